@@ -0,0 +1,39 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <fmt/format.h>
+#include <string_view>
+#include <vector>
+
+namespace bench {
+
+struct Result {
+    double mMin; // milliseconds
+    double mMedian;
+};
+
+// Runs body() iterations times and reports the min and median wall time
+template <typename Body>
+Result Measure(int iterations, Body&& body)
+{
+    std::vector<double> samples;
+    samples.reserve(iterations);
+
+    for (int i { 0 }; i < iterations; i++) {
+        auto start { std::chrono::steady_clock::now() };
+        body();
+        auto end { std::chrono::steady_clock::now() };
+        samples.emplace_back(std::chrono::duration<double, std::milli>(end - start).count());
+    }
+
+    std::sort(samples.begin(), samples.end());
+    return { samples.front(), samples[samples.size() / 2] };
+}
+
+inline void Print(std::string_view name, const Result& result)
+{
+    fmt::print("{:<24} min={:>9.3f}ms median={:>9.3f}ms\n", name, result.mMin, result.mMedian);
+}
+
+}
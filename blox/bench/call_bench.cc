@@ -0,0 +1,69 @@
+#include "bench.h"
+
+#include <compiler/compiler.h>
+#include <driver/error_reporter.h>
+#include <ir/ir.h>
+#include <vm/vm.h>
+
+#include <fmt/format.h>
+#include <spdlog/spdlog.h>
+
+#include <cstdlib>
+
+// Recursive fib, nearly all of its time goes into kCall and kReturn.
+// Usage: call_bench [iterations] [n]
+
+namespace {
+
+// Calls made by fib(n), counting the outermost one
+double CallCount(int n)
+{
+    double a { 1 };
+    double b { 1 };
+    for (int i { 1 }; i < n; i++) {
+        double next { a + b + 1 };
+        a = b;
+        b = next;
+    }
+    return b;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    int iterations { argc > 1 ? std::atoi(argv[1]) : 5 };
+    int n { argc > 2 ? std::atoi(argv[2]) : 30 };
+
+    spdlog::set_level(spdlog::level::warn);
+
+    std::string source { fmt::format(R"(
+fun fib(n) {{
+    if (n < 2) return n;
+    return fib(n - 1) + fib(n - 2);
+}}
+var result = fib({});
+)",
+        n) };
+
+    driver::ErrorReporter errorReporter {};
+    ir::Heap heap {};
+    ir::GlobalTable globals {};
+
+    compiler::Compiler compiler(source, &heap, &globals, &errorReporter);
+    ir::ObjectFunction* main { compiler.Compile() };
+    if (errorReporter.HadErrors()) {
+        return 1;
+    }
+
+    bench::Result result { bench::Measure(iterations, [&]() {
+        vm::Vm vm(main, &heap, &globals, &errorReporter);
+        vm.Run();
+    }) };
+    bench::Print(fmt::format("fib({})", n), result);
+
+    double calls { CallCount(n) };
+    fmt::print("{:.0f} calls, {:.2f}ns per call (median)\n", calls, result.mMedian * 1e6 / calls);
+
+    return errorReporter.HadErrors() ? 1 : 0;
+}
@@ -0,0 +1,68 @@
+#include "bench.h"
+
+#include <compiler/compiler.h>
+#include <driver/error_reporter.h>
+#include <ir/ir.h>
+
+#include <fmt/format.h>
+#include <spdlog/spdlog.h>
+
+#include <cstdlib>
+#include <string>
+
+// Compile throughput on a generated script, front end and peephole pass
+// included. Nothing is run.
+// Usage: compile_bench [iterations] [lines]
+
+namespace {
+
+constexpr int kLinesPerBlock { 11 }; // a function and the global calling it
+
+// Every kind of token and most statements, kLinesPerBlock lines at a time
+std::string Generate(int lines)
+{
+    std::string source;
+    for (int i { 0 }; i < lines / kLinesPerBlock; i++) {
+        source += fmt::format(R"(fun f{0}(a, b) {{
+    var c = a * 2 + b - (a / 3) + {0};
+    if (c > 10 and a != b or !(c <= -1)) {{
+        c = c - 1;
+    }} else {{
+        print "branch" + " {0}";
+    }}
+    for (var i = 0; i < 10; i = i + 1) c = c + i * a;
+    return c >= nil == true;
+}}
+var g{1} = f{0}(1, 2.5);
+)",
+            i, i % 100);
+    }
+    return source;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    int iterations { argc > 1 ? std::atoi(argv[1]) : 10 };
+    int lines { argc > 2 ? std::atoi(argv[2]) : 100000 };
+
+    spdlog::set_level(spdlog::level::warn);
+
+    std::string source { Generate(lines) };
+    lines = lines / kLinesPerBlock * kLinesPerBlock; // whole blocks only
+
+    bool failed { false };
+    bench::Result result { bench::Measure(iterations, [&]() {
+        driver::ErrorReporter errorReporter {};
+        ir::Heap heap {};
+        ir::GlobalTable globals {};
+        compiler::Compiler compiler(source, &heap, &globals, &errorReporter);
+        compiler.Compile();
+        failed |= errorReporter.HadErrors();
+    }) };
+    bench::Print(fmt::format("compile {} lines", lines), result);
+    fmt::print("{:.0f} lines/s (median)\n", lines / (result.mMedian / 1000));
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,76 @@
+#include "bench.h"
+
+#include <compiler/compiler.h>
+#include <driver/error_reporter.h>
+#include <ir/ir.h>
+#include <vm/vm.h>
+
+#include <fmt/format.h>
+#include <spdlog/spdlog.h>
+
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <string>
+
+// Compiles one script and runs the same chunk through every dispatch engine.
+// Usage: dispatch_bench [iterations] [script]
+
+namespace {
+
+const char* kDefaultSource { R"(
+var sum = 0;
+for (var i = 0; i < 1000000; i = i + 1) {
+    var x = i * 2;
+    if (x > 10 and x < 1000) {
+        sum = sum + x - 1;
+    } else {
+        sum = sum - 1;
+    }
+}
+)" };
+
+std::string ReadFile(const char* path)
+{
+    return { std::istreambuf_iterator<char>(std::ifstream(path).rdbuf()),
+        std::istreambuf_iterator<char>() };
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    int iterations { argc > 1 ? std::atoi(argv[1]) : 10 };
+    std::string source { argc > 2 ? ReadFile(argv[2]) : kDefaultSource };
+
+    spdlog::set_level(spdlog::level::warn);
+
+    driver::ErrorReporter errorReporter {};
+    ir::Heap heap {};
+    ir::GlobalTable globals {};
+    compiler::Compiler compiler(source, &heap, &globals, &errorReporter);
+    ir::ObjectFunction* main { compiler.Compile() };
+    if (errorReporter.HadErrors()) {
+        return 1;
+    }
+
+    auto measure { [&](vm::Vm::Dispatch dispatch) {
+        return bench::Measure(iterations, [&]() {
+            vm::Vm vm(main, &heap, &globals, &errorReporter);
+            vm.Run(dispatch);
+        });
+    } };
+
+    bench::Result switchResult { measure(vm::Vm::Dispatch::kSwitch) };
+    bench::Print("switch", switchResult);
+
+#ifdef BLOX_HAS_COMPUTED_GOTO
+    bench::Result threadedResult { measure(vm::Vm::Dispatch::kThreaded) };
+    bench::Print("threaded", threadedResult);
+    fmt::print("speedup (median): {:.2f}x\n", switchResult.mMedian / threadedResult.mMedian);
+#else
+    fmt::print("threaded dispatch not compiled in (BLOX_THREADED_DISPATCH=OFF or unsupported compiler)\n");
+#endif
+
+    return errorReporter.HadErrors() ? 1 : 0;
+}
@@ -0,0 +1,78 @@
+#include "bench.h"
+
+#include <compiler/compiler.h>
+#include <driver/error_reporter.h>
+#include <ir/ir.h>
+#include <vm/vm.h>
+
+#include <fmt/format.h>
+#include <spdlog/spdlog.h>
+
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <string>
+
+// Runs one script with the peephole pass off, fully on, and with each
+// rewrite disabled in turn, to see what every single one is worth.
+// Usage: peephole_bench [iterations] [script]
+
+namespace {
+
+const char* kDefaultSource { R"(
+var sum = 0;
+for (var i = 0; i < 1000000; i = i + 1) {
+    var x = i * 2;
+    if (x >= 10 and x <= 1000 and x != 500) {
+        sum = sum + x - 1;
+    } else {
+        sum = sum - 1;
+    }
+}
+)" };
+
+std::string ReadFile(const char* path)
+{
+    return { std::istreambuf_iterator<char>(std::ifstream(path).rdbuf()),
+        std::istreambuf_iterator<char>() };
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    int iterations { argc > 1 ? std::atoi(argv[1]) : 10 };
+    std::string source { argc > 2 ? ReadFile(argv[2]) : kDefaultSource };
+
+    spdlog::set_level(spdlog::level::warn);
+
+    driver::ErrorReporter errorReporter {};
+    ir::Heap heap {};
+    ir::GlobalTable globals {};
+
+    auto measure { [&](std::string_view name, const compiler::Options& options) {
+        compiler::Compiler compiler(source, &heap, &globals, &errorReporter, options);
+        ir::ObjectFunction* main { compiler.Compile() };
+        if (errorReporter.HadErrors()) {
+            std::exit(1);
+        }
+        bench::Result result { bench::Measure(iterations, [&]() {
+            vm::Vm vm(main, &heap, &globals, &errorReporter);
+            vm.Run();
+        }) };
+        bench::Print(fmt::format("{} ({}b)", name, main->mChunk.mBytecode.size()), result);
+        return result;
+    } };
+
+    bench::Result off { measure("peephole off", { .mPeephole = false }) };
+    bench::Result on { measure("peephole on", {}) };
+    measure("no kGreaterEqual", { .mPeepholeOptions { .mGreaterEqual = false } });
+    measure("no kLessEqual", { .mPeepholeOptions { .mLessEqual = false } });
+    measure("no kNotEqual", { .mPeepholeOptions { .mNotEqual = false } });
+    measure("no kAddLocalConst", { .mPeepholeOptions { .mAddLocalConst = false } });
+    measure("no kJumpIfFalsePop", { .mPeepholeOptions { .mJumpIfFalsePop = false } });
+    measure("no jump threading", { .mPeepholeOptions { .mThreadJumps = false } });
+    fmt::print("speedup (median): {:.2f}x\n", off.mMedian / on.mMedian);
+
+    return errorReporter.HadErrors() ? 1 : 0;
+}
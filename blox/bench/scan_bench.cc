@@ -0,0 +1,61 @@
+#include "bench.h"
+
+#include <compiler/scanner.h>
+#include <driver/error_reporter.h>
+
+#include <fmt/format.h>
+#include <spdlog/spdlog.h>
+
+#include <cstdlib>
+#include <string>
+
+// Scanner throughput over a generated source with long identifiers, strings,
+// comments and indentation. Only tokens are produced, nothing is compiled.
+// Usage: scan_bench [iterations] [megabytes]
+
+namespace {
+
+std::string Generate(size_t bytes)
+{
+    std::string source;
+    for (int i { 0 }; source.size() < bytes; i++) {
+        source += fmt::format(R"(// helper number {0}, computes an accumulated total for the report
+fun accumulate_total_{0}(first_argument, second_argument) {{
+        var running_total_value = first_argument * 2 + second_argument - {0}.5;
+        if (running_total_value >= 100 and first_argument != nil) {{
+                print "the running total went over one hundred in helper {0}";
+        }}
+        while (running_total_value < 1000) running_total_value = running_total_value + 1;
+        return running_total_value or false;
+}}
+)",
+            i);
+    }
+    return source;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    int iterations { argc > 1 ? std::atoi(argv[1]) : 10 };
+    size_t megabytes { argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 16 };
+
+    spdlog::set_level(spdlog::level::warn);
+
+    std::string source { Generate(megabytes << 20) };
+    driver::ErrorReporter errorReporter {};
+
+    size_t tokens { 0 };
+    bench::Result result { bench::Measure(iterations, [&]() {
+        compiler::Scanner scanner(source, &errorReporter);
+        tokens = 0;
+        while (scanner.ScanToken().mType != compiler::Token::Type::kEof) {
+            tokens++;
+        }
+    }) };
+    bench::Print(fmt::format("scan {} MiB", source.size() >> 20), result);
+    fmt::print("{} tokens, {:.3f} GB/s (median)\n", tokens, source.size() / (result.mMedian / 1000) / 1e9);
+
+    return errorReporter.HadErrors() ? 1 : 0;
+}
@@ -0,0 +1,216 @@
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+// Runs every script under every interpreter a few times, each run in a fresh
+// process, and reports wall time and peak RSS. Output of the scripts (and the
+// interpreters' logging) goes to /dev/null. A run that exits non-zero marks
+// the script as failed for that interpreter, which is how blox reports the
+// workloads that need classes.
+//
+// Usage: suite_runner [--runs N] [--json file] [--label text]
+//            --interpreter name=command [--interpreter ...] script...
+// command is split on spaces, the script path is appended to it.
+
+namespace {
+
+struct Interpreter {
+    std::string mName;
+    std::vector<std::string> mCommand;
+};
+
+struct Run {
+    double mMilliseconds;
+    long mMaxRssKb;
+};
+
+struct Result {
+    std::string mBenchmark;
+    std::string mInterpreter;
+    bool mOk;
+    double mMin;
+    double mMedian;
+    double mStddev;
+    long mMaxRssKb; // over all runs
+};
+
+std::vector<std::string> Split(std::string_view command)
+{
+    std::vector<std::string> words;
+    std::istringstream in { std::string { command } };
+    for (std::string word; in >> word;) {
+        words.emplace_back(word);
+    }
+    return words;
+}
+
+// fork, exec, wait4: the rusage of the child alone, unlike getrusage(RUSAGE_CHILDREN)
+std::optional<Run> RunOnce(const Interpreter& interpreter, const std::string& script)
+{
+    std::vector<char*> argv;
+    for (const std::string& word : interpreter.mCommand) {
+        argv.emplace_back(const_cast<char*>(word.c_str()));
+    }
+    argv.emplace_back(const_cast<char*>(script.c_str()));
+    argv.emplace_back(nullptr);
+
+    auto start { std::chrono::steady_clock::now() };
+    pid_t pid { fork() };
+    if (pid == -1) {
+        return std::nullopt;
+    }
+    if (pid == 0) {
+        int null { open("/dev/null", O_WRONLY) };
+        dup2(null, STDOUT_FILENO);
+        dup2(null, STDERR_FILENO);
+        execv(argv[0], argv.data());
+        _exit(127);
+    }
+
+    int status {};
+    rusage usage {};
+    if (wait4(pid, &status, 0, &usage) == -1) {
+        return std::nullopt;
+    }
+    auto end { std::chrono::steady_clock::now() };
+
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        return std::nullopt;
+    }
+    return Run { std::chrono::duration<double, std::milli>(end - start).count(), usage.ru_maxrss };
+}
+
+Result Measure(const Interpreter& interpreter, const std::string& script, int runs)
+{
+    Result result { std::filesystem::path(script).stem().string(), interpreter.mName, false, 0, 0, 0, 0 };
+
+    std::vector<double> samples;
+    for (int i { 0 }; i < runs; i++) {
+        std::optional<Run> run { RunOnce(interpreter, script) };
+        if (!run) {
+            return result;
+        }
+        samples.emplace_back(run->mMilliseconds);
+        result.mMaxRssKb = std::max(result.mMaxRssKb, run->mMaxRssKb);
+    }
+
+    std::sort(samples.begin(), samples.end());
+    double mean { 0 };
+    for (double sample : samples) {
+        mean += sample / samples.size();
+    }
+    double variance { 0 };
+    for (double sample : samples) {
+        variance += (sample - mean) * (sample - mean);
+    }
+
+    result.mOk = true;
+    result.mMin = samples.front();
+    result.mMedian = samples[samples.size() / 2];
+    result.mStddev = samples.size() > 1 ? std::sqrt(variance / (samples.size() - 1)) : 0.0;
+    return result;
+}
+
+std::string ToJson(const std::vector<Result>& results, int runs, std::string_view label)
+{
+    // Names come from file names and the command line, nothing that needs escaping
+    std::string json { fmt::format("{{\n  \"label\": \"{}\",\n  \"runs\": {},\n  \"results\": [", label, runs) };
+    for (std::size_t i { 0 }; i < results.size(); i++) {
+        const Result& result { results[i] };
+        json += fmt::format("{}\n    {{ \"benchmark\": \"{}\", \"interpreter\": \"{}\", \"ok\": {}", i == 0 ? "" : ",",
+            result.mBenchmark, result.mInterpreter, result.mOk);
+        if (result.mOk) {
+            json += fmt::format(", \"min_ms\": {:.3f}, \"median_ms\": {:.3f}, \"stddev_ms\": {:.3f}, \"max_rss_kb\": {}",
+                result.mMin, result.mMedian, result.mStddev, result.mMaxRssKb);
+        }
+        json += " }";
+    }
+    json += "\n  ]\n}\n";
+    return json;
+}
+
+int Usage()
+{
+    fmt::print(stderr, "Usage: suite_runner [--runs N] [--json file] [--label text] "
+                       "--interpreter name=command [--interpreter ...] script...\n");
+    return 2;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    int runs { 5 };
+    std::string jsonPath;
+    std::string label;
+    std::vector<Interpreter> interpreters;
+    std::vector<std::string> scripts;
+
+    for (int i { 1 }; i < argc; i++) {
+        std::string_view arg { argv[i] };
+        bool hasValue { i + 1 < argc };
+        if (arg == "--runs" && hasValue) {
+            runs = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--json" && hasValue) {
+            jsonPath = argv[++i];
+        } else if (arg == "--label" && hasValue) {
+            label = argv[++i];
+        } else if (arg == "--interpreter" && hasValue) {
+            std::string_view spec { argv[++i] };
+            std::size_t equals { spec.find('=') };
+            if (equals == std::string_view::npos || Split(spec.substr(equals + 1)).empty()) {
+                return Usage();
+            }
+            interpreters.emplace_back(std::string { spec.substr(0, equals) }, Split(spec.substr(equals + 1)));
+        } else if (!arg.starts_with("--")) {
+            scripts.emplace_back(arg);
+        } else {
+            return Usage();
+        }
+    }
+    if (interpreters.empty() || scripts.empty()) {
+        return Usage();
+    }
+    std::sort(scripts.begin(), scripts.end());
+
+    std::vector<Result> results;
+    fmt::print("{:<16}{:<10}{:>12}{:>12}{:>12}{:>14}\n", "benchmark", "", "min", "median", "stddev", "peak rss");
+    for (const std::string& script : scripts) {
+        for (const Interpreter& interpreter : interpreters) {
+            Result result { Measure(interpreter, script, runs) };
+            if (result.mOk) {
+                fmt::print("{:<16}{:<10}{:>10.1f}ms{:>10.1f}ms{:>10.1f}ms{:>11}KiB\n", result.mBenchmark,
+                    result.mInterpreter, result.mMin, result.mMedian, result.mStddev, result.mMaxRssKb);
+            } else {
+                fmt::print("{:<16}{:<10}{:>12}\n", result.mBenchmark, result.mInterpreter, "failed");
+            }
+            std::fflush(stdout);
+            results.emplace_back(result);
+        }
+    }
+
+    if (!jsonPath.empty()) {
+        std::ofstream out { jsonPath };
+        out << ToJson(results, runs, label);
+        if (!out) {
+            fmt::print(stderr, "cannot write {}\n", jsonPath);
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,90 @@
+#include "bench.h"
+
+#include <ir/value.h>
+
+#include <fmt/format.h>
+
+#include <cstdlib>
+#include <vector>
+
+// Exercises ir::Value the way the VM does: copies through a value stack,
+// type checks and arithmetic, plus a linear scan over a large array that is
+// bound by memory bandwidth. Built as value_bench_tagged and value_bench_nanbox.
+// Usage: value_bench_<layout> [iterations]
+
+namespace {
+
+#ifdef BLOX_NAN_BOXING
+constexpr const char* kLayout { "nan-boxed" };
+#else
+constexpr const char* kLayout { "tagged union" };
+#endif
+
+constexpr int kArraySize { 1 << 22 };
+constexpr int kStackSize { 256 };
+constexpr int kSteps { 1 << 24 };
+
+// Keeps the optimizer from dropping the work
+volatile double gSink;
+
+double StackMachine(const std::vector<ir::Value>& constants)
+{
+    ir::Value stack[kStackSize];
+    ir::Value* top { stack };
+    *top++ = ir::Value(0.0);
+
+    for (int i { 0 }; i < kSteps; i++) {
+        *top++ = constants[i & (constants.size() - 1)];
+        ir::Value b { *--top };
+        ir::Value a { *--top };
+        if (a.IsNumber() && b.IsNumber()) {
+            *top++ = ir::Value(a.AsNumber() + b.AsNumber());
+        } else if (b.GetType() == ir::Value::Type::kBool && b.AsBool()) {
+            *top++ = ir::Value(a.AsNumber() + 1.0);
+        } else {
+            *top++ = a;
+        }
+    }
+    return top[-1].AsNumber();
+}
+
+double Scan(const std::vector<ir::Value>& values)
+{
+    double sum { 0.0 };
+    for (const ir::Value& value : values) {
+        if (value.IsNumber()) {
+            sum += value.AsNumber();
+        }
+    }
+    return sum;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    int iterations { argc > 1 ? std::atoi(argv[1]) : 10 };
+
+    std::vector<ir::Value> constants;
+    for (int i { 0 }; i < 64; i++) {
+        if (i % 8 == 0) {
+            constants.emplace_back(i % 16 == 0);
+        } else if (i % 8 == 1) {
+            constants.emplace_back();
+        } else {
+            constants.emplace_back(static_cast<double>(i));
+        }
+    }
+
+    std::vector<ir::Value> values;
+    values.reserve(kArraySize);
+    for (int i { 0 }; i < kArraySize; i++) {
+        values.emplace_back(i % 4 == 0 ? ir::Value() : ir::Value(static_cast<double>(i)));
+    }
+
+    fmt::print("layout: {}, sizeof(Value) = {}\n", kLayout, sizeof(ir::Value));
+    bench::Print("stack machine", bench::Measure(iterations, [&]() { gSink = StackMachine(constants); }));
+    bench::Print("array scan", bench::Measure(iterations, [&]() { gSink = Scan(values); }));
+
+    return 0;
+}
@@ -1,31 +1,63 @@
+#include <compiler/source.h>
 #include <driver/driver.h>
 
 #include <spdlog/spdlog.h>
 
-#include <fstream>
 #include <iostream>
-#include <iterator>
-
-std::string readFile(const char* path)
-{
-    return { std::istreambuf_iterator<char>(std::ifstream(path).rdbuf()),
-        std::istreambuf_iterator<char>() };
-}
+#include <memory>
+#include <string_view>
+#include <unistd.h>
 
 int main(int argc, char** argv)
 {
-    if (argc > 2) {
-        std::cerr << "Usage: blox [script]" << std::endl;
-        return 0;
+    ir::GcOptions gcOptions {};
+    bool useCache { true };
+    bool verbose { false };
+    vm::Options vmOptions {};
+    driver::Options options {};
+    const char* script { nullptr };
+
+    for (int i { 1 }; i < argc; i++) {
+        std::string_view arg { argv[i] };
+        if (arg == "--gc-stress") {
+            gcOptions.mStress = true;
+        } else if (arg == "--no-cache") {
+            useCache = false;
+        } else if (arg == "--disassemble") {
+            options.mDisassemble = true;
+        } else if (arg == "--trace") {
+            vmOptions.mTrace = true;
+        } else if (arg == "--verbose") {
+            verbose = true;
+        } else if (arg == "--register-vm") {
+            options.mBackend = driver::Options::Backend::kRegister;
+        } else if (arg == "--profile-ops") {
+            vmOptions.mProfileOps = true;
+        } else if (arg == "--sample-profile") {
+            vmOptions.mSampleProfilePath = "blox.folded";
+        } else if (arg.starts_with("--sample-profile=")) {
+            vmOptions.mSampleProfilePath = arg.substr(arg.find('=') + 1);
+        } else if (!arg.starts_with("--") && script == nullptr) {
+            script = argv[i];
+        } else {
+            std::cerr << "Usage: blox [--gc-stress] [--no-cache] [--disassemble] [--trace] [--verbose]"
+                      << " [--register-vm] [--profile-ops] [--sample-profile[=file]] [script | -]" << std::endl;
+            return 0;
+        }
     }
 
-    spdlog::set_level(spdlog::level::debug);
+    // Errors and warnings only, --verbose brings back the GC and cache chatter
+    spdlog::set_level(verbose ? spdlog::level::debug : spdlog::level::warn);
     spdlog::info("blox starting");
 
-    driver::Driver driver {};
+    driver::Driver driver { gcOptions, vmOptions, options };
 
-    if (argc == 2) {
-        driver.Run(readFile(argv[1]));
+    if (script != nullptr && std::string_view { script } == "-") {
+        // The program is read from stdin as it arrives
+        return driver.Run(std::make_unique<compiler::StreamSource>(STDIN_FILENO)) ? 0 : 1;
+    } else if (script != nullptr) {
+        // Scripts report failure through the exit status, for the benchmark runner and friends
+        return driver.RunFile(script, useCache) ? 0 : 1;
     } else {
         std::string line;
         std::cout << "> ";
@@ -1,11 +1,15 @@
 #include "compiler.h"
+#include "peephole.h"
 #include "token.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cstdint>
 #include <ir/ierror_reporter.h>
 #include <ir/ir.h>
+#include <ir/verifier.h>
 #include <magic_enum/magic_enum.hpp>
+#include <optional>
 #include <ranges>
 #include <spdlog/spdlog.h>
 
@@ -15,95 +19,35 @@
 
 namespace compiler {
 
-Compiler::Compiler(std::string_view source, ir::IErrorReporter* errorReporter)
-    : mScanner(source, errorReporter)
+Compiler::Compiler(std::string_view source, ir::Heap* heap, ir::GlobalTable* globals,
+    ir::IErrorReporter* errorReporter, const Options& options)
+    : Compiler(std::make_unique<StringSource>(source), heap, globals, errorReporter, options)
+{
+}
+
+Compiler::Compiler(std::unique_ptr<Source> source, ir::Heap* heap, ir::GlobalTable* globals,
+    ir::IErrorReporter* errorReporter, const Options& options)
+    : mScanner(std::move(source), errorReporter)
+    , mHeap { heap }
+    , mGlobals { globals }
     , mErrorReporter { errorReporter }
-    , mParseRules(magic_enum::enum_count<Token::Type>())
-    , mMain { std::make_unique<ir::ObjectFunction>("main", ir::ObjectFunction::Type::kMain, 0) }
-    , mCurrentFunction { mMain.get() }
+    , mOptions { options }
+    , mMain { heap->NewFunction("main", ir::ObjectFunction::Type::kMain, 0) }
+    , mCurrentFunction { mMain }
     , mCurrentChunk { &mMain->mChunk }
     , mScopeDepth { 0 }
 {
     mErrorReporter->SetPrefix("Compiler");
-    mLocals.reserve(kLocalVariablesCount);
-
-    struct UnboundRule {
-        Token::Type mType;
-        std::function<void(Compiler*, Precedence)> mPrefix;
-        std::function<void(Compiler*, Precedence)> mInfix;
-        Precedence mPrecedence;
-    };
-
-    using C = Compiler;
-    using T = Token::Type;
-    using P = Precedence;
-    const std::vector<UnboundRule> rules { {
-        { T::kAnd, nullptr, &C::And, P::kAnd },
-        { T::kBang, &C::Unary, nullptr, P::kNone },
-        { T::kBangEqual, nullptr, &C::Binary, P::kEquality },
-        { T::kClass, nullptr, nullptr, P::kNone },
-        { T::kComma, nullptr, nullptr, P::kNone },
-        { T::kDot, nullptr, nullptr, P::kNone },
-        { T::kElse, nullptr, nullptr, P::kNone },
-        { T::kEof, nullptr, nullptr, P::kNone },
-        { T::kEqual, nullptr, nullptr, P::kNone },
-        { T::kEqualEqual, nullptr, &C::Binary, P::kEquality },
-        { T::kError, nullptr, nullptr, P::kNone },
-        { T::kFalse, &C::False, nullptr, P::kNone },
-        { T::kFor, nullptr, nullptr, P::kNone },
-        { T::kFun, nullptr, nullptr, P::kNone },
-        { T::kGreater, nullptr, &C::Binary, P::kComparison },
-        { T::kGreaterEqual, nullptr, &C::Binary, P::kComparison },
-        { T::kIdentifier, &C::Identifier, nullptr, P::kNone },
-        { T::kIf, nullptr, nullptr, P::kNone },
-        { T::kLeftBrace, nullptr, nullptr, P::kNone },
-        { T::kLeftParen, &C::Grouping, nullptr, P::kNone },
-        { T::kLess, nullptr, &C::Binary, P::kComparison },
-        { T::kLessEqual, nullptr, &C::Binary, P::kComparison },
-        { T::kMinus, &C::Unary, &C::Binary, P::kTerm },
-        { T::kNil, &C::Nil, nullptr, P::kNone },
-        { T::kNumber, &C::Number, nullptr, P::kNone },
-        { T::kOr, nullptr, &C::Or, P::kOr },
-        { T::kPlus, nullptr, &C::Binary, P::kTerm },
-        { T::kPrint, nullptr, nullptr, P::kNone },
-        { T::kReturn, nullptr, nullptr, P::kNone },
-        { T::kRightBrace, nullptr, nullptr, P::kNone },
-        { T::kRightParen, nullptr, nullptr, P::kNone },
-        { T::kSemicolon, nullptr, nullptr, P::kNone },
-        { T::kSlash, nullptr, &C::Binary, P::kFactor },
-        { T::kStar, nullptr, &C::Binary, P::kFactor },
-        { T::kString, &C::String, nullptr, P::kNone },
-        { T::kSuper, nullptr, nullptr, P::kNone },
-        { T::kThis, nullptr, nullptr, P::kNone },
-        { T::kTrue, &C::True, nullptr, P::kNone },
-        { T::kVar, nullptr, nullptr, P::kNone },
-        { T::kWhile, nullptr, nullptr, P::kNone },
-    } };
-    assert(rules.size() == magic_enum::enum_count<Token::Type>());
-
-    auto bindRule { [this](UnboundRule rule) -> ParseRule {
-        ParseRule ret;
-        if (rule.mPrefix) {
-            ret.mPrefix = std::bind(rule.mPrefix, this, std::placeholders::_1);
-        } else {
-            ret.mPrefix = nullptr;
-        }
-
-        if (rule.mInfix) {
-            ret.mInfix = std::bind(rule.mInfix, this, std::placeholders::_1);
-        } else {
-            ret.mInfix = nullptr;
-        }
-        ret.mPrecedence = rule.mPrecedence;
-        return ret;
-    } };
+    mLocals.emplace_back("", 0); // slot 0, the running function
+    mHeap->AddRootProvider(this);
+}
 
-    for (auto& rule : rules) {
-        mParseRules[static_cast<int>(rule.mType)] = bindRule(rule);
-    }
+Compiler::~Compiler()
+{
+    mHeap->RemoveRootProvider(this);
 }
 
-std::unique_ptr<ir::ObjectFunction> Compiler::Compile()
+ir::ObjectFunction* Compiler::Compile()
 {
     spdlog::info("compiling..");
 
@@ -114,48 +58,70 @@ std::unique_ptr<ir::ObjectFunction> Compiler::Compile()
     }
 
     mCurrentChunk->AddByte(ir::Opcode::kEof, eof.mLine);
+    FinishChunk(eof.mLine);
+
+    return mMain;
+}
 
-    return std::move(mMain);
+void Compiler::MarkRoots(ir::Heap& heap)
+{
+    heap.MarkObject(mMain);
+    // Functions being compiled are not in any constant pool yet
+    heap.MarkObject(mCurrentFunction);
+    for (EnclosingFunction& enclosing : mEnclosing) {
+        heap.MarkObject(enclosing.mFunction);
+    }
 }
 
 void Compiler::ParseWithPrecedence(Precedence minPrecedence)
 {
-    Token token = mScanner.PeekToken();
+    const Token& token = mScanner.PeekToken();
     if (token.mType == Token::Type::kEof)
         return;
 
-    ParseRule rule { GetRule(token) };
+    const ParseRule& rule { GetRule(token.mType) };
     if (!rule.mPrefix) {
         mErrorReporter->Report(token.mLine, fmt::format("Expected expression, instead got token {}", token));
         return;
     }
 
-    rule.mPrefix(minPrecedence);
+    (this->*rule.mPrefix)(minPrecedence);
 
     for (;;) {
-        Token infix = mScanner.PeekToken();
+        const Token& infix = mScanner.PeekToken();
         if (infix.mType == Token::Type::kEqual) {
             mErrorReporter->Report(infix.mLine, "Invalid assignment target");
             return;
         }
 
-        ParseRule infixRule { GetRule(infix) };
+        const ParseRule& infixRule { GetRule(infix.mType) };
         if (!infixRule.mInfix || infixRule.mPrecedence <= minPrecedence)
             break;
 
-        infixRule.mInfix(minPrecedence);
+        (this->*infixRule.mInfix)(minPrecedence);
     }
 }
 
 void Compiler::Declaration()
 {
     Token token { mScanner.PeekToken() };
+    uint64_t scanned { mScanner.ScannedCount() };
     if (token.mType == Token::Type::kVar) {
         mScanner.ScanToken();
         DeclarationVariable();
+    } else if (token.mType == Token::Type::kFun) {
+        mScanner.ScanToken();
+        DeclarationFunction();
     } else {
         Statement();
     }
+
+    // A declaration that fails on its very first token (e.g. class, which is
+    // not supported) consumes nothing, and every loop over declarations would
+    // spin on it forever. The error is already reported, skip the token.
+    if (token.mType != Token::Type::kEof && mScanner.ScannedCount() == scanned) {
+        mScanner.ScanToken();
+    }
 }
 
 void Compiler::DeclarationVariable()
@@ -164,10 +130,10 @@ void Compiler::DeclarationVariable()
 
     if (mScopeDepth == 0) {
         // Global
-        std::optional<uint8_t> nameOptional { AddIdentifier(name) };
-        if (nameOptional == std::nullopt)
+        std::optional<uint16_t> slotOptional { ResolveGlobal(name) };
+        if (slotOptional == std::nullopt)
             return;
-        uint8_t nameIndex { nameOptional.value() };
+        uint16_t slot { slotOptional.value() };
 
         Token equals { mScanner.PeekToken() };
         if (equals.mType == Token::Type::kEqual) {
@@ -181,29 +147,13 @@ void Compiler::DeclarationVariable()
             return;
         }
 
-        mCurrentChunk->AddByte(ir::Opcode::kGlobalDefine, name.mLine);
-        mCurrentChunk->AddByte(nameIndex, name.mLine);
+        EmitGlobal(ir::Opcode::kGlobalDefine, slot, name.mLine);
     } else {
         // Local
-        for (auto& local : std::ranges::views::reverse(mLocals)) {
-            if (local.mDepth < mScopeDepth) {
-                break;
-            }
-            if (local.mName == name.mLexeme) {
-                mErrorReporter->Report(name.mLine,
-                    fmt::format("Variable {} already exists in local scope", name.mLexeme));
-                return;
-            }
-        }
-
-        if (mLocals.size() == kLocalVariablesCount) {
-            mErrorReporter->Report(name.mLine,
-                fmt::format("More than {} local variables cannot be kept in scope",
-                    kLocalVariablesCount));
+        if (!DeclareLocal(name.mLexeme, name.mLine)) {
+            return;
         }
 
-        // Shift this code into helpers?
-        mLocals.emplace_back(name.mLexeme, -1);
         Token equals { mScanner.PeekToken() };
         if (equals.mType == Token::Type::kEqual) {
             mScanner.ScanToken();
@@ -220,6 +170,25 @@ void Compiler::DeclarationVariable()
     }
 }
 
+void Compiler::DeclarationFunction()
+{
+    Token name { mScanner.ScanToken() };
+
+    if (mScopeDepth == 0) {
+        std::optional<uint16_t> slot { ResolveGlobal(name) };
+        if (slot == std::nullopt)
+            return;
+        Function(name);
+        EmitGlobal(ir::Opcode::kGlobalDefine, slot.value(), name.mLine);
+    } else {
+        // There are no closures, so the body cannot see this local anyway
+        if (!DeclareLocal(name.mLexeme, name.mLine))
+            return;
+        Function(name);
+        mLocals.back().mDepth = mScopeDepth;
+    }
+}
+
 void Compiler::Statement()
 {
     Token token { mScanner.PeekToken() };
@@ -233,6 +202,8 @@ void Compiler::Statement()
         StatementWhile();
     } else if (token.mType == Token::Type::kFor) {
         StatementFor();
+    } else if (token.mType == Token::Type::kReturn) {
+        StatementReturn();
     } else {
         StatementExpression();
     }
@@ -283,10 +254,24 @@ void Compiler::StatementIf()
 
     if (!Consume(Token::Type::kLeftParen))
         return;
+    int conditionStart { static_cast<int>(mCurrentChunk->mBytecode.size()) };
     Expression();
     if (!Consume(Token::Type::kRightParen))
         return;
 
+    // Known condition: no jumps, only the arm that can run is kept
+    if (std::optional<Constant> condition { LastConstant(conditionStart) }) {
+        Truncate(condition->mStart, condition->mConstantsStart);
+        bool isTrue { IsTruthy(GetValue(*condition)) };
+
+        isTrue ? Statement() : StatementDead();
+        if (mScanner.PeekToken().mType == Token::Type::kElse) {
+            mScanner.ScanToken();
+            isTrue ? StatementDead() : Statement();
+        }
+        return;
+    }
+
     int jumpToElse { EmitJump(ir::Opcode::kJumpIfFalse, token.mLine) };
 
     // Then
@@ -313,11 +298,23 @@ void Compiler::StatementWhile()
 
     if (!Consume(Token::Type::kLeftParen))
         return;
-    uint16_t loopStart { static_cast<uint16_t>(mCurrentChunk->mBytecode.size()) };
+    int loopStart { static_cast<int>(mCurrentChunk->mBytecode.size()) };
     Expression();
     if (!Consume(Token::Type::kRightParen))
         return;
 
+    if (std::optional<Constant> condition { LastConstant(loopStart) }) {
+        Truncate(condition->mStart, condition->mConstantsStart);
+        if (!IsTruthy(GetValue(*condition))) {
+            StatementDead();
+            return;
+        }
+        // Nothing can leave the loop, so there is no exit to emit
+        Statement();
+        EmitJump(ir::Opcode::kJump, loopStart, token.mLine);
+        return;
+    }
+
     int jumpToEnd { EmitJump(ir::Opcode::kJumpIfFalse, token.mLine) };
     mCurrentChunk->AddByte(ir::Opcode::kPop, token.mLine);
     Statement();
@@ -346,7 +343,7 @@ void Compiler::StatementFor()
     }
 
     // condition
-    uint16_t conditionStart { static_cast<uint16_t>(mCurrentChunk->mBytecode.size()) };
+    int conditionStart { static_cast<int>(mCurrentChunk->mBytecode.size()) };
     if (mScanner.PeekToken().mType != Token::Type::kSemicolon) {
         Expression();
     } else {
@@ -360,7 +357,7 @@ void Compiler::StatementFor()
     int jumpToBody { EmitJump(ir::Opcode::kJump, token.mLine) };
 
     // increment
-    uint16_t incrementStart { static_cast<uint16_t>(mCurrentChunk->mBytecode.size()) };
+    int incrementStart { static_cast<int>(mCurrentChunk->mBytecode.size()) };
     if (mScanner.PeekToken().mType != Token::Type::kRightParen) {
         Expression();
         mCurrentChunk->AddByte(ir::Opcode::kPop, token.mLine);
@@ -382,6 +379,33 @@ void Compiler::StatementFor()
     EndScope(token);
 }
 
+void Compiler::StatementReturn()
+{
+    Token token { mScanner.ScanToken() };
+    if (mEnclosing.empty()) {
+        mErrorReporter->Report(token.mLine, "Cannot return from top-level code");
+        return;
+    }
+
+    if (mScanner.PeekToken().mType == Token::Type::kSemicolon) {
+        mCurrentChunk->AddByte(ir::Opcode::kNil, token.mLine);
+    } else {
+        Expression();
+    }
+    if (!Consume(Token::Type::kSemicolon)) {
+        return;
+    }
+    mCurrentChunk->AddByte(ir::Opcode::kReturn, token.mLine);
+}
+
+void Compiler::StatementDead()
+{
+    int bytecodeSize { static_cast<int>(mCurrentChunk->mBytecode.size()) };
+    int constantsSize { static_cast<int>(mCurrentChunk->mConstants.size()) };
+    Statement();
+    Truncate(bytecodeSize, constantsSize);
+}
+
 void Compiler::Expression()
 {
     ParseWithPrecedence(Precedence::kAssignment);
@@ -394,20 +418,19 @@ void Compiler::Identifier(Precedence minPrecedence)
     int resolvedLocal { ResolveLocal(token.mLexeme) };
     if (resolvedLocal == -1) {
         // Global
-        std::optional<uint8_t> identifierOptional { AddIdentifier(token) };
-        if (identifierOptional == std::nullopt)
+        std::optional<uint16_t> slotOptional { ResolveGlobal(token) };
+        if (slotOptional == std::nullopt)
             return;
-        uint8_t identifierIndex { identifierOptional.value() };
+        uint16_t slot { slotOptional.value() };
 
         Token equals { mScanner.PeekToken() };
         if (minPrecedence <= Precedence::kAssignment && equals.mType == Token::Type::kEqual) {
             mScanner.ScanToken();
             Expression();
-            mCurrentChunk->AddByte(ir::Opcode::kGlobalSet, token.mLine);
+            EmitGlobal(ir::Opcode::kGlobalSet, slot, token.mLine);
         } else {
-            mCurrentChunk->AddByte(ir::Opcode::kGlobalGet, token.mLine);
+            EmitGlobal(ir::Opcode::kGlobalGet, slot, token.mLine);
         }
-        mCurrentChunk->AddByte(identifierIndex, token.mLine);
     } else {
         // Local
 
@@ -415,7 +438,7 @@ void Compiler::Identifier(Precedence minPrecedence)
         if (minPrecedence <= Precedence::kAssignment && equals.mType == Token::Type::kEqual) {
             mScanner.ScanToken();
             Expression();
-            mCurrentChunk->AddByte(ir::Opcode::kLocalSet, token.mLine);
+            EmitLocal(ir::Opcode::kLocalSet, resolvedLocal, token.mLine);
         } else {
             if (mLocals[resolvedLocal].mDepth == -1) {
                 mErrorReporter->Report(token.mLine,
@@ -423,9 +446,8 @@ void Compiler::Identifier(Precedence minPrecedence)
                         token.mLexeme));
                 return;
             }
-            mCurrentChunk->AddByte(ir::Opcode::kLocalGet, token.mLine);
+            EmitLocal(ir::Opcode::kLocalGet, resolvedLocal, token.mLine);
         }
-        mCurrentChunk->AddByte(static_cast<uint8_t>(resolvedLocal), token.mLine);
     }
 }
 
@@ -434,44 +456,60 @@ void Compiler::Number(Precedence minPrecedence)
     Token token = mScanner.ScanToken();
     // TODO: replace std::stod with std::from_chars to avoid unnecessary string copy?
     double number = std::stod(std::string(token.mLexeme));
-    uint8_t index = mCurrentChunk->AddConstant(number);
-    mCurrentChunk->AddBytes({ static_cast<uint8_t>(ir::Opcode::kConstant), index },
-        token.mLine);
+    int start { static_cast<int>(mCurrentChunk->mBytecode.size()) };
+    int constantsStart { static_cast<int>(mCurrentChunk->mConstants.size()) };
+    EmitConstant(ir::Value(number), token.mLine);
+    MarkConstant(start, constantsStart);
 }
 
 void Compiler::String(Precedence minPrecedence)
 {
     Token token { mScanner.ScanToken() };
     std::string_view string { token.mLexeme.substr(1, token.mLexeme.size() - 2) };
-    ir::ObjectString* object { new ir::ObjectString(string) };
+    ir::ObjectString* object { mHeap->NewString(string) };
 
-    uint8_t index { mCurrentChunk->AddConstant(object) };
-    mCurrentChunk->AddByte(ir::Opcode::kConstant, token.mLine);
-    mCurrentChunk->AddByte(index, token.mLine);
+    int start { static_cast<int>(mCurrentChunk->mBytecode.size()) };
+    int constantsStart { static_cast<int>(mCurrentChunk->mConstants.size()) };
+    EmitConstant(ir::Value(object), token.mLine);
+    MarkConstant(start, constantsStart);
 }
 
 void Compiler::Nil(Precedence minPrecedence)
 {
     Token token { mScanner.ScanToken() };
+    int start { static_cast<int>(mCurrentChunk->mBytecode.size()) };
     mCurrentChunk->AddByte(ir::Opcode::kNil, token.mLine);
+    MarkConstant(start, mCurrentChunk->mConstants.size());
 }
 
 void Compiler::True(Precedence minPrecedence)
 {
     Token token { mScanner.ScanToken() };
+    int start { static_cast<int>(mCurrentChunk->mBytecode.size()) };
     mCurrentChunk->AddByte(ir::Opcode::kTrue, token.mLine);
+    MarkConstant(start, mCurrentChunk->mConstants.size());
 }
 
 void Compiler::False(Precedence minPrecedence)
 {
     Token token { mScanner.ScanToken() };
+    int start { static_cast<int>(mCurrentChunk->mBytecode.size()) };
     mCurrentChunk->AddByte(ir::Opcode::kFalse, token.mLine);
+    MarkConstant(start, mCurrentChunk->mConstants.size());
 }
 
 void Compiler::Unary(Precedence minPrecedence)
 {
     Token token = mScanner.ScanToken();
-    ParseWithPrecedence(GetRule(token).mPrecedence);
+    int start { static_cast<int>(mCurrentChunk->mBytecode.size()) };
+    ParseWithPrecedence(GetRule(token.mType).mPrecedence);
+
+    if (std::optional<Constant> operand { LastConstant(start) }) {
+        if (std::optional<ir::Value> folded { FoldUnary(token.mType, GetValue(*operand)) }) {
+            ReplaceWithConstant(*operand, *folded, token.mLine);
+            return;
+        }
+    }
 
     switch (token.mType) {
     case Token::Type::kMinus:
@@ -488,7 +526,22 @@ void Compiler::Unary(Precedence minPrecedence)
 void Compiler::Binary(Precedence minPrecedence)
 {
     Token token = mScanner.ScanToken();
-    ParseWithPrecedence(GetRule(token).mPrecedence);
+    // The left operand is complete by now, if it ended in a constant it was one
+    int rightStart { static_cast<int>(mCurrentChunk->mBytecode.size()) };
+    std::optional<Constant> left { mLastConstant };
+    if (left && left->mEnd != rightStart) {
+        left.reset();
+    }
+    ParseWithPrecedence(GetRule(token.mType).mPrecedence);
+
+    // Operations that would fail at runtime are left for the VM to report
+    std::optional<Constant> right { LastConstant(rightStart) };
+    if (left && right) {
+        if (std::optional<ir::Value> folded { FoldBinary(token.mType, GetValue(*left), GetValue(*right)) }) {
+            ReplaceWithConstant(*left, *folded, token.mLine);
+            return;
+        }
+    }
 
     switch (token.mType) {
     case Token::Type::kPlus:
@@ -560,10 +613,281 @@ void Compiler::Or(Precedence minPrecedence)
     PatchJump(endJump);
 }
 
-void Compiler::Return(Precedence minPrecedence)
+void Compiler::Call(Precedence minPrecedence)
 {
-    Token token = mScanner.ScanToken();
-    // TODO
+    Token token { mScanner.ScanToken() };
+
+    int argumentCount { 0 };
+    if (mScanner.PeekToken().mType != Token::Type::kRightParen) {
+        for (;;) {
+            Expression();
+            if (argumentCount == kMaxArguments) {
+                mErrorReporter->Report(token.mLine, fmt::format("More than {} arguments", kMaxArguments));
+            }
+            argumentCount++;
+
+            if (mScanner.PeekToken().mType != Token::Type::kComma) {
+                break;
+            }
+            mScanner.ScanToken();
+        }
+    }
+    if (!Consume(Token::Type::kRightParen)) {
+        return;
+    }
+
+    mCurrentChunk->AddBytes({ static_cast<uint8_t>(ir::Opcode::kCall), static_cast<uint8_t>(argumentCount) },
+        token.mLine);
+}
+
+void Compiler::Function(Token name)
+{
+    // Copied before the lexemes go stale, see Scanner
+    std::string functionName { name.mLexeme };
+    if (!Consume(Token::Type::kLeftParen)) {
+        return;
+    }
+
+    // The arity has to be known to create the function, so names come first
+    std::vector<std::pair<std::string, int>> parameters; // name and line
+    if (mScanner.PeekToken().mType != Token::Type::kRightParen) {
+        for (;;) {
+            Token parameter { mScanner.ScanToken() };
+            if (parameter.mType != Token::Type::kIdentifier) {
+                mErrorReporter->Report(parameter.mLine, "Expected parameter name");
+                return;
+            }
+            if (parameters.size() == kMaxArguments) {
+                mErrorReporter->Report(parameter.mLine, fmt::format("More than {} parameters", kMaxArguments));
+            }
+            parameters.emplace_back(parameter.mLexeme, parameter.mLine);
+
+            if (mScanner.PeekToken().mType != Token::Type::kComma) {
+                break;
+            }
+            mScanner.ScanToken();
+        }
+    }
+    if (!Consume(Token::Type::kRightParen) || !Consume(Token::Type::kLeftBrace)) {
+        return;
+    }
+
+    ir::ObjectFunction* function { mHeap->NewFunction(functionName,
+        ir::ObjectFunction::Type::kFunction, parameters.size()) };
+    BeginFunction(function);
+
+    for (const auto& [parameter, line] : parameters) {
+        if (DeclareLocal(parameter, line)) {
+            mLocals.back().mDepth = mScopeDepth;
+        }
+    }
+
+    // The body shares the parameters' scope, and needs no pops at the end
+    Token rightBrace { mScanner.PeekToken() };
+    while (rightBrace.mType != Token::Type::kEof && rightBrace.mType != Token::Type::kRightBrace) {
+        Declaration();
+        rightBrace = mScanner.PeekToken();
+    }
+    Consume(Token::Type::kRightBrace);
+
+    EndFunction(rightBrace.mLine);
+
+    // Nothing allocates between EndFunction() unrooting function and the
+    // constant pool taking it over
+    EmitConstant(ir::Value(function), name.mLine);
+}
+
+void Compiler::BeginFunction(ir::ObjectFunction* function)
+{
+    mEnclosing.emplace_back(mCurrentFunction, std::move(mLocals), mScopeDepth, mLastConstant);
+
+    mCurrentFunction = function;
+    mCurrentChunk = &function->mChunk;
+    mLocals.clear();
+    mLocals.emplace_back("", 0); // slot 0, the running function
+    mScopeDepth = 1;
+    mLastConstant.reset();
+}
+
+void Compiler::EndFunction(int line)
+{
+    // Falling off the end returns nil
+    mCurrentChunk->AddBytes({ ir::Opcode::kNil, ir::Opcode::kReturn }, line);
+    FinishChunk(line);
+
+    EnclosingFunction& enclosing { mEnclosing.back() };
+    mCurrentFunction = enclosing.mFunction;
+    mCurrentChunk = &mCurrentFunction->mChunk;
+    mLocals = std::move(enclosing.mLocals);
+    mScopeDepth = enclosing.mScopeDepth;
+    mLastConstant = enclosing.mLastConstant;
+    mEnclosing.pop_back();
+}
+
+void Compiler::FinishChunk(int line)
+{
+    // Jumps are left unpatched when parsing bails out, only finish good chunks
+    if (mErrorReporter->HadErrors()) {
+        return;
+    }
+    Peephole(mOptions.mPeephole ? mOptions.mPeepholeOptions : PeepholeOptions::None()).Optimize(*mCurrentChunk);
+
+    // Also sizes the function's frame for the VM
+    ir::Verifier verifier(mGlobals->Size());
+    if (!verifier.Verify(mCurrentFunction)) {
+        mErrorReporter->Report(line, "Internal error - " + verifier.Error());
+    }
+}
+
+std::optional<Compiler::Constant> Compiler::LastConstant(int start) const
+{
+    if (mLastConstant && mLastConstant->mStart == start && mLastConstant->mEnd == mCurrentChunk->mBytecode.size()) {
+        return mLastConstant;
+    }
+    return std::nullopt;
+}
+
+void Compiler::MarkConstant(int start, int constantsStart)
+{
+    mLastConstant = { start, static_cast<int>(mCurrentChunk->mBytecode.size()), constantsStart };
+}
+
+ir::Value Compiler::GetValue(const Constant& constant) const
+{
+    switch (static_cast<ir::Opcode>(mCurrentChunk->mBytecode[constant.mStart])) {
+    case ir::Opcode::kTrue:
+        return ir::Value(true);
+    case ir::Opcode::kFalse:
+        return ir::Value(false);
+    case ir::Opcode::kConstant:
+        return mCurrentChunk->GetConstant(mCurrentChunk->mBytecode[constant.mStart + 1]);
+    case ir::Opcode::kConstantLong: {
+        const uint8_t* operand { &mCurrentChunk->mBytecode[constant.mStart + 1] };
+        return mCurrentChunk->GetConstant(operand[0] | (operand[1] << 8) | (operand[2] << 16));
+    }
+    default:
+        assert(static_cast<ir::Opcode>(mCurrentChunk->mBytecode[constant.mStart]) == ir::Opcode::kNil);
+        return ir::Value();
+    }
+}
+
+void Compiler::EmitConstant(ir::Value value, int line)
+{
+    switch (value.GetType()) {
+    case ir::Value::Type::kNil:
+        mCurrentChunk->AddByte(ir::Opcode::kNil, line);
+        break;
+    case ir::Value::Type::kBool:
+        mCurrentChunk->AddByte(value.AsBool() ? ir::Opcode::kTrue : ir::Opcode::kFalse, line);
+        break;
+    default: {
+        // A full pool still takes a constant it already holds
+        std::optional<int> existing { mCurrentChunk->FindConstant(value) };
+        if (!existing && mCurrentChunk->mConstants.size() == ir::Chunk::kMaxConstants) {
+            mErrorReporter->Report(line, fmt::format("More than {} constants", ir::Chunk::kMaxConstants));
+            return;
+        }
+        int index { existing ? *existing : mCurrentChunk->AddConstant(value) };
+        mHeap->WriteBarrier(mCurrentFunction, mCurrentChunk->GetConstant(index));
+        if (index <= ir::Chunk::kMaxShortConstant) {
+            mCurrentChunk->AddBytes({ static_cast<uint8_t>(ir::Opcode::kConstant), static_cast<uint8_t>(index) }, line);
+        } else {
+            // Little-endian
+            mCurrentChunk->AddByte(ir::Opcode::kConstantLong, line);
+            mCurrentChunk->AddBytes({ static_cast<uint8_t>(index), static_cast<uint8_t>(index >> 8),
+                                        static_cast<uint8_t>(index >> 16) },
+                line);
+        }
+        break;
+    }
+    }
+}
+
+void Compiler::ReplaceWithConstant(const Constant& from, ir::Value value, int line)
+{
+    // Nothing but the operands was emitted after from, so their constants go too
+    Truncate(from.mStart, from.mConstantsStart);
+    EmitConstant(value, line);
+    MarkConstant(from.mStart, from.mConstantsStart);
+}
+
+void Compiler::Truncate(int bytecodeSize, int constantsSize)
+{
+    mCurrentChunk->Truncate(bytecodeSize, constantsSize);
+    mLastConstant.reset();
+}
+
+std::optional<ir::Value> Compiler::FoldUnary(Token::Type type, ir::Value value)
+{
+    switch (type) {
+    case Token::Type::kMinus:
+        if (value.IsNumber()) {
+            return ir::Value(-value.AsNumber());
+        }
+        return std::nullopt;
+    case Token::Type::kBang:
+        return ir::Value(!IsTruthy(value));
+    default:
+        return std::nullopt;
+    }
+}
+
+std::optional<ir::Value> Compiler::FoldBinary(Token::Type type, ir::Value a, ir::Value b)
+{
+    using Type = ir::Value::Type;
+
+    switch (type) {
+    case Token::Type::kEqualEqual:
+        return ir::Value(a == b);
+    case Token::Type::kBangEqual:
+        return ir::Value(!(a == b));
+    case Token::Type::kPlus:
+        if (a.GetType() == Type::kString && b.GetType() == Type::kString) {
+            // Both are still in the constant pool, so rooted while this allocates
+            return ir::Value(mHeap->Concatenate(static_cast<ir::ObjectString*>(a.AsObject()),
+                static_cast<ir::ObjectString*>(b.AsObject())));
+        }
+        break;
+    default:
+        break;
+    }
+
+    if (!a.IsNumber() || !b.IsNumber()) {
+        return std::nullopt;
+    }
+    double x { a.AsNumber() };
+    double y { b.AsNumber() };
+
+    // Comparisons as in the VM, so NaN behaves the same folded or not
+    switch (type) {
+    case Token::Type::kPlus:
+        return ir::Value(x + y);
+    case Token::Type::kMinus:
+        return ir::Value(x - y);
+    case Token::Type::kStar:
+        return ir::Value(x * y);
+    case Token::Type::kSlash:
+        if (y == 0.0) {
+            return std::nullopt;
+        }
+        return ir::Value(x / y);
+    case Token::Type::kGreater:
+        return ir::Value(x > y);
+    case Token::Type::kLess:
+        return ir::Value(x < y);
+    case Token::Type::kGreaterEqual:
+        return ir::Value(!(x < y));
+    case Token::Type::kLessEqual:
+        return ir::Value(!(x > y));
+    default:
+        return std::nullopt;
+    }
+}
+
+bool Compiler::IsTruthy(ir::Value value)
+{
+    return !(value.GetType() == ir::Value::Type::kNil
+        || (value.GetType() == ir::Value::Type::kBool && !value.AsBool()));
 }
 
 void Compiler::BeginScope(Token token)
@@ -581,6 +905,30 @@ int Compiler::ResolveLocal(std::string_view name)
     return -1;
 }
 
+bool Compiler::DeclareLocal(std::string_view name, int line)
+{
+    for (auto& local : std::ranges::views::reverse(mLocals)) {
+        if (local.mDepth != -1 && local.mDepth < mScopeDepth) {
+            break;
+        }
+        if (local.mName == name) {
+            mErrorReporter->Report(line,
+                fmt::format("Variable {} already exists in local scope", name));
+            return false;
+        }
+    }
+
+    if (mLocals.size() == kLocalVariablesCount) {
+        mErrorReporter->Report(line,
+            fmt::format("More than {} local variables cannot be kept in scope",
+                kLocalVariablesCount));
+        return false;
+    }
+
+    mLocals.emplace_back(std::string { name }, -1);
+    return true;
+}
+
 void Compiler::EndScope(Token token)
 {
     if (!mScopeDepth) {
@@ -588,41 +936,55 @@ void Compiler::EndScope(Token token)
         exit(1);
     }
 
-    uint8_t poppedCount { 0 };
+    int poppedCount { 0 };
     while (!mLocals.empty() && mLocals.back().mDepth == mScopeDepth) {
         mLocals.pop_back();
         poppedCount++;
     }
 
-    if (poppedCount > 0) {
+    // kPopn only takes a byte
+    while (poppedCount > 0) {
+        int count { std::min(poppedCount, kMaxPopn) };
         mCurrentChunk->AddByte(ir::Opcode::kPopn, token.mLine);
-        mCurrentChunk->AddByte(poppedCount, token.mLine);
+        mCurrentChunk->AddByte(static_cast<uint8_t>(count), token.mLine);
+        poppedCount -= count;
     }
 
     mScopeDepth--;
 }
 
-int Compiler::EmitJump(ir::Opcode jump, uint16_t target, int line)
+int Compiler::EmitJump(ir::Opcode jump, int target, int line)
 {
-    mCurrentChunk->AddByte(jump, line);
+    bool isShort { target <= kMaxShortJump };
+    mCurrentChunk->AddByte(isShort ? jump : ir::LongForm(jump), line);
     int ret { static_cast<int>(mCurrentChunk->mBytecode.size()) };
 
-    mCurrentChunk->AddByte(target & 0xFF, line);
-    mCurrentChunk->AddByte(target >> 8, line);
+    // Little-endian
+    for (int i { 0 }; i < (isShort ? 2 : 4); i++) {
+        mCurrentChunk->AddByte(static_cast<uint8_t>(target >> (8 * i)), line);
+    }
 
     return ret;
 }
 
 int Compiler::EmitJump(ir::Opcode jump, int line)
 {
-    return EmitJump(jump, 0xFFFF, line);
+    int ret { static_cast<int>(mCurrentChunk->mBytecode.size()) + 1 };
+    mCurrentChunk->AddByte(ir::LongForm(jump), line);
+    mCurrentChunk->AddBytes({ 0xFF, 0xFF, 0xFF, 0xFF }, line);
+    return ret;
 }
 
-void Compiler::PatchJump(int offset, uint16_t target)
+void Compiler::PatchJump(int offset, int target)
 {
-    // Little-endian
-    mCurrentChunk->mBytecode[offset] = target & 0xFF;
-    mCurrentChunk->mBytecode[offset + 1] = target >> 8;
+    // Code emitted from here on is reachable from elsewhere, whatever was
+    // emitted last is not necessarily what is on the stack there
+    mLastConstant.reset();
+
+    // Only forward jumps are patched, and they are always long. Little-endian
+    for (int i { 0 }; i < 4; i++) {
+        mCurrentChunk->mBytecode[offset + i] = static_cast<uint8_t>(target >> (8 * i));
+    }
 }
 
 void Compiler::PatchJump(int offset)
@@ -630,19 +992,88 @@ void Compiler::PatchJump(int offset)
     PatchJump(offset, mCurrentChunk->mBytecode.size());
 }
 
-std::optional<uint8_t> Compiler::AddIdentifier(Token token)
+void Compiler::EmitLocal(ir::Opcode opcode, int slot, int line)
+{
+    if (slot <= 0xFF) {
+        mCurrentChunk->AddBytes({ static_cast<uint8_t>(opcode), static_cast<uint8_t>(slot) }, line);
+        return;
+    }
+    // Little-endian
+    mCurrentChunk->AddByte(ir::LongForm(opcode), line);
+    mCurrentChunk->AddBytes({ static_cast<uint8_t>(slot), static_cast<uint8_t>(slot >> 8) }, line);
+}
+
+std::optional<uint16_t> Compiler::ResolveGlobal(Token token)
 {
     if (token.mType != Token::Type::kIdentifier) {
         mErrorReporter->Report(token.mLine, "Expected identifer");
         return std::nullopt;
     }
 
-    return mCurrentChunk->AddConstant(ir::Value(token.mLexeme));
+    int slot { mGlobals->Resolve(token.mLexeme) };
+    if (slot == -1) {
+        mErrorReporter->Report(token.mLine,
+            fmt::format("More than {} global variables", ir::GlobalTable::kMaxSlots));
+        return std::nullopt;
+    }
+    return slot;
+}
+
+void Compiler::EmitGlobal(ir::Opcode opcode, uint16_t slot, int line)
+{
+    // Little-endian
+    mCurrentChunk->AddByte(opcode, line);
+    mCurrentChunk->AddByte(slot & 0xFF, line);
+    mCurrentChunk->AddByte(slot >> 8, line);
+}
+
+constexpr Compiler::ParseRules Compiler::MakeParseRules()
+{
+    struct Entry {
+        Token::Type mType;
+        ParseRule mRule;
+    };
+
+    // Tokens not listed here start and continue no expression
+    using C = Compiler;
+    using T = Token::Type;
+    using P = Precedence;
+    constexpr Entry kEntries[] {
+        { T::kAnd, { nullptr, &C::And, P::kAnd } },
+        { T::kBang, { &C::Unary, nullptr, P::kNone } },
+        { T::kBangEqual, { nullptr, &C::Binary, P::kEquality } },
+        { T::kEqualEqual, { nullptr, &C::Binary, P::kEquality } },
+        { T::kFalse, { &C::False, nullptr, P::kNone } },
+        { T::kGreater, { nullptr, &C::Binary, P::kComparison } },
+        { T::kGreaterEqual, { nullptr, &C::Binary, P::kComparison } },
+        { T::kIdentifier, { &C::Identifier, nullptr, P::kNone } },
+        { T::kLeftParen, { &C::Grouping, &C::Call, P::kCall } },
+        { T::kLess, { nullptr, &C::Binary, P::kComparison } },
+        { T::kLessEqual, { nullptr, &C::Binary, P::kComparison } },
+        { T::kMinus, { &C::Unary, &C::Binary, P::kTerm } },
+        { T::kNil, { &C::Nil, nullptr, P::kNone } },
+        { T::kNumber, { &C::Number, nullptr, P::kNone } },
+        { T::kOr, { nullptr, &C::Or, P::kOr } },
+        { T::kPlus, { nullptr, &C::Binary, P::kTerm } },
+        { T::kSlash, { nullptr, &C::Binary, P::kFactor } },
+        { T::kStar, { nullptr, &C::Binary, P::kFactor } },
+        { T::kString, { &C::String, nullptr, P::kNone } },
+        { T::kTrue, { &C::True, nullptr, P::kNone } },
+    };
+
+    ParseRules rules {};
+    rules.fill({ nullptr, nullptr, P::kNone });
+    for (const Entry& entry : kEntries) {
+        rules[static_cast<int>(entry.mType)] = entry.mRule;
+    }
+    return rules;
 }
 
-Compiler::ParseRule Compiler::GetRule(Token token)
+// A plain array of member function pointers, built at compile time
+const Compiler::ParseRule& Compiler::GetRule(Token::Type type)
 {
-    return mParseRules[static_cast<int>(token.mType)];
+    static constexpr ParseRules kRules { MakeParseRules() };
+    return kRules[static_cast<int>(type)];
 }
 
 bool Compiler::Consume(Token::Type type)
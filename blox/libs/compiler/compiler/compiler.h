@@ -1,21 +1,29 @@
 #pragma once
 
+#include "options.h"
 #include "scanner.h"
+#include "source.h"
 #include "token.h"
 
-#include <functional>
+#include <array>
 #include <ir/ierror_reporter.h>
 #include <ir/ir.h>
+#include <magic_enum/magic_enum.hpp>
 #include <memory>
+#include <string>
 
 namespace compiler {
 
-// TODO: while benchmarking is copying the source around noticeable?
-// If so, switch to some sort of streaming string source
-class Compiler final {
+class Compiler final : public ir::IRootProvider {
 public:
-    Compiler(std::string_view source, ir::IErrorReporter* errorReporter);
-    std::unique_ptr<ir::ObjectFunction> Compile(); // -> function main()
+    Compiler(std::string_view source, ir::Heap* heap, ir::GlobalTable* globals,
+        ir::IErrorReporter* errorReporter, const Options& options = {}); // source must outlive Compile()
+    Compiler(std::unique_ptr<Source> source, ir::Heap* heap, ir::GlobalTable* globals,
+        ir::IErrorReporter* errorReporter, const Options& options = {});
+    ~Compiler();
+    ir::ObjectFunction* Compile(); // -> function main(), owned by the heap
+
+    void MarkRoots(ir::Heap& heap) override;
 
 private:
     enum class Precedence {
@@ -32,27 +40,48 @@ private:
         kPrimary
     };
 
-    // std::function<void(Token)> -> std::function<void(Compiler,Token)> -> actual function
-    // Too many layers of indirection, does this create a measurable slowdown?
-    // (std::bind is being used)
+    using ParseFunction = void (Compiler::*)(Precedence minPrecedence);
     struct ParseRule {
-        std::function<void(Precedence minPrecedence)> mPrefix;
-        std::function<void(Precedence minPrecedence)> mInfix;
+        ParseFunction mPrefix;
+        ParseFunction mInfix;
         Precedence mPrecedence;
     };
+    using ParseRules = std::array<ParseRule, magic_enum::enum_count<Token::Type>()>;
 
+    // Owns its name, the lexeme is gone by the time the scope ends
     struct LocalVariable {
-        std::string_view mName;
+        std::string mName;
         int mDepth;
     };
 
-    const static int kLocalVariablesCount { 256 };
+    // A single instruction that pushes a value known at compile time, e.g. a
+    // literal or an already folded expression. The value itself is read back
+    // from the chunk, where the GC keeps it up to date.
+    struct Constant {
+        int mStart; // bytecode offset
+        int mEnd;
+        int mConstantsStart; // constant pool size before it was emitted
+    };
+
+    // State of a function whose body is interrupted by a nested declaration
+    struct EnclosingFunction {
+        ir::ObjectFunction* mFunction;
+        std::vector<LocalVariable> mLocals;
+        int mScopeDepth;
+        std::optional<Constant> mLastConstant;
+    };
+
+    const static int kLocalVariablesCount { 1 << 16 }; // past 256 they need kLocal*Long
+    const static int kMaxArguments { 0xFF };
+    const static int kMaxShortJump { 0xFFFF };
+    const static int kMaxPopn { 0xFF };
 
     // TODO: We want to emit an opcode for EOF?
     void ParseWithPrecedence(Precedence minPrecedence);
 
     void Declaration();
     void DeclarationVariable();
+    void DeclarationFunction();
     void Statement();
     void StatementPrint();
     void StatementExpression();
@@ -60,6 +89,8 @@ private:
     void StatementIf();
     void StatementWhile();
     void StatementFor();
+    void StatementReturn();
+    void StatementDead(); // compiled for its errors, then dropped
     void Expression();
 
     void Identifier(Precedence);
@@ -73,32 +104,61 @@ private:
     void Grouping(Precedence);
     void And(Precedence);
     void Or(Precedence);
-    void Return(Precedence);
+    void Call(Precedence);
+
+    // Compiles the parameter list and body that follow a function's name,
+    // leaving the function on the stack
+    void Function(Token name);
+    void BeginFunction(ir::ObjectFunction* function);
+    void EndFunction(int line);
+    void FinishChunk(int line); // runs the peephole pass and the verifier over the current chunk
+
+    std::optional<Constant> LastConstant(int start) const; // if [start, end) of the chunk is a constant
+    void MarkConstant(int start, int constantsStart);
+    ir::Value GetValue(const Constant& constant) const;
+    void EmitConstant(ir::Value value, int line);
+    void ReplaceWithConstant(const Constant& from, ir::Value value, int line); // from on is replaced
+    void Truncate(int bytecodeSize, int constantsSize);
+    std::optional<ir::Value> FoldUnary(Token::Type type, ir::Value value);
+    std::optional<ir::Value> FoldBinary(Token::Type type, ir::Value a, ir::Value b);
+    static bool IsTruthy(ir::Value value);
 
     void BeginScope(Token token);
     // TODO: Will using an std::optional here cause much of a slowdown?
     int ResolveLocal(std::string_view name); // -> -1 on failure
+    bool DeclareLocal(std::string_view name, int line); // adds it uninitialized, false after reporting an error
     void EndScope(Token token);
 
-    int EmitJump(ir::Opcode jump, uint16_t target, int line);
+    // Backward jumps know their target and use the compact form when it fits.
+    // Forward jumps are always emitted long, the peephole pass shrinks them.
+    int EmitJump(ir::Opcode jump, int target, int line);
     int EmitJump(ir::Opcode jump, int line);
-    void PatchJump(int offset, uint16_t target);
+    void PatchJump(int offset, int target);
     void PatchJump(int offset);
+    void EmitLocal(ir::Opcode opcode, int slot, int line);
 
-    std::optional<uint8_t> AddIdentifier(Token token);
-    ParseRule GetRule(Token token);
+    std::optional<uint16_t> ResolveGlobal(Token token);
+    void EmitGlobal(ir::Opcode opcode, uint16_t slot, int line);
+    static constexpr ParseRules MakeParseRules();
+    static const ParseRule& GetRule(Token::Type type);
     bool Consume(Token::Type type);
 
     Scanner mScanner;
+    ir::Heap* mHeap;
+    ir::GlobalTable* mGlobals;
     ir::IErrorReporter* mErrorReporter;
-    std::vector<ParseRule> mParseRules;
+    Options mOptions;
 
-    std::unique_ptr<ir::ObjectFunction> mMain;
+    ir::ObjectFunction* mMain;
     ir::ObjectFunction* mCurrentFunction;
     ir::Chunk* mCurrentChunk;
+    std::vector<EnclosingFunction> mEnclosing; // innermost last, empty while compiling main
 
     std::vector<LocalVariable> mLocals;
     int mScopeDepth;
+
+    // Reset by anything that makes the end of the chunk a jump target
+    std::optional<Constant> mLastConstant;
 };
 
 }
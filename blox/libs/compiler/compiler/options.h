@@ -0,0 +1,14 @@
+#pragma once
+
+#include "peephole.h"
+
+namespace compiler {
+
+struct Options {
+    // With the rewrites off the peephole pass still re-encodes the chunk,
+    // which shrinks forward jumps to the compact form where they fit
+    bool mPeephole { true };
+    PeepholeOptions mPeepholeOptions {};
+};
+
+}
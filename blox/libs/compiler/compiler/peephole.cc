@@ -0,0 +1,268 @@
+#include "peephole.h"
+
+#include <cassert>
+#include <ir/ir.h>
+#include <spdlog/spdlog.h>
+
+namespace compiler {
+
+using ir::Opcode;
+
+Peephole::Peephole(const PeepholeOptions& options)
+    : mOptions { options }
+{
+}
+
+void Peephole::Optimize(ir::Chunk& chunk)
+{
+    if (!Decode(chunk)) {
+        spdlog::error("Internal error - peephole pass cannot decode chunk, leaving it as is");
+        return;
+    }
+
+    Fuse();
+    if (mOptions.mThreadJumps) {
+        ThreadJumps();
+    }
+
+    Encode(chunk);
+}
+
+bool Peephole::Decode(const ir::Chunk& chunk)
+{
+    const std::vector<uint8_t>& bytecode { chunk.mBytecode };
+    int size { static_cast<int>(bytecode.size()) };
+
+    mInstructions.clear();
+    std::vector<int> indexAt(size + 1, -1);
+    std::vector<int64_t> rawTargets;
+
+    for (int offset { 0 }; offset < size;) {
+        Opcode opcode { static_cast<Opcode>(bytecode[offset]) };
+        int operandBytes { ir::OperandBytes(opcode) };
+        if (offset + operandBytes >= size) {
+            return false;
+        }
+
+        Instruction instruction { opcode, { 0, 0, 0 }, -1, chunk.GetLine(offset), false };
+        int64_t rawTarget { -1 };
+        if (IsJump(ir::ShortForm(opcode))) {
+            instruction.mOpcode = ir::ShortForm(opcode);
+            rawTarget = 0;
+            for (int i { 0 }; i < operandBytes; i++) {
+                rawTarget |= static_cast<int64_t>(bytecode[offset + 1 + i]) << (8 * i);
+            }
+        } else {
+            for (int i { 0 }; i < operandBytes; i++) {
+                instruction.mOperands[i] = bytecode[offset + 1 + i];
+            }
+        }
+
+        indexAt[offset] = mInstructions.size();
+        rawTargets.emplace_back(rawTarget);
+        mInstructions.emplace_back(instruction);
+        offset += 1 + operandBytes;
+    }
+    indexAt[size] = mInstructions.size();
+
+    mIsTarget.assign(mInstructions.size() + 1, false);
+    for (int i { 0 }; i < mInstructions.size(); i++) {
+        if (rawTargets[i] == -1) {
+            continue;
+        }
+        // Unpatched or otherwise bogus jump
+        if (rawTargets[i] > size || indexAt[rawTargets[i]] == -1) {
+            return false;
+        }
+        mInstructions[i].mTarget = indexAt[rawTargets[i]];
+        mIsTarget[mInstructions[i].mTarget] = true;
+    }
+    return true;
+}
+
+void Peephole::Encode(ir::Chunk& chunk) const
+{
+    int count { static_cast<int>(mInstructions.size()) };
+
+    // Start with every jump compact and widen the ones whose target does not
+    // fit until nothing changes. Jumps only ever grow, so this terminates.
+    std::vector<bool> isLong(count, false);
+    std::vector<int> offsets(count + 1); // removed instructions share the next live offset
+    for (bool changed { true }; changed;) {
+        int offset { 0 };
+        for (int i { 0 }; i < count; i++) {
+            offsets[i] = offset;
+            if (!mInstructions[i].mRemoved) {
+                ir::Opcode opcode { mInstructions[i].mOpcode };
+                offset += 1 + ir::OperandBytes(isLong[i] ? ir::LongForm(opcode) : opcode);
+            }
+        }
+        offsets[count] = offset;
+
+        changed = false;
+        for (int i { 0 }; i < count; i++) {
+            if (!mInstructions[i].mRemoved && IsJump(mInstructions[i].mOpcode) && !isLong[i]
+                && offsets[mInstructions[i].mTarget] > 0xFFFF) {
+                isLong[i] = true;
+                changed = true;
+            }
+        }
+    }
+
+    chunk.mBytecode.clear();
+    chunk.mLines = {};
+    for (int i { 0 }; i < count; i++) {
+        const Instruction& instruction { mInstructions[i] };
+        if (instruction.mRemoved) {
+            continue;
+        }
+
+        if (IsJump(instruction.mOpcode)) {
+            // Little-endian
+            uint32_t target { static_cast<uint32_t>(offsets[instruction.mTarget]) };
+            chunk.AddByte(isLong[i] ? ir::LongForm(instruction.mOpcode) : instruction.mOpcode, instruction.mLine);
+            for (int byte { 0 }; byte < (isLong[i] ? 4 : 2); byte++) {
+                chunk.AddByte(static_cast<uint8_t>(target >> (8 * byte)), instruction.mLine);
+            }
+            continue;
+        }
+
+        chunk.AddByte(instruction.mOpcode, instruction.mLine);
+        for (int byte { 0 }; byte < ir::OperandBytes(instruction.mOpcode); byte++) {
+            chunk.AddByte(instruction.mOperands[byte], instruction.mLine);
+        }
+    }
+}
+
+void Peephole::Fuse()
+{
+    for (int i { 0 }; i < mInstructions.size(); i++) {
+        // The comparisons keep the line of the comparison proper, kAddLocalConst
+        // the line of the kAdd since that is the part that can fail
+        if (mOptions.mGreaterEqual && Fuse(i, { Opcode::kLess, Opcode::kNot }, Opcode::kGreaterEqual, 0)) {
+            continue;
+        }
+        if (mOptions.mLessEqual && Fuse(i, { Opcode::kGreater, Opcode::kNot }, Opcode::kLessEqual, 0)) {
+            continue;
+        }
+        if (mOptions.mNotEqual && Fuse(i, { Opcode::kEqual, Opcode::kNot }, Opcode::kNotEqual, 0)) {
+            continue;
+        }
+        if (mOptions.mAddLocalConst
+            && Fuse(i, { Opcode::kLocalGet, Opcode::kConstant, Opcode::kAdd }, Opcode::kAddLocalConst, 2)) {
+            mInstructions[i].mOperands[1] = mInstructions[i + 1].mOperands[0];
+            continue;
+        }
+
+        // if and while pop the condition on both paths: right after the jump
+        // and at its target. Popping inside the jump lets it skip the second pop.
+        // The pop at the target stays, something else may still reach it.
+        if (mOptions.mJumpIfFalsePop) {
+            int target { mInstructions[i].mTarget };
+            if (mInstructions[i].mOpcode == Opcode::kJumpIfFalse
+                && target < mInstructions.size() && mInstructions[target].mOpcode == Opcode::kPop
+                && Fuse(i, { Opcode::kJumpIfFalse, Opcode::kPop }, Opcode::kJumpIfFalsePop, 0)) {
+                mInstructions[i].mTarget = target + 1;
+                continue;
+            }
+        }
+    }
+}
+
+bool Peephole::Fuse(int index, std::initializer_list<Opcode> pattern, Opcode fused, int lineFrom)
+{
+    int length { static_cast<int>(pattern.size()) };
+    if (!IsFusible(index, length)) {
+        return false;
+    }
+    int k { 0 };
+    for (Opcode opcode : pattern) {
+        if (mInstructions[index + k++].mOpcode != opcode) {
+            return false;
+        }
+    }
+
+    // Callers fill in any operands beyond the first instruction's
+    Instruction& first { mInstructions[index] };
+    first.mOpcode = fused;
+    first.mLine = mInstructions[index + lineFrom].mLine;
+    for (int i { 1 }; i < length; i++) {
+        mInstructions[index + i].mRemoved = true;
+    }
+    return true;
+}
+
+void Peephole::ThreadJumps()
+{
+    int count { static_cast<int>(mInstructions.size()) };
+
+    for (Instruction& instruction : mInstructions) {
+        if (instruction.mRemoved || !IsJump(instruction.mOpcode)) {
+            continue;
+        }
+
+        // Bounded, a loop made only of jumps would otherwise spin forever
+        for (int step { 0 }; step < count; step++) {
+            int target { NextLive(instruction.mTarget) };
+            if (target == count) {
+                break;
+            }
+            const Instruction& next { mInstructions[target] };
+
+            if (next.mOpcode == Opcode::kJump) {
+                instruction.mTarget = next.mTarget;
+                continue;
+            }
+
+            // A conditional jump landing on another one with the condition still
+            // on the stack already knows which way that one goes
+            bool isConditional { instruction.mOpcode == Opcode::kJumpIfFalse
+                || instruction.mOpcode == Opcode::kJumpIfTrue };
+            if (!isConditional
+                || (next.mOpcode != Opcode::kJumpIfFalse && next.mOpcode != Opcode::kJumpIfTrue)) {
+                break;
+            }
+            if (next.mOpcode == instruction.mOpcode) {
+                instruction.mTarget = next.mTarget;
+            } else {
+                instruction.mTarget = NextLive(target + 1);
+            }
+        }
+    }
+}
+
+bool Peephole::IsFusible(int index, int length) const
+{
+    if (index + length > mInstructions.size()) {
+        return false;
+    }
+    for (int i { 0 }; i < length; i++) {
+        if (mInstructions[index + i].mRemoved || (i > 0 && mIsTarget[index + i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int Peephole::NextLive(int index) const
+{
+    while (index < mInstructions.size() && mInstructions[index].mRemoved) {
+        index++;
+    }
+    return index;
+}
+
+bool Peephole::IsJump(Opcode opcode)
+{
+    switch (opcode) {
+    case Opcode::kJump:
+    case Opcode::kJumpIfFalse:
+    case Opcode::kJumpIfFalsePop:
+    case Opcode::kJumpIfTrue:
+        return true;
+    default:
+        return false;
+    }
+}
+
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <ir/ir.h>
+#include <vector>
+
+namespace compiler {
+
+// Every rewrite can be switched off on its own, to measure what it buys
+struct PeepholeOptions {
+    bool mGreaterEqual { true }; // kLess kNot -> kGreaterEqual
+    bool mLessEqual { true }; // kGreater kNot -> kLessEqual
+    bool mNotEqual { true }; // kEqual kNot -> kNotEqual
+    bool mAddLocalConst { true }; // kLocalGet kConstant kAdd -> kAddLocalConst
+    bool mJumpIfFalsePop { true }; // kJumpIfFalse kPop, when the target is also a kPop
+    bool mThreadJumps { true }; // a jump to a jump goes straight to the final target
+
+    static constexpr PeepholeOptions None()
+    {
+        return { false, false, false, false, false, false };
+    }
+};
+
+// Rewrites a finished chunk in place. The bytecode is decoded into a list of
+// instructions with jump targets turned into instruction indices, so fusing
+// instructions never has to patch offsets by hand; everything is re-encoded
+// (targets and line table included) at the end.
+//
+// A sequence is only fused when none of its instructions but the first is a
+// jump target, since a jump into the middle of it would have nowhere to land.
+//
+// Jumps are handled in their compact form throughout, the encoder picks the
+// long form only for jumps whose target does not fit in 16 bits.
+class Peephole final {
+public:
+    Peephole(const PeepholeOptions& options = {});
+    void Optimize(ir::Chunk& chunk);
+
+private:
+    struct Instruction {
+        ir::Opcode mOpcode;
+        uint8_t mOperands[3]; // raw bytes, unused for jumps
+        int mTarget; // jumps only, index into mInstructions (may be one past the end)
+        int mLine;
+        bool mRemoved;
+    };
+
+    bool Decode(const ir::Chunk& chunk); // false if the bytecode is not understood
+    void Encode(ir::Chunk& chunk) const;
+
+    void Fuse();
+    bool Fuse(int index, std::initializer_list<ir::Opcode> pattern, ir::Opcode fused, int lineFrom);
+    void ThreadJumps();
+
+    bool IsFusible(int index, int length) const;
+    int NextLive(int index) const;
+    static bool IsJump(ir::Opcode opcode); // compact forms only
+
+    PeepholeOptions mOptions;
+    std::vector<Instruction> mInstructions;
+    std::vector<bool> mIsTarget;
+};
+
+}
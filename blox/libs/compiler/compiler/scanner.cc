@@ -1,53 +1,191 @@
 #include "scanner.h"
 #include "token.h"
 
-#include <cctype>
+#include <bit>
+#include <cstring>
 #include <ir/ierror_reporter.h>
 #include <ir/ir.h>
 #include <string>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 namespace compiler {
 
+namespace {
+
+bool IsDigit(char character)
+{
+    return character >= '0' && character <= '9';
+}
+
+bool IsAlpha(char character)
+{
+    return (character >= 'a' && character <= 'z') || (character >= 'A' && character <= 'Z') || character == '_';
+}
+
+bool IsSpace(char character)
+{
+    return character == ' ' || character == '\t' || character == '\r' || character == '\n';
+}
+
+// The helpers below look at 16 bytes at a time with SSE2 while that many are
+// left, the rest goes through the scalar loop. Bytes past 0x7F are never
+// letters, digits or spaces, same as with the C locale.
+#ifdef __SSE2__
+using Bytes = __m128i;
+constexpr int kWidth { 16 };
+
+Bytes Load(const char* at)
+{
+    return _mm_loadu_si128(reinterpret_cast<const Bytes*>(at));
+}
+
+uint32_t Mask(Bytes bytes)
+{
+    return _mm_movemask_epi8(bytes);
+}
+
+Bytes Equal(Bytes bytes, char character)
+{
+    return _mm_cmpeq_epi8(bytes, _mm_set1_epi8(character));
+}
+
+// Signed, which is fine for ASCII ranges
+Bytes InRange(Bytes bytes, char low, char high)
+{
+    return _mm_and_si128(_mm_cmpgt_epi8(bytes, _mm_set1_epi8(low - 1)), _mm_cmpgt_epi8(_mm_set1_epi8(high + 1), bytes));
+}
+#endif
+
+// -> length of the run of letters, digits and underscores at begin
+size_t IdentifierLength(const char* begin, const char* end)
+{
+    const char* at { begin };
+#ifdef __SSE2__
+    for (; end - at >= kWidth; at += kWidth) {
+        Bytes bytes { Load(at) };
+        // Setting 0x20 folds upper case into lower case
+        Bytes letters { InRange(_mm_or_si128(bytes, _mm_set1_epi8(0x20)), 'a', 'z') };
+        Bytes word { _mm_or_si128(_mm_or_si128(letters, InRange(bytes, '0', '9')), Equal(bytes, '_')) };
+        if (uint32_t other { ~Mask(word) & 0xFFFF }) {
+            return at - begin + std::countr_zero(other);
+        }
+    }
+#endif
+    while (at < end && (IsAlpha(*at) || IsDigit(*at))) {
+        at++;
+    }
+    return at - begin;
+}
+
+// -> length of the run of whitespace at begin, lines gets the newlines in it
+size_t WhitespaceLength(const char* begin, const char* end, int& lines)
+{
+    const char* at { begin };
+#ifdef __SSE2__
+    for (; end - at >= kWidth; at += kWidth) {
+        Bytes bytes { Load(at) };
+        uint32_t newlines { Mask(Equal(bytes, '\n')) };
+        Bytes space { _mm_or_si128(_mm_or_si128(Equal(bytes, ' '), Equal(bytes, '\t')),
+            _mm_or_si128(Equal(bytes, '\r'), Equal(bytes, '\n'))) };
+        if (uint32_t other { ~Mask(space) & 0xFFFF }) {
+            int length { std::countr_zero(other) };
+            lines += std::popcount(newlines & ((1u << length) - 1));
+            return at - begin + length;
+        }
+        lines += std::popcount(newlines);
+    }
+#endif
+    for (; at < end && IsSpace(*at); at++) {
+        lines += *at == '\n';
+    }
+    return at - begin;
+}
+
+// -> offset of the first quote at or after begin (end - begin without one),
+// lines gets the newlines before it
+size_t StringBodyLength(const char* begin, const char* end, int& lines)
+{
+    const char* at { begin };
+#ifdef __SSE2__
+    for (; end - at >= kWidth; at += kWidth) {
+        Bytes bytes { Load(at) };
+        uint32_t newlines { Mask(Equal(bytes, '\n')) };
+        if (uint32_t quotes { Mask(Equal(bytes, '"')) }) {
+            int length { std::countr_zero(quotes) };
+            lines += std::popcount(newlines & ((1u << length) - 1));
+            return at - begin + length;
+        }
+        lines += std::popcount(newlines);
+    }
+#endif
+    for (; at < end && *at != '"'; at++) {
+        lines += *at == '\n';
+    }
+    return at - begin;
+}
+
+}
+
 Scanner::Scanner(std::string_view source, ir::IErrorReporter* errorReporter)
-    : mSource { source }
+    : Scanner(std::make_unique<StringSource>(source), errorReporter)
+{
+}
+
+Scanner::Scanner(std::unique_ptr<Source> source, ir::IErrorReporter* errorReporter)
+    : mSource { std::move(source) }
     , mErrorReporter { errorReporter }
 {
+    std::string_view window { mSource->Window() };
+    mLexemeStart = window.data();
+    mCurrent = window.data();
+    mEnd = window.data() + window.size();
+    mKeep = mLexemeStart;
 }
 
-Token Scanner::PeekToken()
+const Token& Scanner::PeekToken()
 {
-    if (mPeekedToken != std::nullopt) {
-        return mPeekedToken.value();
+    if (!mHasPeekedToken) {
+        mPeekedToken = Scan();
+        mHasPeekedToken = true;
     }
-    mPeekedToken = ScanToken();
-    return mPeekedToken.value();
+    return mPeekedToken;
 }
 
 Token Scanner::ScanToken()
 {
-    if (mPeekedToken != std::nullopt) {
-        Token token { mPeekedToken.value() };
-        mPeekedToken.reset();
-        return token;
+    mScannedCount++;
+    if (mHasPeekedToken) {
+        mHasPeekedToken = false;
+        return mPeekedToken;
     }
+    return Scan();
+}
+
+uint64_t Scanner::ScannedCount() const
+{
+    return mScannedCount;
+}
+
+Token Scanner::Scan()
+{
+    // Still in the window, or kept in the one before
+    mKeep = mLexemeStart;
 
     for (;;) {
-        mLexemeStart = mCurrentCharacter;
+        mCurrent += WhitespaceLength(mCurrent, mEnd, mLine);
+        mLexemeStart = mCurrent;
         if (IsAtEnd()) {
+            if (Refill()) {
+                continue;
+            }
             return MakeToken(Token::Type::kEof);
         }
 
         char character = Next();
         switch (character) {
-        case ' ':
-        case '\r':
-        case '\t':
-            break;
-
-        case '\n':
-            ++mLine;
-            break;
-
         case '(':
             return MakeToken(Token::Type::kLeftParen);
         case ')':
@@ -80,8 +218,9 @@ Token Scanner::ScanToken()
 
         case '/':
             if (Match('/')) {
-                while (!IsAtEnd() && Peek() != '\n')
-                    Next();
+                // memchr is vectorized already, the newline is left for the next round
+                const void* newline { std::memchr(mCurrent, '\n', mEnd - mCurrent) };
+                mCurrent = newline != nullptr ? static_cast<const char*>(newline) : mEnd;
             } else {
                 return MakeToken(Token::Type::kSlash);
             }
@@ -91,9 +230,9 @@ Token Scanner::ScanToken()
             return ScanString();
 
         default:
-            if (std::isdigit(character)) {
+            if (IsDigit(character)) {
                 return ScanNumber();
-            } else if (std::isalpha(character) || character == '_') {
+            } else if (IsAlpha(character)) {
                 return ScanIdentifier();
             }
             mErrorReporter->Report(mLine, "[Scanner] Unexpected character.");
@@ -104,31 +243,19 @@ Token Scanner::ScanToken()
 
 Token Scanner::ScanIdentifier()
 {
-    while (std::isalpha(Peek()) || Peek() == '_' || std::isdigit(Peek()))
-        Next();
-
-    Token::Type type = Token::Type::kIdentifier;
-
-    std::string identifier = mSource.substr(mLexemeStart,
-        mCurrentCharacter - mLexemeStart);
-
-    if (Token::kKeywordToType.find(identifier) != Token::kKeywordToType.end())
-        type = Token::kKeywordToType.at(identifier);
-
-    return MakeToken(type);
+    mCurrent += IdentifierLength(mCurrent, mEnd);
+    return MakeToken(Token::IdentifierType(Lexeme()));
 }
 
 Token Scanner::ScanString()
 {
-    while (!IsAtEnd() && Peek() != '"') {
-        if (Peek() == '\n')
-            mLine++;
-        Next();
-    }
-
-    if (IsAtEnd()) {
-        mErrorReporter->Report(mLine, "[Scanner] Unterminated string literal.");
-        return MakeToken(Token::Type::kError);
+    // The only token that can run past the window
+    for (mCurrent += StringBodyLength(mCurrent, mEnd, mLine); IsAtEnd();
+         mCurrent += StringBodyLength(mCurrent, mEnd, mLine)) {
+        if (!Refill()) {
+            mErrorReporter->Report(mLine, "[Scanner] Unterminated string literal.");
+            return MakeToken(Token::Type::kError);
+        }
     }
 
     Next();
@@ -138,13 +265,13 @@ Token Scanner::ScanString()
 
 Token Scanner::ScanNumber()
 {
-    while (std::isdigit(Peek()))
+    while (IsDigit(Peek()))
         Next();
 
-    if (Peek() == '.' && std::isdigit(PeekNext())) {
+    if (Peek() == '.' && IsDigit(PeekNext())) {
         Next();
 
-        while (std::isdigit(Peek()))
+        while (IsDigit(Peek()))
             Next();
     }
 
@@ -153,7 +280,25 @@ Token Scanner::ScanNumber()
 
 Token Scanner::MakeToken(Token::Type type)
 {
-    return Token(type, std::string_view(mSource).substr(mLexemeStart, mCurrentCharacter - mLexemeStart), mLine);
+    return Token(type, Lexeme(), mLine);
+}
+
+std::string_view Scanner::Lexeme() const
+{
+    return { mLexemeStart, static_cast<std::size_t>(mCurrent - mLexemeStart) };
+}
+
+bool Scanner::Refill()
+{
+    std::size_t scanned { static_cast<std::size_t>(mCurrent - mLexemeStart) };
+    if (!mSource->Advance(mLexemeStart, mKeep)) {
+        return false;
+    }
+    std::string_view window { mSource->Window() };
+    mLexemeStart = window.data();
+    mCurrent = window.data() + scanned;
+    mEnd = window.data() + window.size();
+    return true;
 }
 
 bool Scanner::Match(char expected)
@@ -171,26 +316,26 @@ char Scanner::Peek()
 {
     if (IsAtEnd())
         return '\0';
-    return mSource[mCurrentCharacter];
+    return *mCurrent;
 }
 
 char Scanner::PeekNext()
 {
-    if (mCurrentCharacter + 1 >= mSource.size())
+    if (mEnd - mCurrent < 2)
         return '\0';
-    return mSource[mCurrentCharacter + 1];
+    return mCurrent[1];
 }
 
 char Scanner::Next()
 {
     if (IsAtEnd())
         return '\0';
-    return mSource[mCurrentCharacter++];
+    return *mCurrent++;
 }
 
 bool Scanner::IsAtEnd()
 {
-    return mCurrentCharacter >= mSource.size();
+    return mCurrent == mEnd;
 }
 
 }
@@ -1,21 +1,32 @@
 #pragma once
 
+#include "source.h"
 #include "token.h"
 
+#include <cstdint>
 #include <ir/ierror_reporter.h>
 #include <ir/ir.h>
+#include <memory>
 #include <string_view>
 
 namespace compiler {
 
+// Lexemes point into the source, which may only hold a window of the program
+// (see StreamSource). A token's lexeme stays valid while the scanner scans
+// one more token, and no longer: copy out whatever is needed past that.
 class Scanner final {
 public:
-    Scanner(std::string_view source, ir::IErrorReporter* errorReporter);
-    Token PeekToken();
+    Scanner(std::string_view source, ir::IErrorReporter* errorReporter); // source must outlive the scanner
+    Scanner(std::unique_ptr<Source> source, ir::IErrorReporter* errorReporter);
+    const Token& PeekToken(); // valid until the next ScanToken()
     Token ScanToken();
+    uint64_t ScannedCount() const; // tokens ScanToken() has returned so far
 
 private:
+    Token Scan();
     Token MakeToken(Token::Type type);
+    std::string_view Lexeme() const;
+    bool Refill(); // next window, carrying the lexeme so far along, false at the end
 
     Token ScanIdentifier();
     Token ScanString();
@@ -27,12 +38,16 @@ private:
     char Next();
     bool IsAtEnd();
 
-    int mLexemeStart { 0 };
-    int mCurrentCharacter { 0 };
+    std::unique_ptr<Source> mSource;
+    const char* mLexemeStart;
+    const char* mCurrent;
+    const char* mEnd; // of the window
+    const char* mKeep; // start of the token before the one being scanned
     int mLine { 1 };
-    std::optional<Token> mPeekedToken;
+    uint64_t mScannedCount { 0 };
+    Token mPeekedToken { Token::Type::kError, {}, 0 };
+    bool mHasPeekedToken { false };
 
-    const std::string mSource;
     ir::IErrorReporter* mErrorReporter;
 };
 
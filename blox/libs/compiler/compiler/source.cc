@@ -0,0 +1,148 @@
+#include "source.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <functional>
+#include <spdlog/spdlog.h>
+#include <unistd.h>
+
+namespace compiler {
+
+StringSource::StringSource(std::string_view source)
+    : mSource { source }
+{
+}
+
+std::string_view StringSource::Window() const
+{
+    return mSource;
+}
+
+bool StringSource::Advance(const char*, const char*)
+{
+    return false;
+}
+
+std::unique_ptr<MappedSource> MappedSource::Open(const std::string& path)
+{
+    std::unique_ptr<ir::MappedFile> file { ir::MappedFile::Open(path) };
+    if (!file) {
+        return nullptr;
+    }
+    return std::unique_ptr<MappedSource>(new MappedSource(std::move(file)));
+}
+
+MappedSource::MappedSource(std::unique_ptr<ir::MappedFile> file)
+    : mFile { std::move(file) }
+{
+}
+
+std::string_view MappedSource::Window() const
+{
+    return { reinterpret_cast<const char*>(mFile->Bytes().data()), mFile->Bytes().size() };
+}
+
+bool MappedSource::Advance(const char*, const char*)
+{
+    return false;
+}
+
+StreamSource::StreamSource(int fd, std::size_t bufferSize)
+    : mFd { fd }
+{
+    mBuffers[0].resize(bufferSize);
+    mBuffers[1].resize(bufferSize);
+}
+
+std::unique_ptr<StreamSource> StreamSource::Open(const std::string& path)
+{
+    int fd { open(path.c_str(), O_RDONLY | O_CLOEXEC) };
+    if (fd == -1) {
+        return nullptr;
+    }
+    std::unique_ptr<StreamSource> source { std::make_unique<StreamSource>(fd) };
+    source->mOwnsFd = true;
+    return source;
+}
+
+StreamSource::~StreamSource()
+{
+    if (mOwnsFd) {
+        close(mFd);
+    }
+}
+
+std::string_view StreamSource::Window() const
+{
+    return { mBuffers[mCurrent].data(), mWindowSize };
+}
+
+bool StreamSource::Advance(const char* carry, const char* keep)
+{
+    if (mAtEnd && mFilled == mWindowSize) {
+        return false;
+    }
+
+    // The buffer holding keep is left alone, the other one is refilled
+    int target { Contains(mCurrent, keep) ? 1 - mCurrent : mCurrent };
+    std::vector<char>& buffer { mBuffers[target] };
+    std::size_t carryOffset { static_cast<std::size_t>(carry - mBuffers[mCurrent].data()) };
+    std::size_t carried { mFilled - carryOffset }; // with what was read past the window
+    if (buffer.size() < carried) {
+        buffer.resize(carried);
+    }
+    std::memmove(buffer.data(), carry, carried);
+
+    // The new window has to reach past the old one, up to the last newline
+    std::size_t searchFrom { mWindowSize - carryOffset };
+    std::size_t filled { carried };
+    std::size_t windowSize {};
+    for (;;) {
+        std::size_t newline { std::string_view(buffer.data() + searchFrom, filled - searchFrom).rfind('\n') };
+        if (newline != std::string_view::npos) {
+            windowSize = searchFrom + newline + 1;
+            break;
+        }
+        if (mAtEnd) {
+            windowSize = filled;
+            break;
+        }
+        if (filled == buffer.size()) {
+            buffer.resize(buffer.size() * 2); // a line longer than the buffer
+        }
+        Read(buffer, filled);
+    }
+
+    mCurrent = target;
+    mWindowSize = windowSize;
+    mFilled = filled;
+    return true;
+}
+
+bool StreamSource::Contains(int buffer, const char* at) const
+{
+    const std::vector<char>& bytes { mBuffers[buffer] };
+    return std::less_equal<const char*> {}(bytes.data(), at) && std::less_equal<const char*> {}(at, bytes.data() + bytes.size());
+}
+
+void StreamSource::Read(std::vector<char>& buffer, std::size_t& filled)
+{
+    for (;;) {
+        ssize_t count { read(mFd, buffer.data() + filled, buffer.size() - filled) };
+        if (count > 0) {
+            filled += count;
+            return;
+        }
+        if (count == -1 && errno == EINTR) {
+            continue;
+        }
+        if (count == -1) {
+            spdlog::error("cannot read source: {}", std::strerror(errno));
+        }
+        mAtEnd = true;
+        return;
+    }
+}
+
+}
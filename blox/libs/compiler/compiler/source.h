@@ -0,0 +1,82 @@
+#pragma once
+
+#include <ir/mapped_file.h>
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace compiler {
+
+// Where the scanner reads a program from, one window at a time. A window ends
+// right after a newline or at the end of the program, so the only token that
+// can run past its end is a string literal.
+class Source {
+public:
+    virtual ~Source() = default;
+
+    virtual std::string_view Window() const = 0;
+    // Moves on to the next window, which starts with the bytes from carry to
+    // the end of this one. The bytes from keep (at or before carry, possibly
+    // in the window before this one) to the end of their window stay where
+    // they are until the next call. False, and nothing moves, at the end.
+    virtual bool Advance(const char* carry, const char* keep) = 0;
+};
+
+// The whole program in memory already, owned by the caller
+class StringSource final : public Source {
+public:
+    explicit StringSource(std::string_view source);
+    std::string_view Window() const override;
+    bool Advance(const char* carry, const char* keep) override;
+
+private:
+    std::string_view mSource;
+};
+
+// A file mapped as a whole, the window is all of it
+class MappedSource final : public Source {
+public:
+    static std::unique_ptr<MappedSource> Open(const std::string& path); // nullptr if it cannot be mapped
+    std::string_view Window() const override;
+    bool Advance(const char* carry, const char* keep) override;
+
+private:
+    explicit MappedSource(std::unique_ptr<ir::MappedFile> file);
+
+    std::unique_ptr<ir::MappedFile> mFile;
+};
+
+// Reads a descriptor (a pipe, say) in chunks into two buffers, one holding the
+// window and one the window before it for keep. Each buffer only grows past
+// kBufferSize to fit a line or string literal longer than that, so memory use
+// is bounded by the program's longest line rather than its size.
+class StreamSource final : public Source {
+public:
+    static constexpr std::size_t kBufferSize { 1 << 16 };
+
+    explicit StreamSource(int fd, std::size_t bufferSize = kBufferSize); // fd stays open
+    static std::unique_ptr<StreamSource> Open(const std::string& path); // nullptr on failure, closes the file
+    ~StreamSource();
+    StreamSource(const StreamSource&) = delete;
+    StreamSource& operator=(const StreamSource&) = delete;
+
+    std::string_view Window() const override;
+    bool Advance(const char* carry, const char* keep) override;
+
+private:
+    bool Contains(int buffer, const char* at) const;
+    void Read(std::vector<char>& buffer, std::size_t& filled); // sets mAtEnd at the end, or on error
+
+    int mFd;
+    bool mOwnsFd { false };
+    bool mAtEnd { false };
+    std::vector<char> mBuffers[2];
+    int mCurrent { 0 };
+    std::size_t mWindowSize { 0 };
+    std::size_t mFilled { 0 }; // read into mBuffers[mCurrent], past the window only when no newline followed yet
+};
+
+}
@@ -13,6 +13,63 @@ Token::Token(Type type, const std::string_view lexeme, int line)
 {
 }
 
+// A switch on the first letter (and the second one where that is shared)
+// leaves a single keyword to compare against, without allocating
+Token::Type Token::IdentifierType(std::string_view identifier)
+{
+    auto keyword { [identifier](std::string_view spelling, Type type) {
+        return identifier == spelling ? type : Type::kIdentifier;
+    } };
+
+    switch (identifier[0]) {
+    case 'a':
+        return keyword("and", Type::kAnd);
+    case 'c':
+        return keyword("class", Type::kClass);
+    case 'e':
+        return keyword("else", Type::kElse);
+    case 'f':
+        if (identifier.size() > 1) {
+            switch (identifier[1]) {
+            case 'a':
+                return keyword("false", Type::kFalse);
+            case 'o':
+                return keyword("for", Type::kFor);
+            case 'u':
+                return keyword("fun", Type::kFun);
+            }
+        }
+        break;
+    case 'i':
+        return keyword("if", Type::kIf);
+    case 'n':
+        return keyword("nil", Type::kNil);
+    case 'o':
+        return keyword("or", Type::kOr);
+    case 'p':
+        return keyword("print", Type::kPrint);
+    case 'r':
+        return keyword("return", Type::kReturn);
+    case 's':
+        return keyword("super", Type::kSuper);
+    case 't':
+        if (identifier.size() > 1) {
+            switch (identifier[1]) {
+            case 'h':
+                return keyword("this", Type::kThis);
+            case 'r':
+                return keyword("true", Type::kTrue);
+            }
+        }
+        break;
+    case 'v':
+        return keyword("var", Type::kVar);
+    case 'w':
+        return keyword("while", Type::kWhile);
+    }
+    return Type::kIdentifier;
+}
+
 std::string Token::ToString() const
 {
     return fmt::format("token (type={}, lexeme={}, line={})",
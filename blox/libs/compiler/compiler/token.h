@@ -2,8 +2,8 @@
 
 #include <fmt/format.h>
 #include <fmt/ostream.h>
-#include <map>
 #include <string>
+#include <string_view>
 
 namespace compiler {
 
@@ -61,25 +61,8 @@ public:
         kEof
     };
 
-    // TODO: Will a trie be faster?
-    inline static const std::map<std::string, Type> kKeywordToType {
-        { "and", Type::kAnd },
-        { "class", Type::kClass },
-        { "else", Type::kElse },
-        { "false", Type::kFalse },
-        { "for", Type::kFor },
-        { "fun", Type::kFun },
-        { "if", Type::kIf },
-        { "nil", Type::kNil },
-        { "or", Type::kOr },
-        { "print", Type::kPrint },
-        { "return", Type::kReturn },
-        { "super", Type::kSuper },
-        { "this", Type::kThis },
-        { "true", Type::kTrue },
-        { "var", Type::kVar },
-        { "while", Type::kWhile }
-    };
+    // kIdentifier, or the keyword spelled by identifier
+    static Type IdentifierType(std::string_view identifier);
 
     Token(Type type, const std::string_view lexeme, int line);
 
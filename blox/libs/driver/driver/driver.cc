@@ -2,30 +2,128 @@
 #include "error_reporter.h"
 
 #include <compiler/compiler.h>
+#include <compiler/source.h>
+#include <ir/bytecode_cache.h>
 #include <ir/ierror_reporter.h>
 #include <ir/ir.h>
+#include <ir/object.h>
+#include <regvm/translator.h>
+#include <regvm/vm.h>
 #include <vm/vm.h>
 
+#include <filesystem>
+#include <iostream>
+#include <spdlog/spdlog.h>
+
 namespace driver {
 
+Driver::Driver(const ir::GcOptions& gcOptions, const vm::Options& vmOptions, const Options& options)
+    : mHeap { gcOptions }
+    , mVmOptions { vmOptions }
+    , mOptions { options }
+{
+}
+
 // BUG: REPL is broken because VMs (hence variables) dont persist across lines
 bool Driver::Run(std::string_view source)
 {
+    return Run(std::make_unique<compiler::StringSource>(source));
+}
+
+bool Driver::Run(std::unique_ptr<compiler::Source> source)
+{
+    std::unique_ptr<ir::IErrorReporter> errorReporter = std::make_unique<ErrorReporter>();
+
+    compiler::Compiler compiler(std::move(source), &mHeap, &mGlobals, errorReporter.get());
+    ir::ObjectFunction* main = compiler.Compile();
+
+    if (errorReporter->HadErrors()) {
+        return false;
+    }
+
+    return Execute(main, errorReporter.get());
+}
+
+bool Driver::RunFile(const std::string& path, bool useCache)
+{
+    // Streamed when it cannot be mapped (a pipe, an empty file), and without
+    // the cache then, whose hash needs the whole source up front
+    std::unique_ptr<compiler::MappedSource> source { compiler::MappedSource::Open(path) };
+    if (!source) {
+        std::unique_ptr<compiler::StreamSource> stream { compiler::StreamSource::Open(path) };
+        if (!stream) {
+            spdlog::error("cannot read {}", path);
+            return false;
+        }
+        return Run(std::move(stream));
+    }
+    if (!useCache) {
+        return Run(std::move(source));
+    }
+
+    std::string cachePath { std::filesystem::path(path).replace_extension(".bloxc").string() };
+    uint64_t hash { ir::BytecodeCache::Hash(source->Window()) };
     std::unique_ptr<ir::IErrorReporter> errorReporter = std::make_unique<ErrorReporter>();
 
-    compiler::Compiler compiler(source, errorReporter.get());
-    std::unique_ptr<ir::ObjectFunction> main = compiler.Compile();
+    if (std::unique_ptr<ir::MappedFile> mapped { ir::MappedFile::Open(cachePath) }) {
+        ir::BytecodeLoader loader(&mHeap, &mGlobals);
+        if (ir::ObjectFunction* main { loader.Load(mapped->Bytes(), hash) }) {
+            spdlog::info("using bytecode cache {}", cachePath);
+            mMappedFiles.emplace_back(std::move(mapped));
+            return Execute(main, errorReporter.get());
+        }
+        spdlog::info("bytecode cache {} is stale, recompiling", cachePath);
+    }
+
+    compiler::Compiler compiler(std::move(source), &mHeap, &mGlobals, errorReporter.get());
+    ir::ObjectFunction* main = compiler.Compile();
 
     if (errorReporter->HadErrors()) {
         return false;
     }
 
-    main->mChunk.Print();
+    // Best effort, the program runs either way
+    ir::BytecodeCache::Write(cachePath, main, mGlobals, hash);
 
-    vm::Vm vm(main.get(), errorReporter.get());
+    return Execute(main, errorReporter.get());
+}
+
+bool Driver::Execute(ir::ObjectFunction* main, ir::IErrorReporter* errorReporter)
+{
+    if (mOptions.mDisassemble) {
+        Disassemble(main);
+    }
+
+    if (mOptions.mBackend == Options::Backend::kRegister) {
+        if (mVmOptions.mTrace || !mVmOptions.mSampleProfilePath.empty()) {
+            spdlog::warn("tracing and sampling need the stack vm, running without them");
+        }
+        regvm::Vm vm(main, &mHeap, &mGlobals, errorReporter, mVmOptions);
+        vm.Run();
+        return !errorReporter->HadErrors();
+    }
+
+    vm::Vm vm(main, &mHeap, &mGlobals, errorReporter, mVmOptions);
     vm.Run();
 
     return !errorReporter->HadErrors();
 }
 
+void Driver::Disassemble(ir::ObjectFunction* function) const
+{
+    std::cerr << "== " << function->mName << " ==\n";
+    if (mOptions.mBackend == Options::Backend::kRegister) {
+        regvm::Translator translator(mGlobals.Size());
+        std::unique_ptr<regvm::Function> translated { translator.Translate(function) };
+        std::cerr << (translated ? translated->Disassemble() : translator.Error()) << "\n";
+    } else {
+        function->mChunk.Print();
+    }
+    for (const ir::Value& constant : function->mChunk.mConstants) {
+        if (constant.GetType() == ir::Value::Type::kFunction) {
+            Disassemble(static_cast<ir::ObjectFunction*>(constant.AsObject()));
+        }
+    }
+}
+
 }
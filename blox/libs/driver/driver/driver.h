@@ -1,13 +1,45 @@
 #pragma once
 
+#include <ir/global_table.h>
+#include <driver/options.h>
+#include <ir/heap.h>
+#include <ir/mapped_file.h>
+#include <memory>
+#include <string>
 #include <string_view>
+#include <vector>
+#include <vm/options.h>
+
+namespace compiler {
+class Source;
+}
+
+namespace ir {
+class IErrorReporter;
+class ObjectFunction;
+}
 
 namespace driver {
 
 class Driver final {
 public:
-    Driver() = default;
+    Driver(const ir::GcOptions& gcOptions = {}, const vm::Options& vmOptions = {}, const Options& options = {});
     bool Run(std::string_view source); // returns false if there was any error
+    bool Run(std::unique_ptr<compiler::Source> source);
+    // Like Run(), but with useCache the compiled program is kept in a .bloxc
+    // file next to the script and reused while the source stays the same
+    bool RunFile(const std::string& path, bool useCache = true);
+
+private:
+    bool Execute(ir::ObjectFunction* main, ir::IErrorReporter* errorReporter);
+    void Disassemble(ir::ObjectFunction* function) const; // and every function it contains
+
+    ir::Heap mHeap;
+    ir::GlobalTable mGlobals;
+    vm::Options mVmOptions;
+    Options mOptions;
+    // Loaded functions run their bytecode from these, they live as long as the heap
+    std::vector<std::unique_ptr<ir::MappedFile>> mMappedFiles;
 };
 
 }
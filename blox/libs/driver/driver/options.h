@@ -0,0 +1,17 @@
+#pragma once
+
+namespace driver {
+
+struct Options {
+    enum class Backend {
+        kStack = 0, // vm::Vm runs the bytecode as compiled
+        kRegister // regvm::Vm runs it translated to register code
+    };
+
+    // Prints the bytecode of every function to stderr before running it,
+    // the register code with kRegister
+    bool mDisassemble { false };
+    Backend mBackend { Backend::kStack };
+};
+
+}
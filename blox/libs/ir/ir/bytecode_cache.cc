@@ -0,0 +1,431 @@
+#include "bytecode_cache.h"
+#include "ir.h"
+#include "verifier.h"
+
+#include <bit>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <spdlog/spdlog.h>
+#include <unordered_map>
+#include <vector>
+
+namespace ir {
+
+namespace {
+
+constexpr char kMagic[8] { 'b', 'l', 'o', 'x', 'c', 0, 0, 0 };
+// Offsets and lines are stored unsigned but held as int
+constexpr uint32_t kMaxInt { std::numeric_limits<int>::max() };
+
+enum class ConstantTag : uint8_t {
+    kNil = 0,
+    kBool,
+    kNumber,
+    kString,
+    kFunction
+};
+
+class Writer final {
+public:
+    void Put(uint8_t value)
+    {
+        mBytes.emplace_back(value);
+    }
+    void Put(uint32_t value)
+    {
+        for (int i { 0 }; i < 4; i++) {
+            mBytes.emplace_back(static_cast<uint8_t>(value >> (8 * i)));
+        }
+    }
+    void Put(uint64_t value)
+    {
+        for (int i { 0 }; i < 8; i++) {
+            mBytes.emplace_back(static_cast<uint8_t>(value >> (8 * i)));
+        }
+    }
+    void Put(std::string_view string)
+    {
+        Put(static_cast<uint32_t>(string.size()));
+        mBytes.insert(mBytes.end(), string.begin(), string.end());
+    }
+    void Put(std::span<const uint8_t> bytes)
+    {
+        mBytes.insert(mBytes.end(), bytes.begin(), bytes.end());
+    }
+
+    // A chunk that already ran may hold quickened opcodes
+    void PutCode(std::span<const uint8_t> code)
+    {
+        std::size_t start { mBytes.size() };
+        Put(code);
+        for (std::size_t offset { 0 }; offset < code.size();) {
+            Opcode opcode { static_cast<Opcode>(code[offset]) };
+            mBytes[start + offset] = static_cast<uint8_t>(Generic(opcode));
+            offset += 1 + OperandBytes(opcode);
+        }
+    }
+
+    // Post-order, so that every function constant refers to an index that is
+    // already written
+    void PutFunction(const ObjectFunction* function)
+    {
+        for (const Value& constant : function->mChunk.mConstants) {
+            if (constant.GetType() == Value::Type::kFunction) {
+                auto* nested { static_cast<const ObjectFunction*>(constant.AsObject()) };
+                if (!mIndices.contains(nested)) {
+                    PutFunction(nested);
+                }
+            }
+        }
+
+        const Chunk& chunk { function->mChunk };
+        Put(function->mName);
+        Put(static_cast<uint8_t>(function->mType));
+        Put(static_cast<uint32_t>(function->mArity));
+
+        Put(static_cast<uint32_t>(chunk.mLines.Runs().size()));
+        for (const LineTable::Run& run : chunk.mLines.Runs()) {
+            Put(static_cast<uint32_t>(run.mOffset));
+            Put(static_cast<uint32_t>(run.mLine));
+        }
+
+        Put(static_cast<uint32_t>(chunk.mConstants.size()));
+        for (const Value& constant : chunk.mConstants) {
+            switch (constant.GetType()) {
+            case Value::Type::kBool:
+                Put(static_cast<uint8_t>(ConstantTag::kBool));
+                Put(static_cast<uint8_t>(constant.AsBool()));
+                break;
+            case Value::Type::kNumber:
+                Put(static_cast<uint8_t>(ConstantTag::kNumber));
+                Put(std::bit_cast<uint64_t>(constant.AsNumber()));
+                break;
+            case Value::Type::kString:
+                Put(static_cast<uint8_t>(ConstantTag::kString));
+                Put(static_cast<const ObjectString*>(constant.AsObject())->mString);
+                break;
+            case Value::Type::kFunction:
+                Put(static_cast<uint8_t>(ConstantTag::kFunction));
+                Put(static_cast<uint32_t>(mIndices.at(static_cast<const ObjectFunction*>(constant.AsObject()))));
+                break;
+            default:
+                Put(static_cast<uint8_t>(ConstantTag::kNil));
+                break;
+            }
+        }
+
+        Put(static_cast<uint32_t>(chunk.Code().size()));
+        PutCode(chunk.Code());
+
+        int index { static_cast<int>(mIndices.size()) };
+        mIndices.emplace(function, index);
+    }
+
+    std::vector<uint8_t> mBytes;
+    std::unordered_map<const ObjectFunction*, int> mIndices;
+};
+
+}
+
+uint64_t BytecodeCache::Hash(std::string_view source)
+{
+    uint64_t hash { 14695981039346656037u };
+    for (char c : source) {
+        hash ^= static_cast<uint8_t>(c);
+        hash *= 1099511628211u;
+    }
+    return hash;
+}
+
+bool BytecodeCache::Write(const std::string& path, const ObjectFunction* main, const GlobalTable& globals,
+    uint64_t sourceHash)
+{
+    Writer functions {};
+    functions.PutFunction(main);
+
+    Writer writer {};
+    for (char byte : kMagic) {
+        writer.Put(static_cast<uint8_t>(byte));
+    }
+    writer.Put(kVersion);
+    writer.Put(sourceHash);
+    writer.Put(static_cast<uint32_t>(globals.Size()));
+    writer.Put(static_cast<uint32_t>(functions.mIndices.size()));
+    for (int slot { 0 }; slot < globals.Size(); slot++) {
+        writer.Put(globals.GetName(slot));
+    }
+    writer.Put(functions.mBytes);
+
+    // Renamed into place, so a concurrent run never maps a half-written file
+    std::string temporary { path + ".tmp" };
+    {
+        std::ofstream out { temporary, std::ios::binary | std::ios::trunc };
+        out.write(reinterpret_cast<const char*>(writer.mBytes.data()), writer.mBytes.size());
+        if (!out) {
+            spdlog::warn("cannot write bytecode cache {}", temporary);
+            std::error_code error {};
+            std::filesystem::remove(temporary, error);
+            return false;
+        }
+    }
+    std::error_code error {};
+    std::filesystem::rename(temporary, path, error);
+    if (error) {
+        spdlog::warn("cannot write bytecode cache {}: {}", path, error.message());
+        std::filesystem::remove(temporary, error);
+        return false;
+    }
+    return true;
+}
+
+BytecodeLoader::BytecodeLoader(Heap* heap, GlobalTable* globals)
+    : mHeap { heap }
+    , mGlobals { globals }
+{
+    mHeap->AddRootProvider(this);
+}
+
+BytecodeLoader::~BytecodeLoader()
+{
+    mHeap->RemoveRootProvider(this);
+}
+
+void BytecodeLoader::MarkRoots(Heap& heap)
+{
+    for (ObjectFunction* function : mFunctions) {
+        heap.MarkObject(function);
+    }
+}
+
+ObjectFunction* BytecodeLoader::Load(std::span<uint8_t> file, uint64_t sourceHash)
+{
+    mFile = file;
+    mOffset = 0;
+    mFunctions.clear();
+
+    std::span<uint8_t> magic;
+    uint32_t version {};
+    uint64_t hash {};
+    uint32_t globalCount {};
+    uint32_t functionCount {};
+    if (!Read(magic, sizeof(kMagic)) || std::memcmp(magic.data(), kMagic, sizeof(kMagic)) != 0
+        || !Read(version) || version != BytecodeCache::kVersion) {
+        return nullptr;
+    }
+    if (!Read(hash) || hash != sourceHash || !Read(globalCount) || !Read(functionCount)
+        || functionCount == 0) {
+        return nullptr;
+    }
+
+    // The bytecode has the slots baked in
+    for (uint32_t slot { 0 }; slot < globalCount; slot++) {
+        std::string_view name;
+        if (!Read(name) || mGlobals->Resolve(name) != static_cast<int>(slot)) {
+            return nullptr;
+        }
+    }
+
+    for (uint32_t i { 0 }; i < functionCount; i++) {
+        if (!LoadFunction()) {
+            mFunctions.clear();
+            return nullptr;
+        }
+    }
+
+    // Nothing in a file is trusted, the VM runs its code unchecked
+    Verifier verifier(globalCount);
+    for (ObjectFunction* function : mFunctions) {
+        if (!verifier.Verify(function)) {
+            spdlog::warn("rejecting bytecode cache: {}", verifier.Error());
+            mFunctions.clear();
+            return nullptr;
+        }
+    }
+
+    ObjectFunction* main { mFunctions.back() };
+    mFunctions.clear();
+    if (mOffset != mFile.size() || main->mType != ObjectFunction::Type::kMain) {
+        return nullptr;
+    }
+    return main;
+}
+
+bool BytecodeLoader::LoadFunction()
+{
+    std::string_view name;
+    uint8_t type {};
+    uint32_t arity {};
+    if (!Read(name) || !Read(type) || !Read(arity)) {
+        return false;
+    }
+    if (type != static_cast<uint8_t>(ObjectFunction::Type::kMain)
+        && type != static_cast<uint8_t>(ObjectFunction::Type::kFunction)) {
+        return false;
+    }
+
+    ObjectFunction* function { mHeap->NewFunction(std::string { name },
+        static_cast<ObjectFunction::Type>(type), arity) };
+    mFunctions.emplace_back(function);
+    Chunk& chunk { function->mChunk };
+
+    // Added once the code size is known, every run must start inside the code
+    uint32_t runCount {};
+    if (!Read(runCount)) {
+        return false;
+    }
+    std::vector<LineTable::Run> runs;
+    for (uint32_t i { 0 }; i < runCount; i++) {
+        uint32_t offset {};
+        uint32_t line {};
+        if (!Read(offset) || !Read(line) || offset > kMaxInt || line > kMaxInt
+            || (!runs.empty() && static_cast<int>(offset) < runs.back().mOffset)) {
+            return false;
+        }
+        runs.emplace_back(static_cast<int>(offset), static_cast<int>(line));
+    }
+
+    uint32_t constantCount {};
+    if (!Read(constantCount) || constantCount > Chunk::kMaxConstants) {
+        return false;
+    }
+    for (uint32_t i { 0 }; i < constantCount; i++) {
+        if (!LoadConstant(function)) {
+            return false;
+        }
+    }
+
+    uint32_t codeSize {};
+    std::span<uint8_t> code;
+    if (!Read(codeSize) || !Read(code, codeSize)) {
+        return false;
+    }
+    if (!runs.empty() && runs.back().mOffset >= static_cast<int64_t>(codeSize)) {
+        return false;
+    }
+    for (const LineTable::Run& run : runs) {
+        chunk.mLines.Add(run.mOffset, run.mLine);
+    }
+    chunk.SetMappedCode(code);
+    return true;
+}
+
+bool BytecodeLoader::LoadConstant(ObjectFunction* function)
+{
+    uint8_t tag {};
+    if (!Read(tag)) {
+        return false;
+    }
+
+    Value value {};
+    switch (static_cast<ConstantTag>(tag)) {
+    case ConstantTag::kNil:
+        break;
+    case ConstantTag::kBool: {
+        uint8_t boolean {};
+        if (!Read(boolean)) {
+            return false;
+        }
+        value = Value(boolean != 0);
+        break;
+    }
+    case ConstantTag::kNumber: {
+        uint64_t bits {};
+        if (!Read(bits)) {
+            return false;
+        }
+        // A NaN with the wrong payload would read back as some other type
+        value = Value(std::bit_cast<double>(bits));
+        if (!value.IsNumber()) {
+            return false;
+        }
+        break;
+    }
+    case ConstantTag::kString: {
+        std::string_view string;
+        if (!Read(string)) {
+            return false;
+        }
+        // function is rooted through mFunctions, its earlier constants through it
+        value = Value(mHeap->NewString(string));
+        break;
+    }
+    case ConstantTag::kFunction: {
+        uint32_t index {};
+        // The current function is last in mFunctions and cannot refer to itself
+        if (!Read(index) || index + 1 >= mFunctions.size()) {
+            return false;
+        }
+        value = Value(mFunctions[index]);
+        break;
+    }
+    default:
+        return false;
+    }
+
+    // The writer never stores a constant twice, the pool would fold the copy
+    // into the first one and shift every index after it
+    int index { function->mChunk.AddConstant(value) };
+    if (index != static_cast<int>(function->mChunk.mConstants.size()) - 1) {
+        return false;
+    }
+    mHeap->WriteBarrier(function, function->mChunk.GetConstant(index));
+    return true;
+}
+
+bool BytecodeLoader::Read(uint8_t& value)
+{
+    if (mOffset + 1 > mFile.size()) {
+        return false;
+    }
+    value = mFile[mOffset++];
+    return true;
+}
+
+bool BytecodeLoader::Read(uint32_t& value)
+{
+    if (mOffset + 4 > mFile.size()) {
+        return false;
+    }
+    value = 0;
+    for (int i { 0 }; i < 4; i++) {
+        value |= static_cast<uint32_t>(mFile[mOffset++]) << (8 * i);
+    }
+    return true;
+}
+
+bool BytecodeLoader::Read(uint64_t& value)
+{
+    if (mOffset + 8 > mFile.size()) {
+        return false;
+    }
+    value = 0;
+    for (int i { 0 }; i < 8; i++) {
+        value |= static_cast<uint64_t>(mFile[mOffset++]) << (8 * i);
+    }
+    return true;
+}
+
+bool BytecodeLoader::Read(std::string_view& string)
+{
+    uint32_t size {};
+    std::span<uint8_t> bytes;
+    if (!Read(size) || !Read(bytes, size)) {
+        return false;
+    }
+    string = { reinterpret_cast<const char*>(bytes.data()), bytes.size() };
+    return true;
+}
+
+bool BytecodeLoader::Read(std::span<uint8_t>& bytes, std::size_t size)
+{
+    if (size > mFile.size() - mOffset) {
+        return false;
+    }
+    bytes = mFile.subspan(mOffset, size);
+    mOffset += size;
+    return true;
+}
+
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "global_table.h"
+#include "heap.h"
+#include "iroot_provider.h"
+#include "object.h"
+
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace ir {
+
+// Compiled programs are cached in .bloxc files. All integers are little-endian:
+//
+//   header     "bloxc\0\0\0", kVersion, hash of the source it was compiled from,
+//              global count, function count
+//   globals    every global name, in slot order
+//   functions  nested functions before the functions whose constants refer to
+//              them, main last. Each has its name, type, arity, line runs,
+//              constants and finally its bytecode.
+//
+// Constants are a tag byte followed by the value: nothing for nil, a byte for
+// bools, the bits of a double, the characters of a string, or the index of an
+// earlier function. Bytecode is always written with its generic opcodes, see
+// ir::Generic(). Bump kVersion whenever the format or any opcode changes.
+class BytecodeCache final {
+public:
+    static constexpr uint32_t kVersion { 2 };
+
+    static uint64_t Hash(std::string_view source); // FNV-1a
+    // false if the file could not be written, a partial file is never left behind
+    static bool Write(const std::string& path, const ObjectFunction* main, const GlobalTable& globals,
+        uint64_t sourceHash);
+};
+
+// Rebuilds the functions of a .bloxc file on the heap. Bytecode is not copied,
+// chunks run straight from file (see Chunk::SetMappedCode()), so the memory
+// behind file must outlive every function loaded from it.
+class BytecodeLoader final : public IRootProvider {
+public:
+    BytecodeLoader(Heap* heap, GlobalTable* globals);
+    ~BytecodeLoader();
+
+    // -> main, or nullptr if file is malformed, was written by another version
+    // or for another source, or its globals do not get the same slots here
+    ObjectFunction* Load(std::span<uint8_t> file, uint64_t sourceHash);
+
+    void MarkRoots(Heap& heap) override;
+
+private:
+    bool LoadFunction();
+    bool LoadConstant(ObjectFunction* function);
+
+    // Bounds checked, they return false once the file runs out
+    bool Read(uint8_t& value);
+    bool Read(uint32_t& value);
+    bool Read(uint64_t& value);
+    bool Read(std::string_view& string); // length prefixed, points into the file
+    bool Read(std::span<uint8_t>& bytes, std::size_t size);
+
+    Heap* mHeap;
+    GlobalTable* mGlobals;
+    std::span<uint8_t> mFile;
+    std::size_t mOffset { 0 };
+    std::vector<ObjectFunction*> mFunctions; // loaded so far, by index
+};
+
+}
@@ -1,21 +1,23 @@
 #include "chunk.h"
 #include "ir.h"
+#include "object.h"
 #include "value.h"
 
+#include <bit>
 #include <cassert>
 #include <cstdint>
 #include <fmt/format.h>
 #include <initializer_list>
+#include <iostream>
 #include <magic_enum/magic_enum.hpp>
 #include <ostream>
-#include <spdlog/spdlog.h>
 
 namespace ir {
 
 void Chunk::AddByte(uint8_t byte, int line)
 {
+    mLines.Add(mBytecode.size(), line);
     mBytecode.emplace_back(byte);
-    mLines.emplace_back(line);
 }
 
 void Chunk::AddBytes(std::initializer_list<uint8_t> bytes, int line)
@@ -37,78 +39,198 @@ void Chunk::AddBytes(std::initializer_list<Opcode> opcodes, int line)
     }
 }
 
-uint8_t Chunk::AddConstant(const Value& value)
+int Chunk::AddConstant(const Value& value)
 {
+    if (std::optional<int> existing { FindConstant(value) }) {
+        return *existing;
+    }
+
     int ret = mConstants.size();
-    assert(ret < 256);
+    assert(ret < kMaxConstants);
 
     mConstants.emplace_back(value);
+    if (std::optional<uint64_t> key { ConstantKey(value) }) {
+        mConstantIndex.emplace(*key, ret);
+    }
     return ret;
 }
 
-uint8_t Chunk::AddConstant(double number)
+std::optional<int> Chunk::FindConstant(const Value& value) const
+{
+    std::optional<uint64_t> key { ConstantKey(value) };
+    if (!key) {
+        return std::nullopt;
+    }
+    auto [begin, end] { mConstantIndex.equal_range(*key) };
+    for (auto it { begin }; it != end; it++) {
+        if (IsSameConstant(mConstants[it->second], value)) {
+            return it->second;
+        }
+    }
+    return std::nullopt;
+}
+
+int Chunk::AddConstant(double number)
 {
     return AddConstant(Value(number));
 }
 
-uint8_t Chunk::AddConstant(bool boolean)
+int Chunk::AddConstant(bool boolean)
 {
     return AddConstant(Value(boolean));
 }
 
-uint8_t Chunk::AddConstant(ObjectString* string)
+int Chunk::AddConstant(ObjectString* string)
 {
     return AddConstant(Value(string));
 }
 
-uint8_t Chunk::AddConstant(ObjectFunction* function)
+int Chunk::AddConstant(ObjectFunction* function)
 {
     return AddConstant(Value(function));
 }
 
+void Chunk::SetMappedCode(std::span<uint8_t> code)
+{
+    assert(mBytecode.empty());
+    mMappedCode = code;
+}
+
 Value Chunk::GetConstant(int index) const
 {
     return mConstants[index];
 }
 
+int Chunk::GetLine(int offset) const
+{
+    return mLines.GetLine(offset);
+}
+
+void Chunk::Truncate(int bytecodeSize, int constantsSize)
+{
+    assert(bytecodeSize <= mBytecode.size() && constantsSize <= mConstants.size());
+    mBytecode.resize(bytecodeSize);
+    mLines.Truncate(bytecodeSize);
+    for (int index { static_cast<int>(mConstants.size()) - 1 }; index >= constantsSize; index--) {
+        std::optional<uint64_t> key { ConstantKey(mConstants[index]) };
+        if (!key) {
+            continue;
+        }
+        auto [begin, end] { mConstantIndex.equal_range(*key) };
+        for (auto it { begin }; it != end; it++) {
+            if (it->second == index) {
+                mConstantIndex.erase(it);
+                break;
+            }
+        }
+    }
+    mConstants.resize(constantsSize);
+}
+
+std::optional<uint64_t> Chunk::ConstantKey(const Value& value)
+{
+    switch (value.GetType()) {
+    case Value::Type::kNumber:
+        return std::bit_cast<uint64_t>(value.AsNumber());
+    case Value::Type::kString:
+        return static_cast<ObjectString*>(value.AsObject())->mHash;
+    default:
+        return std::nullopt; // functions are only ever added once
+    }
+}
+
+bool Chunk::IsSameConstant(const Value& a, const Value& b)
+{
+    if (a.GetType() != b.GetType()) {
+        return false;
+    }
+    if (a.IsNumber()) {
+        return std::bit_cast<uint64_t>(a.AsNumber()) == std::bit_cast<uint64_t>(b.AsNumber());
+    }
+    return a.AsObject() == b.AsObject(); // strings are interned
+}
+
 void Chunk::Print() const
+{
+    std::cerr << Disassemble() << "\n";
+}
+
+std::string Chunk::Disassemble() const
 {
     std::string toPrint { fmt::format("== {} ==", ToString()) };
     int line { -1 };
+    std::span<const uint8_t> code { Code() };
 
-    for (int index { 0 }; index < mBytecode.size(); index++) {
+    for (int index { 0 }; index < code.size(); index++) {
         toPrint += "\n";
         std::string lineString { "|" };
-        if (mLines[index] != line) {
-            line = mLines[index];
+        if (GetLine(index) != line) {
+            line = GetLine(index);
             lineString = std::to_string(line);
         }
 
         toPrint += fmt::format("{:04d} {:>4} ", index, lineString);
 
-        ir::Opcode opcode { static_cast<ir::Opcode>(mBytecode[index]) };
+        ir::Opcode opcode { static_cast<ir::Opcode>(code[index]) };
         toPrint += fmt::format("{:<16}", magic_enum::enum_name(opcode));
 
         switch (opcode) {
         case ir::Opcode::kGlobalDefine:
         case ir::Opcode::kGlobalGet:
-        case ir::Opcode::kGlobalSet:
+        case ir::Opcode::kGlobalSet: {
+            uint16_t slot { code[++index] };
+            slot += code[++index] << 8;
+            toPrint += fmt::format("{:>4} (slot)", slot);
+            break;
+        }
         case ir::Opcode::kConstant: {
             index++;
-            int constantIndex { mBytecode[index] };
+            int constantIndex { code[index] };
+            toPrint += fmt::format("{:>4} '{}'", constantIndex, GetConstant(constantIndex));
+            break;
+        }
+        case ir::Opcode::kConstantLong: {
+            int constantIndex { code[index + 1] | (code[index + 2] << 8) | (code[index + 3] << 16) };
+            index += 3;
             toPrint += fmt::format("{:>4} '{}'", constantIndex, GetConstant(constantIndex));
             break;
         }
+        case ir::Opcode::kLocalGetLong:
+        case ir::Opcode::kLocalSetLong: {
+            uint16_t slot { code[++index] };
+            slot += code[++index] << 8;
+            toPrint += fmt::format("{:<4}", slot);
+            break;
+        }
+        case ir::Opcode::kAddLocalConst: {
+            int local { code[++index] };
+            int constantIndex { code[++index] };
+            toPrint += fmt::format("{:>4} {:>4} '{}'", local, constantIndex, GetConstant(constantIndex));
+            break;
+        }
+        case ir::Opcode::kCall:
         case ir::Opcode::kPopn:
         case ir::Opcode::kLocalSet:
         case ir::Opcode::kLocalGet:
-            toPrint += fmt::format("{:<4}", mBytecode[++index]);
+            toPrint += fmt::format("{:<4}", code[++index]);
             break;
         case ir::Opcode::kJump:
         case ir::Opcode::kJumpIfTrue:
-        case ir::Opcode::kJumpIfFalse: {
-            uint16_t target { mBytecode[++index] };
-            target += mBytecode[++index] << 8;
+        case ir::Opcode::kJumpIfFalse:
+        case ir::Opcode::kJumpIfFalsePop: {
+            uint16_t target { code[++index] };
+            target += code[++index] << 8;
+            toPrint += fmt::format("{:<5}", target);
+            break;
+        }
+        case ir::Opcode::kJumpLong:
+        case ir::Opcode::kJumpIfTrueLong:
+        case ir::Opcode::kJumpIfFalseLong:
+        case ir::Opcode::kJumpIfFalsePopLong: {
+            uint32_t target { 0 };
+            for (int i { 0 }; i < 4; i++) {
+                target |= static_cast<uint32_t>(code[++index]) << (8 * i);
+            }
             toPrint += fmt::format("{:<5}", target);
             break;
         }
@@ -116,13 +238,13 @@ void Chunk::Print() const
             break;
         }
     }
-    spdlog::debug(toPrint);
+    return toPrint;
 }
 
 std::string Chunk::ToString() const
 {
-    return fmt::format("chunk (sizes: bytecode={}, constants={})",
-        mBytecode.size(), mConstants.size());
+    return fmt::format("chunk (sizes: bytecode={}, constants={}, line runs={})",
+        Code().size(), mConstants.size(), mLines.Runs().size());
 }
 
 std::ostream& operator<<(std::ostream& out, const Chunk& chunk)
@@ -1,40 +1,80 @@
 #pragma once
 
+#include "line_table.h"
 #include "value.h"
 
 #include <cstdint>
 #include <initializer_list>
+#include <optional>
+#include <span>
+#include <unordered_map>
 #include <vector>
 
 namespace ir {
 
 enum class Opcode;
 
-// Not serializable currently
+// Built through mBytecode. A chunk loaded from a bytecode cache file runs its
+// code straight from the mapped file instead, see Code().
 class Chunk final {
 public:
+    static constexpr int kMaxShortConstant { 0xFF };
+    static constexpr int kMaxConstants { 1 << 24 };
+
     Chunk() = default;
 
     void AddByte(uint8_t byte, int line);
     void AddBytes(std::initializer_list<uint8_t> bytes, int line);
     void AddByte(Opcode, int line);
     void AddBytes(std::initializer_list<Opcode> opcodes, int line);
-    uint8_t AddConstant(const Value& value);
-    uint8_t AddConstant(double number);
-    uint8_t AddConstant(bool boolean);
-    uint8_t AddConstant(Object* object) = delete;
-    uint8_t AddConstant(ObjectString* string);
-    uint8_t AddConstant(ObjectFunction* function);
+    // -> index, anything past kMaxShortConstant needs kConstantLong. Numbers
+    // (bitwise, so 0 and -0 stay apart) and strings that are already in the
+    // pool get their existing index back.
+    int AddConstant(const Value& value);
+    int AddConstant(double number);
+    int AddConstant(bool boolean);
+    int AddConstant(Object* object) = delete;
+    int AddConstant(ObjectString* string);
+    int AddConstant(ObjectFunction* function);
+    // The index AddConstant() would share, if the value is already pooled
+    std::optional<int> FindConstant(const Value& value) const;
+
+    // What the VM runs: mBytecode, unless SetMappedCode() pointed it elsewhere.
+    // Inline, the VM calls it on every call and return. The VM also writes
+    // to it when quickening.
+    std::span<const uint8_t> Code() const
+    {
+        return mMappedCode.data() != nullptr ? mMappedCode : std::span<const uint8_t> { mBytecode };
+    }
+    std::span<uint8_t> Code()
+    {
+        return mMappedCode.data() != nullptr ? mMappedCode : std::span<uint8_t> { mBytecode };
+    }
+    void SetMappedCode(std::span<uint8_t> code); // must outlive the chunk, or at least its use
 
     Value GetConstant(int index) const;
+    int GetLine(int offset) const; // source line of the bytecode at offset
+    // Drops bytecode (with its lines) and constants emitted past these sizes
+    void Truncate(int bytecodeSize, int constantsSize);
 
-    void Print() const;
+    std::string Disassemble() const;
+    void Print() const; // Disassemble() to stderr
     std::string ToString() const;
     friend std::ostream& operator<<(std::ostream& out, const Chunk& chunk);
 
     std::vector<uint8_t> mBytecode;
-    std::vector<int> mLines;
+    LineTable mLines;
     std::vector<Value> mConstants;
+
+private:
+    // Numbers by their bits, strings by their hash. A string's hash survives
+    // the GC moving it, its pointer (which the pool compares) does not.
+    static std::optional<uint64_t> ConstantKey(const Value& value);
+    static bool IsSameConstant(const Value& a, const Value& b);
+
+    std::span<uint8_t> mMappedCode;
+    // Key -> index into mConstants, kept in step by AddConstant() and Truncate()
+    std::unordered_multimap<uint64_t, int> mConstantIndex;
 };
 
 }
@@ -0,0 +1,32 @@
+#include "global_table.h"
+
+namespace ir {
+
+int GlobalTable::Resolve(std::string_view name)
+{
+    auto it { mSlots.find(name) };
+    if (it != mSlots.end()) {
+        return it->second;
+    }
+
+    if (Size() == kMaxSlots) {
+        return -1;
+    }
+
+    int slot { Size() };
+    mNames.emplace_back(name);
+    mSlots.emplace(name, slot);
+    return slot;
+}
+
+const std::string& GlobalTable::GetName(int slot) const
+{
+    return mNames[slot];
+}
+
+int GlobalTable::Size() const
+{
+    return mNames.size();
+}
+
+}
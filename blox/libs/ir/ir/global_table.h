@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace ir {
+
+// Global names are resolved to dense slots at compile time, the VM then
+// indexes a plain array with them. Shared by the compiler and the VM.
+class GlobalTable final {
+public:
+    static constexpr int kMaxSlots { UINT16_MAX + 1 };
+
+    GlobalTable() = default;
+
+    int Resolve(std::string_view name); // -> slot, allocated on first use, -1 if full
+    const std::string& GetName(int slot) const;
+    int Size() const;
+
+private:
+    std::map<std::string, int, std::less<>> mSlots;
+    std::vector<std::string> mNames;
+};
+
+}
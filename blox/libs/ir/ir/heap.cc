@@ -0,0 +1,310 @@
+#include "heap.h"
+#include "iroot_provider.h"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstring>
+#include <new>
+#include <spdlog/spdlog.h>
+#include <string>
+
+namespace ir {
+
+namespace {
+
+constexpr std::size_t kAlignment { alignof(std::max_align_t) };
+
+constexpr std::size_t Align(std::size_t size)
+{
+    return (size + kAlignment - 1) & ~(kAlignment - 1);
+}
+
+}
+
+Heap::Heap(const GcOptions& options)
+    : mOptions { options }
+    , mNextCollection { options.mInitialThreshold }
+    , mNursery { std::make_unique<std::byte[]>(options.mNurserySize) }
+    , mNurseryTop { mNursery.get() }
+    , mNurseryEnd { mNursery.get() + options.mNurserySize }
+{
+}
+
+Heap::~Heap()
+{
+    while (mObjects != nullptr) {
+        Object* next { mObjects->mNext };
+        Free(mObjects);
+        mObjects = next;
+    }
+    // Nursery objects own nothing outside the nursery, see ObjectString
+}
+
+ObjectString* Heap::NewString(std::string_view string)
+{
+    uint32_t hash { StringTable::Hash(string) };
+    if (ObjectString* interned { mStrings.Find(string, hash) }; interned != nullptr) {
+        return interned;
+    }
+
+    std::size_t size { sizeof(ObjectString) + string.size() };
+    void* memory { AllocateYoung(size) };
+    bool young { memory != nullptr };
+    if (!young) {
+        memory = AllocateOld(size);
+    }
+
+    char* characters { static_cast<char*>(memory) + sizeof(ObjectString) };
+    std::memcpy(characters, string.data(), string.size());
+    ObjectString* object { new (memory) ObjectString({ characters, string.size() }, hash) };
+
+    if (!young) {
+        LinkOld(object);
+    }
+    mStrings.Insert(object);
+    return object;
+}
+
+ObjectString* Heap::Concatenate(const ObjectString* a, const ObjectString* b)
+{
+    // Built before allocating, a and b may not survive (or may move in) a collection
+    std::string string;
+    string.reserve(a->mString.size() + b->mString.size());
+    string += a->mString;
+    string += b->mString;
+    return NewString(string);
+}
+
+ObjectFunction* Heap::NewFunction(const std::string& name, ObjectFunction::Type type, int arity)
+{
+    // Functions are long lived and reference other objects, so they skip the nursery
+    void* memory { AllocateOld(sizeof(ObjectFunction)) };
+    ObjectFunction* function { new (memory) ObjectFunction(name, type, arity) };
+    LinkOld(function);
+    return function;
+}
+
+void* Heap::AllocateYoung(std::size_t size)
+{
+    size = Align(size);
+    if (size > mOptions.mNurserySize / 4) {
+        return nullptr;
+    }
+
+    if (mOptions.mStress) {
+        Collect();
+    } else if (static_cast<std::size_t>(mNurseryEnd - mNurseryTop) < size) {
+        CollectMinor();
+    }
+    assert(mCollection == Collection::kNone);
+
+    void* memory { mNurseryTop };
+    mNurseryTop += size;
+    mNurseryObjectCount++;
+    return memory;
+}
+
+void* Heap::AllocateOld(std::size_t size)
+{
+    if (mOptions.mStress || mBytesAllocated > mNextCollection) {
+        Collect();
+    }
+    return ::operator new(size);
+}
+
+void Heap::LinkOld(Object* object)
+{
+    object->mNext = mObjects;
+    mObjects = object;
+    mBytesAllocated += object->Size();
+    mObjectCount++;
+}
+
+void Heap::Free(Object* object)
+{
+    object->~Object();
+    ::operator delete(object);
+}
+
+ObjectString* Heap::Promote(ObjectString* string)
+{
+    void* memory { ::operator new(string->Size()) };
+    char* characters { static_cast<char*>(memory) + sizeof(ObjectString) };
+    std::memcpy(characters, string->mString.data(), string->mString.size());
+    ObjectString* promoted { new (memory) ObjectString({ characters, string->mString.size() }, string->mHash) };
+
+    LinkOld(promoted);
+    string->mForward = promoted;
+    return promoted;
+}
+
+void Heap::AddRootProvider(IRootProvider* provider)
+{
+    mRootProviders.emplace_back(provider);
+}
+
+void Heap::RemoveRootProvider(IRootProvider* provider)
+{
+    std::erase(mRootProviders, provider);
+}
+
+void Heap::MarkValue(Value& value)
+{
+    if (!value.IsObject()) {
+        return;
+    }
+
+    if (mCollection == Collection::kMinor) {
+        if (!IsYoung(value.AsObject())) {
+            return;
+        }
+        // Only strings are allocated in the nursery, and they reference nothing
+        ObjectString* string { static_cast<ObjectString*>(value.AsObject()) };
+        Object* forward { string->mForward != nullptr ? string->mForward : Promote(string) };
+        value.SetObject(forward);
+        return;
+    }
+
+    MarkObject(value.AsObject());
+}
+
+void Heap::MarkObject(Object* object)
+{
+    if (mCollection == Collection::kMinor) {
+        assert(!IsYoung(object));
+        return;
+    }
+
+    if (object == nullptr || object->mMarked) {
+        return;
+    }
+    object->mMarked = true;
+    mGrayStack.emplace_back(object);
+}
+
+bool Heap::IsMinorCollection() const
+{
+    return mCollection == Collection::kMinor;
+}
+
+void Heap::WriteBarrier(Object* owner, const Value& value)
+{
+    if (!owner->mRemembered && IsYoung(value) && !IsYoung(owner)) {
+        owner->mRemembered = true;
+        mRememberedSet.emplace_back(owner);
+    }
+}
+
+void Heap::CollectMinor()
+{
+    Evacuate();
+    if (mBytesAllocated > mNextCollection) {
+        CollectMajor();
+    }
+}
+
+void Heap::Collect()
+{
+    Evacuate();
+    CollectMajor();
+}
+
+void Heap::Evacuate()
+{
+    auto start { std::chrono::steady_clock::now() };
+    int youngCount { mNurseryObjectCount };
+    int oldCount { mObjectCount };
+
+    mCollection = Collection::kMinor;
+
+    for (IRootProvider* provider : mRootProviders) {
+        provider->MarkRoots(*this);
+    }
+    for (Object* object : mRememberedSet) {
+        object->mRemembered = false;
+        object->Trace(*this);
+    }
+    mRememberedSet.clear();
+
+    // Young strings are either promoted or dead
+    mStrings.Rewrite([this](ObjectString* string) -> ObjectString* {
+        if (!IsYoung(string)) {
+            return string;
+        }
+        return static_cast<ObjectString*>(string->mForward);
+    });
+
+    mNurseryTop = mNursery.get();
+    mNurseryObjectCount = 0;
+    mCollection = Collection::kNone;
+
+    auto elapsed { std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start) };
+    spdlog::debug("gc minor: promoted {}/{} objects in {:.1f}us",
+        mObjectCount - oldCount, youngCount, elapsed.count());
+}
+
+void Heap::CollectMajor()
+{
+    // The nursery is empty here, nothing moves
+    assert(mNurseryTop == mNursery.get());
+
+    std::size_t before { mBytesAllocated };
+    mCollection = Collection::kMajor;
+
+    for (IRootProvider* provider : mRootProviders) {
+        provider->MarkRoots(*this);
+    }
+
+    while (!mGrayStack.empty()) {
+        Object* object { mGrayStack.back() };
+        mGrayStack.pop_back();
+        object->Trace(*this);
+    }
+
+    mStrings.Rewrite([](ObjectString* string) -> ObjectString* {
+        return string->mMarked ? string : nullptr;
+    });
+    Sweep();
+
+    mCollection = Collection::kNone;
+    mNextCollection = std::max(static_cast<std::size_t>(mBytesAllocated * mOptions.mGrowthFactor),
+        mOptions.mInitialThreshold);
+
+    spdlog::debug("gc major: {} -> {} bytes, next at {}", before, mBytesAllocated, mNextCollection);
+}
+
+void Heap::Sweep()
+{
+    Object** link { &mObjects };
+    while (*link != nullptr) {
+        Object* object { *link };
+        if (object->mMarked) {
+            object->mMarked = false;
+            link = &object->mNext;
+            continue;
+        }
+
+        *link = object->mNext;
+        mBytesAllocated -= object->Size();
+        mObjectCount--;
+        Free(object);
+    }
+}
+
+std::size_t Heap::BytesAllocated() const
+{
+    return mBytesAllocated + (mNurseryTop - mNursery.get());
+}
+
+int Heap::ObjectCount() const
+{
+    return mObjectCount + mNurseryObjectCount;
+}
+
+const StringTable& Heap::Strings() const
+{
+    return mStrings;
+}
+
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include "object.h"
+#include "string_table.h"
+#include "value.h"
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace ir {
+
+class IRootProvider;
+
+struct GcOptions {
+    std::size_t mNurserySize { 256 << 10 }; // bytes
+    std::size_t mInitialThreshold { 1 << 20 }; // old space bytes before the first major collection
+    double mGrowthFactor { 2.0 }; // next threshold = live old space bytes * factor
+    bool mStress { false }; // full collection before every allocation
+};
+
+// Owns every runtime object. Strings are interned, so two ObjectStrings with
+// the same contents are always the same pointer; the intern table holds them
+// weakly.
+//
+// Generational: strings are bump allocated in a fixed size nursery. When it
+// fills up a minor collection copies the survivors into the old space and
+// resets the bump pointer. Old objects (all functions, promoted strings) are
+// reclaimed by a mark-sweep major collection once the old space passes a
+// threshold.
+//
+// A minor collection only sees the nursery through root providers and the
+// remembered set, so storing a young value into an old object must go
+// through WriteBarrier(). Root providers are responsible for their own roots,
+// see IsMinorCollection().
+class Heap final {
+public:
+    Heap(const GcOptions& options = {});
+    ~Heap();
+    Heap(const Heap&) = delete;
+    Heap& operator=(const Heap&) = delete;
+
+    // Any of these may trigger a collection, which can free or move (update
+    // the Values pointing at) young objects. Everything the caller still
+    // needs must be reachable from a root provider beforehand.
+    ObjectString* NewString(std::string_view string);
+    ObjectString* Concatenate(const ObjectString* a, const ObjectString* b);
+    ObjectFunction* NewFunction(const std::string& name, ObjectFunction::Type type, int arity);
+
+    void AddRootProvider(IRootProvider* provider);
+    void RemoveRootProvider(IRootProvider* provider);
+
+    // For IRootProvider::MarkRoots() and Object::Trace(). During a minor
+    // collection MarkValue() may replace value's object with its promoted copy
+    // and MarkObject() (old objects only) does nothing.
+    void MarkValue(Value& value);
+    void MarkObject(Object* object);
+    bool IsMinorCollection() const;
+
+    bool IsYoung(const Object* object) const
+    {
+        auto* address { reinterpret_cast<const std::byte*>(object) };
+        return address >= mNursery.get() && address < mNurseryEnd;
+    }
+    bool IsYoung(const Value& value) const
+    {
+        return value.IsObject() && IsYoung(value.AsObject());
+    }
+    void WriteBarrier(Object* owner, const Value& value); // after storing value into owner
+
+    void CollectMinor(); // escalates to a major collection if the old space is over its threshold
+    void Collect(); // full collection, nursery first
+
+    std::size_t BytesAllocated() const;
+    int ObjectCount() const;
+    const StringTable& Strings() const;
+
+private:
+    void* AllocateYoung(std::size_t size); // nullptr if it does not fit in an empty nursery
+    void* AllocateOld(std::size_t size);
+    void LinkOld(Object* object);
+    void Free(Object* object);
+    ObjectString* Promote(ObjectString* string);
+
+    void Evacuate(); // minor collection proper
+    void CollectMajor();
+    void Sweep();
+
+    GcOptions mOptions;
+    std::size_t mBytesAllocated { 0 }; // old space
+    std::size_t mNextCollection;
+    int mObjectCount { 0 }; // old space
+
+    std::unique_ptr<std::byte[]> mNursery;
+    std::byte* mNurseryTop;
+    std::byte* mNurseryEnd;
+    int mNurseryObjectCount { 0 };
+
+    enum class Collection {
+        kNone = 0,
+        kMinor,
+        kMajor
+    };
+    Collection mCollection { Collection::kNone };
+
+    Object* mObjects { nullptr }; // old space, intrusive list through Object::mNext
+    std::vector<Object*> mGrayStack;
+    std::vector<Object*> mRememberedSet;
+    std::vector<IRootProvider*> mRootProviders;
+    StringTable mStrings;
+};
+
+}
@@ -1,43 +1,288 @@
 #pragma once
 
 #include "chunk.h" // IWYU pragma: keep
+#include "global_table.h" // IWYU pragma: keep
+#include "heap.h" // IWYU pragma: keep
+#include "iroot_provider.h" // IWYU pragma: keep
 #include "object.h" // IWYU pragma: keep
 #include "value.h" // IWYU pragma: keep
 
+#include <array>
+
 namespace ir {
 
 // NOTE: The jump instructions jump to absolute ips. Switch to relative instead?
 // For real pc ofc relative makes sense, but for this is it worth the effort
 // cos then you'll also have to add instructions for backward jmp (instead of
 // stuffing a signed offset in the bytecode which is even more pain).
+//
+// kGlobal* take a 16-bit little-endian GlobalTable slot, not a constant index.
+//
+// The *Long variants exist for chunks that outgrow the compact operands: a
+// 24-bit constant index, a 16-bit local slot and 32-bit jump targets. All
+// operands are little-endian.
+//
+// Local slots are relative to the frame base. Slot 0 holds the function that
+// is running, its arguments are slots 1..arity.
+//
+// The superinstructions (kAddLocalConst, kGreaterEqual, kJumpIfFalsePop, ...)
+// are never emitted by the compiler directly, only by the peephole pass.
+//
+// The *Number opcodes are quickened arithmetic and comparisons. The VM
+// rewrites a generic opcode into one after seeing it run on two numbers, and
+// back when the guard sees anything else. They never appear in a chunk that
+// has not run, nor in a bytecode cache file.
 enum class Opcode {
     kError = 0,
     kAdd,
+    kAddLocalConst, // local slot, constant index
+    kAddNumber,
+    kCall, // argument count, the callee sits below the arguments
     kConstant,
+    kConstantLong,
     kDivide,
+    kDivideNumber,
     kEqual,
     kFalse,
     kGlobalDefine,
     kGlobalGet,
     kGlobalSet,
     kGreater,
+    kGreaterEqual,
+    kGreaterEqualNumber,
+    kGreaterNumber,
     kJump,
     kJumpIfFalse,
+    kJumpIfFalseLong,
+    kJumpIfFalsePop,
+    kJumpIfFalsePopLong,
     kJumpIfTrue,
+    kJumpIfTrueLong,
+    kJumpLong,
     kLess,
+    kLessEqual,
+    kLessEqualNumber,
+    kLessNumber,
     kLocalGet,
+    kLocalGetLong,
     kLocalSet,
+    kLocalSetLong,
     kMultiply,
+    kMultiplyNumber,
     kNegate,
     kNil,
     kNot,
+    kNotEqual,
     kPop,
     kPopn,
     kPrint,
     kReturn,
     kSubtract,
+    kSubtractNumber,
     kTrue,
     kEof
 };
 
+// kJump -> kJumpLong and so on, opcodes without a long variant map to themselves
+constexpr Opcode LongForm(Opcode opcode)
+{
+    switch (opcode) {
+    case Opcode::kConstant:
+        return Opcode::kConstantLong;
+    case Opcode::kJump:
+        return Opcode::kJumpLong;
+    case Opcode::kJumpIfFalse:
+        return Opcode::kJumpIfFalseLong;
+    case Opcode::kJumpIfFalsePop:
+        return Opcode::kJumpIfFalsePopLong;
+    case Opcode::kJumpIfTrue:
+        return Opcode::kJumpIfTrueLong;
+    case Opcode::kLocalGet:
+        return Opcode::kLocalGetLong;
+    case Opcode::kLocalSet:
+        return Opcode::kLocalSetLong;
+    default:
+        return opcode;
+    }
+}
+
+// The inverse of LongForm
+constexpr Opcode ShortForm(Opcode opcode)
+{
+    switch (opcode) {
+    case Opcode::kConstantLong:
+        return Opcode::kConstant;
+    case Opcode::kJumpLong:
+        return Opcode::kJump;
+    case Opcode::kJumpIfFalseLong:
+        return Opcode::kJumpIfFalse;
+    case Opcode::kJumpIfFalsePopLong:
+        return Opcode::kJumpIfFalsePop;
+    case Opcode::kJumpIfTrueLong:
+        return Opcode::kJumpIfTrue;
+    case Opcode::kLocalGetLong:
+        return Opcode::kLocalGet;
+    case Opcode::kLocalSetLong:
+        return Opcode::kLocalSet;
+    default:
+        return opcode;
+    }
+}
+
+// kAdd -> kAddNumber and so on, opcodes that are never quickened map to themselves
+constexpr Opcode Quickened(Opcode opcode)
+{
+    switch (opcode) {
+    case Opcode::kAdd:
+        return Opcode::kAddNumber;
+    case Opcode::kSubtract:
+        return Opcode::kSubtractNumber;
+    case Opcode::kMultiply:
+        return Opcode::kMultiplyNumber;
+    case Opcode::kDivide:
+        return Opcode::kDivideNumber;
+    case Opcode::kGreater:
+        return Opcode::kGreaterNumber;
+    case Opcode::kGreaterEqual:
+        return Opcode::kGreaterEqualNumber;
+    case Opcode::kLess:
+        return Opcode::kLessNumber;
+    case Opcode::kLessEqual:
+        return Opcode::kLessEqualNumber;
+    default:
+        return opcode;
+    }
+}
+
+// The inverse of Quickened
+constexpr Opcode Generic(Opcode opcode)
+{
+    switch (opcode) {
+    case Opcode::kAddNumber:
+        return Opcode::kAdd;
+    case Opcode::kSubtractNumber:
+        return Opcode::kSubtract;
+    case Opcode::kMultiplyNumber:
+        return Opcode::kMultiply;
+    case Opcode::kDivideNumber:
+        return Opcode::kDivide;
+    case Opcode::kGreaterNumber:
+        return Opcode::kGreater;
+    case Opcode::kGreaterEqualNumber:
+        return Opcode::kGreaterEqual;
+    case Opcode::kLessNumber:
+        return Opcode::kLess;
+    case Opcode::kLessEqualNumber:
+        return Opcode::kLessEqual;
+    default:
+        return opcode;
+    }
+}
+
+constexpr int kOpcodeCount { static_cast<int>(Opcode::kEof) + 1 };
+
+// What an operand refers to, and so how the verifier checks it
+enum class OperandKind {
+    kNone = 0,
+    kConstant, // index into the chunk's constants
+    kLocal, // slot relative to the frame base
+    kGlobal, // GlobalTable slot
+    kJump, // absolute offset into the bytecode
+    kCount, // arguments for kCall, values for kPopn
+    kLocalConstant // kAddLocalConst: a local slot byte, then a constant index byte
+};
+
+struct OpcodeInfo {
+    int mOperandBytes; // following the opcode byte
+    OperandKind mOperand;
+    // Values taken off and left on the stack. Opcodes that only peek at the
+    // top count it as popped and pushed again. kCount operands add to mPops.
+    int mPops;
+    int mPushes;
+    int mScratch; // slots used above mPushes while it runs
+    bool mFallsThrough; // false if the next instruction never runs after this one
+};
+
+constexpr std::array<OpcodeInfo, kOpcodeCount> MakeOpcodeTable()
+{
+    struct Entry {
+        Opcode mOpcode;
+        OpcodeInfo mInfo;
+    };
+
+    // kError and anything unlisted has no info, the verifier rejects it
+    using O = Opcode;
+    using K = OperandKind;
+    constexpr Entry kEntries[] {
+        { O::kAdd, { 0, K::kNone, 2, 1, 0, true } },
+        { O::kAddLocalConst, { 2, K::kLocalConstant, 0, 1, 1, true } }, // pushes both operands when not numbers
+        { O::kAddNumber, { 0, K::kNone, 2, 1, 0, true } },
+        { O::kCall, { 1, K::kCount, 1, 1, 0, true } }, // the callee and the arguments
+        { O::kConstant, { 1, K::kConstant, 0, 1, 0, true } },
+        { O::kConstantLong, { 3, K::kConstant, 0, 1, 0, true } },
+        { O::kDivide, { 0, K::kNone, 2, 1, 0, true } },
+        { O::kDivideNumber, { 0, K::kNone, 2, 1, 0, true } },
+        { O::kEqual, { 0, K::kNone, 2, 1, 0, true } },
+        { O::kFalse, { 0, K::kNone, 0, 1, 0, true } },
+        { O::kGlobalDefine, { 2, K::kGlobal, 1, 0, 0, true } },
+        { O::kGlobalGet, { 2, K::kGlobal, 0, 1, 0, true } },
+        { O::kGlobalSet, { 2, K::kGlobal, 1, 1, 0, true } },
+        { O::kGreater, { 0, K::kNone, 2, 1, 0, true } },
+        { O::kGreaterEqual, { 0, K::kNone, 2, 1, 0, true } },
+        { O::kGreaterEqualNumber, { 0, K::kNone, 2, 1, 0, true } },
+        { O::kGreaterNumber, { 0, K::kNone, 2, 1, 0, true } },
+        { O::kJump, { 2, K::kJump, 0, 0, 0, false } },
+        { O::kJumpIfFalse, { 2, K::kJump, 1, 1, 0, true } },
+        { O::kJumpIfFalseLong, { 4, K::kJump, 1, 1, 0, true } },
+        { O::kJumpIfFalsePop, { 2, K::kJump, 1, 0, 0, true } },
+        { O::kJumpIfFalsePopLong, { 4, K::kJump, 1, 0, 0, true } },
+        { O::kJumpIfTrue, { 2, K::kJump, 1, 1, 0, true } },
+        { O::kJumpIfTrueLong, { 4, K::kJump, 1, 1, 0, true } },
+        { O::kJumpLong, { 4, K::kJump, 0, 0, 0, false } },
+        { O::kLess, { 0, K::kNone, 2, 1, 0, true } },
+        { O::kLessEqual, { 0, K::kNone, 2, 1, 0, true } },
+        { O::kLessEqualNumber, { 0, K::kNone, 2, 1, 0, true } },
+        { O::kLessNumber, { 0, K::kNone, 2, 1, 0, true } },
+        { O::kLocalGet, { 1, K::kLocal, 0, 1, 0, true } },
+        { O::kLocalGetLong, { 2, K::kLocal, 0, 1, 0, true } },
+        { O::kLocalSet, { 1, K::kLocal, 1, 1, 0, true } },
+        { O::kLocalSetLong, { 2, K::kLocal, 1, 1, 0, true } },
+        { O::kMultiply, { 0, K::kNone, 2, 1, 0, true } },
+        { O::kMultiplyNumber, { 0, K::kNone, 2, 1, 0, true } },
+        { O::kNegate, { 0, K::kNone, 1, 1, 0, true } },
+        { O::kNil, { 0, K::kNone, 0, 1, 0, true } },
+        { O::kNot, { 0, K::kNone, 1, 1, 0, true } },
+        { O::kNotEqual, { 0, K::kNone, 2, 1, 0, true } },
+        { O::kPop, { 0, K::kNone, 1, 0, 0, true } },
+        { O::kPopn, { 1, K::kCount, 0, 0, 0, true } },
+        { O::kPrint, { 0, K::kNone, 1, 0, 0, true } },
+        { O::kReturn, { 0, K::kNone, 1, 0, 0, false } },
+        { O::kSubtract, { 0, K::kNone, 2, 1, 0, true } },
+        { O::kSubtractNumber, { 0, K::kNone, 2, 1, 0, true } },
+        { O::kTrue, { 0, K::kNone, 0, 1, 0, true } },
+        { O::kEof, { 0, K::kNone, 0, 0, 0, false } },
+    };
+
+    std::array<OpcodeInfo, kOpcodeCount> table {};
+    table.fill({ 0, K::kNone, 0, 0, 0, false });
+    for (const Entry& entry : kEntries) {
+        table[static_cast<int>(entry.mOpcode)] = entry.mInfo;
+    }
+    return table;
+}
+
+inline constexpr std::array<OpcodeInfo, kOpcodeCount> kOpcodeTable { MakeOpcodeTable() };
+
+// Only for opcodes that exist, check against kOpcodeCount first
+constexpr const OpcodeInfo& GetOpcodeInfo(Opcode opcode)
+{
+    return kOpcodeTable[static_cast<int>(opcode)];
+}
+
+// Bytes following the opcode byte, 0 for a byte that is no opcode
+constexpr int OperandBytes(Opcode opcode)
+{
+    return static_cast<int>(opcode) < kOpcodeCount ? GetOpcodeInfo(opcode).mOperandBytes : 0;
+}
+
 }
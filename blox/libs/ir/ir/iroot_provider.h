@@ -0,0 +1,17 @@
+#pragma once
+
+namespace ir {
+
+class Heap;
+
+// Anything holding references to heap objects outside of the heap itself
+// (VM stacks, globals, functions being compiled) registers with the Heap so
+// that a collection can find them.
+class IRootProvider {
+public:
+    virtual void MarkRoots(Heap& heap) = 0;
+
+    virtual ~IRootProvider() = default;
+};
+
+}
@@ -0,0 +1,41 @@
+#include "line_table.h"
+
+#include <algorithm>
+#include <cassert>
+
+namespace ir {
+
+void LineTable::Add(int offset, int line)
+{
+    assert(mRuns.empty() || mRuns.back().mOffset <= offset);
+
+    if (!mRuns.empty() && mRuns.back().mLine == line) {
+        return;
+    }
+    mRuns.emplace_back(offset, line);
+}
+
+int LineTable::GetLine(int offset) const
+{
+    // Last run starting at or before offset
+    auto it { std::upper_bound(mRuns.begin(), mRuns.end(), offset,
+        [](int offset, const Run& run) { return offset < run.mOffset; }) };
+    if (it == mRuns.begin()) {
+        return -1;
+    }
+    return std::prev(it)->mLine;
+}
+
+void LineTable::Truncate(int offset)
+{
+    while (!mRuns.empty() && mRuns.back().mOffset >= offset) {
+        mRuns.pop_back();
+    }
+}
+
+const std::vector<LineTable::Run>& LineTable::Runs() const
+{
+    return mRuns;
+}
+
+}
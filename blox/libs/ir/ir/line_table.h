@@ -0,0 +1,29 @@
+#pragma once
+
+#include <vector>
+
+namespace ir {
+
+// Run-length encoded map from bytecode offset -> source line. Consecutive
+// bytes almost always share a line, so one run per line change is stored
+// instead of one int per byte.
+class LineTable final {
+public:
+    struct Run {
+        int mOffset; // first bytecode offset with this line
+        int mLine;
+    };
+
+    LineTable() = default;
+
+    void Add(int offset, int line); // offsets must be added in increasing order
+    int GetLine(int offset) const; // O(log runs)
+    void Truncate(int offset); // forget everything from offset on
+
+    const std::vector<Run>& Runs() const;
+
+private:
+    std::vector<Run> mRuns;
+};
+
+}
@@ -0,0 +1,48 @@
+#include "mapped_file.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace ir {
+
+std::unique_ptr<MappedFile> MappedFile::Open(const std::string& path)
+{
+    int fd { open(path.c_str(), O_RDONLY | O_CLOEXEC) };
+    if (fd == -1) {
+        return nullptr;
+    }
+
+    struct stat info {};
+    if (fstat(fd, &info) == -1 || info.st_size == 0) {
+        close(fd);
+        return nullptr;
+    }
+
+    // The mapping keeps the file alive, the descriptor is not needed past this
+    void* data { mmap(nullptr, info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0) };
+    close(fd);
+    if (data == MAP_FAILED) {
+        return nullptr;
+    }
+    return std::unique_ptr<MappedFile>(new MappedFile(static_cast<uint8_t*>(data), info.st_size));
+}
+
+MappedFile::MappedFile(uint8_t* data, std::size_t size)
+    : mData { data }
+    , mSize { size }
+{
+}
+
+MappedFile::~MappedFile()
+{
+    munmap(mData, mSize);
+}
+
+std::span<uint8_t> MappedFile::Bytes() const
+{
+    return { mData, mSize };
+}
+
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string>
+
+namespace ir {
+
+// Private mapping of a whole file. It is copy on write: writes (the VM
+// quickening mapped bytecode) only copy the page they touch and never reach
+// the file. It is unmapped on destruction, so nothing pointing into Bytes()
+// may outlive it.
+class MappedFile final {
+public:
+    static std::unique_ptr<MappedFile> Open(const std::string& path); // nullptr on failure
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    std::span<uint8_t> Bytes() const;
+
+private:
+    MappedFile(uint8_t* data, std::size_t size);
+
+    uint8_t* mData;
+    std::size_t mSize;
+};
+
+}
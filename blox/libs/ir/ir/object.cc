@@ -1,4 +1,5 @@
 #include "object.h"
+#include "heap.h"
 
 #include <fmt/format.h>
 #include <ostream>
@@ -11,14 +12,20 @@ std::ostream& operator<<(std::ostream& out, const Object& object)
     return out;
 }
 
-ObjectString::ObjectString(std::string_view string)
+ObjectString::ObjectString(std::string_view string, uint32_t hash)
     : mString { string }
+    , mHash { hash }
 {
 }
 
 std::string ObjectString::ToString() const
 {
-    return mString;
+    return std::string { mString };
+}
+
+std::size_t ObjectString::Size() const
+{
+    return sizeof(ObjectString) + mString.size();
 }
 
 ObjectFunction::ObjectFunction(const std::string& name, Type type, const int arity)
@@ -33,4 +40,16 @@ std::string ObjectFunction::ToString() const
     return fmt::format("<function= {}>", mName);
 }
 
+void ObjectFunction::Trace(Heap& heap)
+{
+    for (Value& constant : mChunk.mConstants) {
+        heap.MarkValue(constant);
+    }
+}
+
+std::size_t ObjectFunction::Size() const
+{
+    return sizeof(ObjectFunction);
+}
+
 }
@@ -2,24 +2,46 @@
 
 #include "chunk.h"
 
+#include <cstddef>
+#include <cstdint>
 #include <string>
+#include <string_view>
 
 namespace ir {
 
+class Heap;
+
 // Object or its derived classes are not necessarily copyable
+// All objects are allocated and freed by Heap
 class Object {
 public:
     virtual std::string ToString() const = 0;
+    virtual void Trace(Heap& heap) { } // mark every object this one references
+    virtual std::size_t Size() const = 0; // bytes charged to the heap, must not change
     friend std::ostream& operator<<(std::ostream& out, const Object& object);
     virtual ~Object() = default;
+
+    // GC bookkeeping, owned by Heap
+    bool mMarked { false };
+    bool mRemembered { false }; // old object in the remembered set
+    Object* mNext { nullptr }; // old space list
+    Object* mForward { nullptr }; // nursery object that has been promoted
 };
 
+// Only created through Heap::NewString(), which interns them. The characters
+// are stored inline right after the object, so a string is one allocation
+// (a pointer bump in the nursery) and owns no other memory.
 class ObjectString final : public Object {
 public:
-    ObjectString(std::string_view string);
     std::string ToString() const override;
+    std::size_t Size() const override;
+
+    const std::string_view mString;
+    const uint32_t mHash;
 
-    const std::string mString;
+private:
+    friend class Heap;
+    ObjectString(std::string_view string, uint32_t hash); // string must already be in place
 };
 
 class ObjectFunction final : public Object {
@@ -32,11 +54,16 @@ public:
 
     ObjectFunction(const std::string& name, Type type, const int arity);
     std::string ToString() const override;
+    void Trace(Heap& heap) override;
+    std::size_t Size() const override;
 
     const std::string mName;
     Type mType;
     const int mArity;
     Chunk mChunk;
+    // Values the function ever has on its frame, slot 0 and the arguments
+    // included. Set by Verifier, the VM only runs verified functions.
+    int mMaxStackDepth { -1 };
 };
 
 }
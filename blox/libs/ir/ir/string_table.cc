@@ -0,0 +1,100 @@
+#include "string_table.h"
+#include "object.h"
+
+#include <cassert>
+
+namespace ir {
+
+ObjectString* StringTable::Find(std::string_view string, uint32_t hash) const
+{
+    if (mEntries.empty()) {
+        return nullptr;
+    }
+
+    int mask { static_cast<int>(mEntries.size()) - 1 };
+    for (int index { static_cast<int>(hash) & mask };; index = NextIndex(index)) {
+        ObjectString* entry { mEntries[index] };
+        if (entry == nullptr) {
+            return nullptr;
+        }
+        if (entry != kTombstone && entry->mHash == hash && entry->mString == string) {
+            return entry;
+        }
+    }
+}
+
+void StringTable::Insert(ObjectString* string)
+{
+    if (mUsed + 1 > mEntries.size() * kMaxLoad) {
+        Grow();
+    }
+
+    int mask { static_cast<int>(mEntries.size()) - 1 };
+    int index { static_cast<int>(string->mHash) & mask };
+    while (mEntries[index] != nullptr && mEntries[index] != kTombstone) {
+        index = NextIndex(index);
+    }
+
+    if (mEntries[index] == nullptr) {
+        mUsed++;
+    }
+    mEntries[index] = string;
+    mCount++;
+}
+
+void StringTable::Remove(ObjectString* string)
+{
+    if (mEntries.empty()) {
+        return;
+    }
+
+    int mask { static_cast<int>(mEntries.size()) - 1 };
+    for (int index { static_cast<int>(string->mHash) & mask };; index = NextIndex(index)) {
+        ObjectString* entry { mEntries[index] };
+        if (entry == nullptr) {
+            return;
+        }
+        if (entry == string) {
+            // Keep the probe chain intact for strings inserted after this one
+            mEntries[index] = kTombstone;
+            mCount--;
+            return;
+        }
+    }
+}
+
+int StringTable::Size() const
+{
+    return mCount;
+}
+
+uint32_t StringTable::Hash(std::string_view string)
+{
+    uint32_t hash { 2166136261u };
+    for (char character : string) {
+        hash ^= static_cast<uint8_t>(character);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+void StringTable::Grow()
+{
+    std::vector<ObjectString*> old { std::move(mEntries) };
+    mEntries.assign(old.empty() ? 16 : old.size() * 2, nullptr);
+    mCount = 0;
+    mUsed = 0;
+
+    for (ObjectString* entry : old) {
+        if (entry != nullptr && entry != kTombstone) {
+            Insert(entry);
+        }
+    }
+}
+
+int StringTable::NextIndex(int index) const
+{
+    return (index + 1) & (mEntries.size() - 1);
+}
+
+}
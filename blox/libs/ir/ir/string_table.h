@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+namespace ir {
+
+class ObjectString;
+
+// Open-addressing (linear probing) set of interned strings. Lookups compare
+// the cached hash first and only then the characters.
+class StringTable final {
+public:
+    StringTable() = default;
+
+    ObjectString* Find(std::string_view string, uint32_t hash) const;
+    void Insert(ObjectString* string); // string must not already be present
+    void Remove(ObjectString* string);
+
+    // Interned strings are weak references, after a collection every entry is
+    // replaced by replace(entry): the same string, the string it moved to, or
+    // nullptr if it died
+    template <typename Replace>
+    void Rewrite(Replace replace)
+    {
+        for (ObjectString*& entry : mEntries) {
+            if (entry == nullptr || entry == kTombstone) {
+                continue;
+            }
+            entry = replace(entry);
+            if (entry == nullptr) {
+                entry = kTombstone;
+                mCount--;
+            }
+        }
+    }
+
+    int Size() const;
+
+    static uint32_t Hash(std::string_view string); // FNV-1a
+
+private:
+    static constexpr double kMaxLoad { 0.75 };
+
+    void Grow();
+    int NextIndex(int index) const;
+
+    // nullptr = empty, kTombstone = removed
+    static inline ObjectString* const kTombstone { reinterpret_cast<ObjectString*>(1) };
+
+    std::vector<ObjectString*> mEntries;
+    int mCount { 0 }; // live strings
+    int mUsed { 0 }; // live strings + tombstones
+};
+
+}
@@ -6,35 +6,17 @@
 
 namespace ir {
 
-Value::Value()
-    : mType { Type::kNil }
-{
-}
-
-Value::Value(double number)
-    : mType { Type::kNumber }
-{
-    mAs.number = number;
-}
-
-Value::Value(bool boolean)
-    : mType { Type::kBool }
-{
-    mAs.boolean = boolean;
-}
-
-Value::Value(const std::string& string)
-    : mType { Type::kString }
+#ifdef BLOX_NAN_BOXING
+Value::Value(ObjectString* string)
+    : mBits { kObjectTag | reinterpret_cast<uint64_t>(static_cast<Object*>(string)) }
 {
-    Object* object = new ObjectString(string);
-    mAs.object = object;
 }
 
-Value::Value(std::string_view string)
-    : Value(std::string { string })
+Value::Value(ObjectFunction* function)
+    : mBits { kObjectTag | kFunctionBit | reinterpret_cast<uint64_t>(static_cast<Object*>(function)) }
 {
 }
-
+#else
 Value::Value(ObjectString* string)
     : mType { Type::kString }
 {
@@ -46,20 +28,23 @@ Value::Value(ObjectFunction* function)
 {
     mAs.object = static_cast<Object*>(function);
 }
+#endif
 
 std::string Value::ToString() const
 {
-    switch (mType) {
+    switch (GetType()) {
     case Type::kNumber:
-        return fmt::format("number= {}", mAs.number);
+        return fmt::format("number= {}", AsNumber());
+    case Type::kUndefined:
+        return fmt::format("undefined");
     case Type::kNil:
         return fmt::format("nil");
     case Type::kBool:
-        return fmt::format("boolean= {}", mAs.boolean);
+        return fmt::format("boolean= {}", AsBool());
     case Type::kString:
-        return fmt::format("string= {}", mAs.object->ToString());
+        return fmt::format("string= {}", AsObject()->ToString());
     case Type::kFunction:
-        return fmt::format("function= {}", mAs.object->ToString());
+        return fmt::format("function= {}", AsObject()->ToString());
     case Type::kError:
         spdlog::error("Value type enum is kError!");
         exit(1);
@@ -70,24 +55,21 @@ std::string Value::ToString() const
 
 bool operator==(const Value& a, const Value& b)
 {
-    if (a.mType != b.mType) {
+    if (a.GetType() != b.GetType()) {
         return false;
     }
 
-    switch (a.mType) {
+    switch (a.GetType()) {
+    case Value::Type::kUndefined:
     case Value::Type::kNil:
         return true;
     case Value::Type::kNumber:
-        return a.mAs.number == b.mAs.number;
+        return a.AsNumber() == b.AsNumber(); // not bitwise, NaN != NaN
     case Value::Type::kBool:
-        return a.mAs.boolean == b.mAs.boolean;
-    case Value::Type::kString: {
-        ObjectString* x = static_cast<ObjectString*>(a.mAs.object);
-        ObjectString* y = static_cast<ObjectString*>(b.mAs.object);
-        return x->mString == y->mString;
-    }
+        return a.AsBool() == b.AsBool();
+    case Value::Type::kString: // interned
     case Value::Type::kFunction:
-        return a.mAs.object == b.mAs.object;
+        return a.AsObject() == b.AsObject();
     default:
         assert(6 > 9);
     }
@@ -2,6 +2,9 @@
 
 #include <fmt/ostream.h>
 
+#include <bit>
+#include <cstdint>
+
 namespace ir {
 
 class Object;
@@ -9,10 +12,14 @@ class ObjectString;
 class ObjectFunction;
 
 // Value is copyable
+// With BLOX_NAN_BOXING a Value is a single 64-bit word: numbers are stored as
+// raw doubles and everything else lives in the quiet NaN space. Without it a
+// Value is a tagged union. Either way, only go through the accessors below.
 struct Value {
 public:
     enum class Type {
         kError = 0,
+        kUndefined, // value of a global slot before it is defined, never on the stack
         kNil,
         kNumber,
         kBool,
@@ -23,24 +30,179 @@ public:
     Value();
     Value(double number);
     Value(bool boolean);
-    Value(const std::string& string);
-    Value(std::string_view string);
     Value(Object*) = delete;
-    Value(ObjectString* string);
+    Value(ObjectString* string); // out of line, the object types are incomplete here
     Value(ObjectFunction* function);
+    static Value Undefined();
+
+    Type GetType() const;
+    bool IsNumber() const;
+    bool IsObject() const; // string or function
+
+    double AsNumber() const;
+    bool AsBool() const;
+    Object* AsObject() const;
+    void SetObject(Object* object); // for the heap when it moves an object, the type is kept
+
+    std::string ToString() const;
+    friend bool operator==(const Value&, const Value&);
+    friend std::ostream& operator<<(std::ostream& out, const Value& value);
+
+private:
+#ifdef BLOX_NAN_BOXING
+    // Anything with all of kQuietNan set is not a number. Objects also have the
+    // sign bit, a kind bit and a 48-bit pointer; the rest store their Type in
+    // the low bits, and true sets one more bit on top of kBool.
+    static constexpr uint64_t kQuietNan { 0x7ffc000000000000 };
+    static constexpr uint64_t kSignBit { 0x8000000000000000 };
+    static constexpr uint64_t kObjectTag { kQuietNan | kSignBit };
+    static constexpr uint64_t kFunctionBit { uint64_t { 1 } << 48 };
+    static constexpr uint64_t kPointerMask { (uint64_t { 1 } << 48) - 1 };
+    static constexpr uint64_t kTypeMask { 0x7 };
+    static constexpr uint64_t kTrueBit { 0x8 };
 
+    static constexpr uint64_t Singleton(Type type)
+    {
+        return kQuietNan | static_cast<uint64_t>(type);
+    }
+
+    uint64_t mBits;
+#else
     Type mType;
     union {
         double number;
         bool boolean;
         Object* object;
     } mAs;
-
-    std::string ToString() const;
-    friend bool operator==(const Value&, const Value&);
-    friend std::ostream& operator<<(std::ostream& out, const Value& value);
+#endif
 };
 
+#ifdef BLOX_NAN_BOXING
+static_assert(sizeof(Value) == 8);
+
+inline Value::Value()
+    : mBits { Singleton(Type::kNil) }
+{
+}
+
+inline Value::Value(double number)
+    : mBits { std::bit_cast<uint64_t>(number) }
+{
+}
+
+inline Value::Value(bool boolean)
+    : mBits { Singleton(Type::kBool) | (boolean ? kTrueBit : 0) }
+{
+}
+
+inline Value Value::Undefined()
+{
+    Value value {};
+    value.mBits = Singleton(Type::kUndefined);
+    return value;
+}
+
+inline Value::Type Value::GetType() const
+{
+    if (IsNumber()) {
+        return Type::kNumber;
+    }
+    if (IsObject()) {
+        return (mBits & kFunctionBit) != 0 ? Type::kFunction : Type::kString;
+    }
+    return static_cast<Type>(mBits & kTypeMask);
+}
+
+inline bool Value::IsNumber() const
+{
+    return (mBits & kQuietNan) != kQuietNan;
+}
+
+inline bool Value::IsObject() const
+{
+    return (mBits & kObjectTag) == kObjectTag;
+}
+
+inline double Value::AsNumber() const
+{
+    return std::bit_cast<double>(mBits);
+}
+
+inline bool Value::AsBool() const
+{
+    return mBits == (Singleton(Type::kBool) | kTrueBit);
+}
+
+inline Object* Value::AsObject() const
+{
+    return reinterpret_cast<Object*>(mBits & kPointerMask);
+}
+
+inline void Value::SetObject(Object* object)
+{
+    mBits = (mBits & ~kPointerMask) | reinterpret_cast<uint64_t>(object);
+}
+#else
+inline Value::Value()
+    : mType { Type::kNil }
+{
+}
+
+inline Value::Value(double number)
+    : mType { Type::kNumber }
+{
+    mAs.number = number;
+}
+
+inline Value::Value(bool boolean)
+    : mType { Type::kBool }
+{
+    mAs.boolean = boolean;
+}
+
+inline Value Value::Undefined()
+{
+    Value value {};
+    value.mType = Type::kUndefined;
+    return value;
+}
+
+inline Value::Type Value::GetType() const
+{
+    return mType;
+}
+
+inline bool Value::IsNumber() const
+{
+    return mType == Type::kNumber;
+}
+
+inline bool Value::IsObject() const
+{
+    return mType == Type::kString || mType == Type::kFunction;
+}
+
+inline double Value::AsNumber() const
+{
+    return mAs.number;
+}
+
+inline bool Value::AsBool() const
+{
+    return mAs.boolean;
+}
+
+inline Object* Value::AsObject() const
+{
+    return mAs.object;
+}
+
+inline void Value::SetObject(Object* object)
+{
+    mAs.object = object;
+}
+#endif
+
 }
 
 template <>
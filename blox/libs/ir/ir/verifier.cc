@@ -0,0 +1,160 @@
+#include "verifier.h"
+
+#include "ir.h"
+#include "object.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <fmt/format.h>
+#include <span>
+#include <utility>
+
+namespace ir {
+
+Verifier::Verifier(int globalCount)
+    : mGlobalCount { globalCount }
+{
+}
+
+bool Verifier::Verify(ObjectFunction* function)
+{
+    mFunction = function;
+    mError.clear();
+
+    std::span<const uint8_t> code { std::as_const(function->mChunk).Code() };
+    int size { static_cast<int>(code.size()) };
+    int constantCount { static_cast<int>(function->mChunk.mConstants.size()) };
+    if (size == 0) {
+        return Fail(0, "no code");
+    }
+    // kCall passes at most a byte's worth of arguments, main none
+    bool isMain { function->mType == ObjectFunction::Type::kMain };
+    if (function->mArity < 0 || function->mArity > (isMain ? 0 : 0xFF)) {
+        return Fail(0, fmt::format("arity {}", function->mArity));
+    }
+
+    // Instruction boundaries first, jump targets are checked against them
+    mIsInstruction.assign(size, false);
+    for (int offset { 0 }; offset < size;) {
+        uint8_t byte { code[offset] };
+        if (byte >= kOpcodeCount || byte == static_cast<uint8_t>(Opcode::kError)) {
+            return Fail(offset, fmt::format("unknown opcode {}", byte));
+        }
+        mIsInstruction[offset] = true;
+        offset += 1 + OperandBytes(static_cast<Opcode>(byte));
+        if (offset > size) {
+            return Fail(offset, "operands run past the end of the code");
+        }
+    }
+
+    // Slot 0 holds the function, the arguments follow
+    int entryDepth { 1 + function->mArity };
+    int maxDepth { entryDepth };
+    mDepths.assign(size, -1);
+    mDepths[0] = entryDepth;
+    mPending.assign(1, 0);
+
+    while (!mPending.empty()) {
+        int offset { mPending.back() };
+        mPending.pop_back();
+        int depth { mDepths[offset] };
+
+        Opcode opcode { static_cast<Opcode>(code[offset]) };
+        const OpcodeInfo& info { GetOpcodeInfo(opcode) };
+        int64_t operand { 0 };
+        for (int i { 0 }; i < info.mOperandBytes; i++) {
+            operand |= static_cast<int64_t>(code[offset + 1 + i]) << (8 * i); // Little-endian
+        }
+
+        int pops { info.mPops + (info.mOperand == OperandKind::kCount ? static_cast<int>(operand) : 0) };
+        if (depth < pops) {
+            return Fail(offset, fmt::format("pops {} values with {} on the stack", pops, depth));
+        }
+        int after { depth - pops + info.mPushes };
+        maxDepth = std::max(maxDepth, after + info.mScratch);
+
+        switch (info.mOperand) {
+        case OperandKind::kConstant:
+            if (operand >= constantCount) {
+                return Fail(offset, fmt::format("constant {} out of range", operand));
+            }
+            break;
+        case OperandKind::kLocal:
+            if (operand >= depth) {
+                return Fail(offset, fmt::format("local slot {} with {} on the stack", operand, depth));
+            }
+            break;
+        case OperandKind::kLocalConstant:
+            if ((operand & 0xFF) >= depth || (operand >> 8) >= constantCount) {
+                return Fail(offset, "local slot or constant out of range");
+            }
+            break;
+        case OperandKind::kGlobal:
+            if (operand >= mGlobalCount) {
+                return Fail(offset, fmt::format("global slot {} out of range", operand));
+            }
+            break;
+        case OperandKind::kJump:
+            if (!Reach(offset, operand, after)) {
+                return false;
+            }
+            break;
+        case OperandKind::kNone:
+        case OperandKind::kCount:
+            break;
+        }
+
+        // Main ends the program with kEof, returning from it would pop a
+        // frame that is not there. Functions return.
+        if ((opcode == Opcode::kReturn && isMain) || (opcode == Opcode::kEof && !isMain)) {
+            return Fail(offset, fmt::format("{} in {}", opcode == Opcode::kReturn ? "return" : "end of program",
+                isMain ? "main" : "a function"));
+        }
+
+        if (info.mFallsThrough && !Reach(offset, offset + 1 + info.mOperandBytes, after)) {
+            return false;
+        }
+    }
+
+    function->mMaxStackDepth = maxDepth;
+    return true;
+}
+
+const std::string& Verifier::Error() const
+{
+    return mError;
+}
+
+const std::vector<int>& Verifier::Depths() const
+{
+    return mDepths;
+}
+
+bool Verifier::Fail(int offset, const std::string& message)
+{
+    mError = fmt::format("{} at {:04d}: {}", mFunction->mName, offset, message);
+    return false;
+}
+
+bool Verifier::Reach(int offset, int64_t target, int depth)
+{
+    if (target < 0) {
+        return Fail(offset, "jumps before the start of the code");
+    }
+    if (target >= static_cast<int64_t>(mDepths.size())) {
+        return Fail(offset, "runs past the end of the code");
+    }
+    if (!mIsInstruction[target]) {
+        return Fail(offset, fmt::format("jumps into the middle of an instruction at {:04d}", target));
+    }
+    if (mDepths[target] == -1) {
+        mDepths[target] = depth;
+        mPending.emplace_back(target);
+    } else if (mDepths[target] != depth) {
+        return Fail(offset, fmt::format("reaches {:04d} with {} values, it was reached with {} before",
+            target, depth, mDepths[target]));
+    }
+    return true;
+}
+
+}
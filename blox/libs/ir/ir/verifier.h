@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace ir {
+
+class ObjectFunction;
+
+// Checks a function's bytecode before anything runs it, driven by the opcode
+// table (see GetOpcodeInfo()): every instruction is a known opcode with all
+// of its operands inside the code, every jump lands on an instruction, and
+// constant, local and global operands are in range.
+//
+// The stack depth is followed along every path through the code. Paths that
+// meet must agree on it, nothing may pop what is not there, and the code
+// cannot run off its end. The deepest point becomes the function's
+// mMaxStackDepth, which is what lets the VM check for room once per frame
+// instead of on every push.
+//
+// Functions in the constant pool are not followed, each is verified on its
+// own (the compiler finishes nested functions first).
+class Verifier final {
+public:
+    explicit Verifier(int globalCount); // global operands must be below this
+    bool Verify(ObjectFunction* function); // false, with Error() set, if it is malformed
+    const std::string& Error() const;
+    // After a successful Verify(): the stack depth on entry by bytecode
+    // offset, -1 where no instruction starts or nothing reaches it
+    const std::vector<int>& Depths() const;
+
+private:
+    bool Fail(int offset, const std::string& message);
+    bool Reach(int offset, int64_t target, int depth); // records the depth at target, queues it the first time
+
+    int mGlobalCount;
+    const ObjectFunction* mFunction { nullptr };
+    std::string mError;
+    std::vector<bool> mIsInstruction; // by offset
+    std::vector<int> mDepths; // stack depth on entry by offset, -1 until reached
+    std::vector<int> mPending; // reached, not walked yet
+};
+
+}
@@ -0,0 +1,77 @@
+#include "code.h"
+
+#include <fmt/format.h>
+#include <magic_enum/magic_enum.hpp>
+
+namespace regvm {
+
+namespace {
+
+std::string Operand(const Function& function, uint16_t operand)
+{
+    if (operand & kConstantFlag) {
+        int index { operand & ~kConstantFlag };
+        return fmt::format("k{} '{}'", index, function.mConstants[index]);
+    }
+    return fmt::format("r{}", operand);
+}
+
+}
+
+std::string Function::Disassemble() const
+{
+    std::string toPrint { fmt::format("== {} ({} registers) ==", mSource->mName, mRegisterCount) };
+    int line { -1 };
+
+    for (int index { 0 }; index < static_cast<int>(mCode.size()); index++) {
+        const Instruction& instruction { mCode[index] };
+        std::string lineString { "|" };
+        if (mLines.GetLine(index) != line) {
+            line = mLines.GetLine(index);
+            lineString = std::to_string(line);
+        }
+        toPrint += fmt::format("\n{:04d} {:>4} {:<16}", index, lineString, magic_enum::enum_name(instruction.mOpcode));
+
+        switch (instruction.mOpcode) {
+        case Opcode::kCall:
+            toPrint += fmt::format("r{} ({} arguments)", instruction.mA, instruction.mB);
+            break;
+        case Opcode::kGlobalDefine:
+        case Opcode::kGlobalSet:
+            toPrint += fmt::format("g{} {}", instruction.mA, Operand(*this, instruction.mB));
+            break;
+        case Opcode::kGlobalGet:
+            toPrint += fmt::format("r{} g{}", instruction.mA, instruction.mB);
+            break;
+        case Opcode::kJump:
+            toPrint += fmt::format("-> {:04d}", instruction.Target());
+            break;
+        case Opcode::kJumpIfFalse:
+        case Opcode::kJumpIfTrue:
+            toPrint += fmt::format("{} -> {:04d}", Operand(*this, instruction.mA), instruction.Target());
+            break;
+        case Opcode::kLoadConstant:
+            toPrint += fmt::format("r{} k{} '{}'", instruction.mA, instruction.Target(),
+                mConstants[instruction.Target()]);
+            break;
+        case Opcode::kMove:
+        case Opcode::kNegate:
+        case Opcode::kNot:
+            toPrint += fmt::format("r{} {}", instruction.mA, Operand(*this, instruction.mB));
+            break;
+        case Opcode::kPrint:
+        case Opcode::kReturn:
+            toPrint += Operand(*this, instruction.mA);
+            break;
+        case Opcode::kEof:
+            break;
+        default:
+            toPrint += fmt::format("r{} {} {}", instruction.mA, Operand(*this, instruction.mB),
+                Operand(*this, instruction.mC));
+            break;
+        }
+    }
+    return toPrint;
+}
+
+}
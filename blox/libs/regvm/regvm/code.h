@@ -0,0 +1,86 @@
+#pragma once
+
+#include <ir/line_table.h>
+#include <ir/object.h>
+#include <ir/value.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace regvm {
+
+// Three-address code for the register VM. Registers are the slots of a
+// frame, numbered from its base exactly like the stack VM's local slots:
+// register 0 holds the running function, the arguments follow, then the
+// locals and the temporaries.
+//
+// Operands written RK are a register, or with kConstantFlag set an index
+// into the function's constants, so literals and locals feed arithmetic
+// directly. Jump targets are instruction indices, B holds the low half and
+// C the high half (see Instruction::Target()).
+enum class Opcode : uint16_t {
+    kAdd = 0, // A = RK(B) + RK(C), the other binary opcodes likewise
+    kCall, // calls A with the B registers above it as arguments, the result lands in A. C is its call cache.
+    kDivide,
+    kEqual,
+    kGlobalDefine, // global A = RK(B)
+    kGlobalGet, // A = global B
+    kGlobalSet, // global A = RK(B)
+    kGreater,
+    kGreaterEqual,
+    kJump,
+    kJumpIfFalse, // on RK(A)
+    kJumpIfTrue, // on RK(A)
+    kLess,
+    kLessEqual,
+    kLoadConstant, // A = constant BC, for the constants RK cannot reach
+    kMove, // A = RK(B)
+    kMultiply,
+    kNegate, // A = -RK(B)
+    kNot, // A = !RK(B)
+    kNotEqual,
+    kPrint, // RK(A)
+    kReturn, // RK(A)
+    kSubtract,
+    kEof
+};
+
+constexpr int kOpcodeCount { static_cast<int>(Opcode::kEof) + 1 };
+constexpr uint16_t kConstantFlag { 0x8000 };
+constexpr int kMaxRegisters { kConstantFlag };
+
+struct Instruction {
+    Opcode mOpcode;
+    uint16_t mA;
+    uint16_t mB;
+    uint16_t mC;
+
+    uint32_t Target() const { return mB | (static_cast<uint32_t>(mC) << 16); }
+};
+
+struct Function;
+
+// Remembers the last function a kCall called, so that calling it again does
+// not have to look up its translation
+struct CallCache {
+    const ir::ObjectFunction* mCallee { nullptr };
+    Function* mTarget { nullptr };
+};
+
+// The translation of one ir::ObjectFunction. Functions are never moved by
+// the GC, so mSource stays valid as long as something references it.
+struct Function {
+    ir::ObjectFunction* mSource;
+    std::vector<Instruction> mCode;
+    ir::LineTable mLines; // by instruction index
+    // The chunk's constants, then nil, true and false as far as the code
+    // uses them. Strings among them move with the GC, see Vm::MarkRoots().
+    std::vector<ir::Value> mConstants;
+    int mRegisterCount; // the verified stack depth of mSource
+    std::vector<CallCache> mCallCaches; // by kCall's C
+
+    std::string Disassemble() const;
+};
+
+}
@@ -0,0 +1,365 @@
+#include "translator.h"
+
+#include <ir/verifier.h>
+
+#include <cassert>
+#include <fmt/format.h>
+#include <span>
+#include <utility>
+
+namespace regvm {
+
+Translator::Translator(int globalCount)
+    : mGlobalCount { globalCount }
+{
+}
+
+std::unique_ptr<Function> Translator::Translate(ir::ObjectFunction* function)
+{
+    mError.clear();
+    ir::Verifier verifier(mGlobalCount);
+    if (!verifier.Verify(function)) {
+        mError = verifier.Error();
+        return nullptr;
+    }
+    if (function->mMaxStackDepth > kMaxRegisters) {
+        mError = fmt::format("{} needs {} registers, at most {} can be addressed", function->mName,
+            function->mMaxStackDepth, kMaxRegisters);
+        return nullptr;
+    }
+
+    const ir::Chunk& chunk { function->mChunk };
+    std::span<const uint8_t> code { chunk.Code() };
+    const std::vector<int>& depths { verifier.Depths() };
+    int size { static_cast<int>(code.size()) };
+
+    // Jump targets start blocks, where every slot must be in its home register
+    std::vector<bool> isTarget(size, false);
+    for (int offset { 0 }; offset < size; offset += 1 + ir::OperandBytes(static_cast<ir::Opcode>(code[offset]))) {
+        const ir::OpcodeInfo& info { ir::GetOpcodeInfo(static_cast<ir::Opcode>(code[offset])) };
+        if (depths[offset] != -1 && info.mOperand == ir::OperandKind::kJump) {
+            uint32_t target { 0 };
+            for (int i { 0 }; i < info.mOperandBytes; i++) {
+                target |= static_cast<uint32_t>(code[offset + 1 + i]) << (8 * i);
+            }
+            isTarget[target] = true;
+        }
+    }
+
+    mFunction = std::make_unique<Function>(Function { function, {}, {}, chunk.mConstants, function->mMaxStackDepth, {} });
+    mSlots.clear();
+    mBlockStart = 0;
+    mJumps.clear();
+    mNil.reset();
+    mTrue.reset();
+    mFalse.reset();
+
+    std::vector<int> indexAt(size, -1);
+    bool fallsThrough { false }; // from the instruction before
+    for (int offset { 0 }; offset < size;) {
+        auto opcode { static_cast<ir::Opcode>(code[offset]) };
+        int next { offset + 1 + ir::OperandBytes(opcode) };
+        // Never reached, nothing to translate
+        if (depths[offset] == -1) {
+            fallsThrough = false;
+            offset = next;
+            continue;
+        }
+
+        int line { chunk.GetLine(offset) };
+        if (isTarget[offset] || !fallsThrough) {
+            if (fallsThrough) {
+                MaterializeFrom(0, line);
+            }
+            mSlots.assign(depths[offset], { Slot::Kind::kHome, 0 });
+            mBlockStart = mFunction->mCode.size();
+        }
+        indexAt[offset] = mFunction->mCode.size();
+        Translate(opcode, &code[offset + 1], line);
+
+        fallsThrough = ir::GetOpcodeInfo(opcode).mFallsThrough;
+        offset = next;
+    }
+
+    for (int jump : mJumps) {
+        Instruction& instruction { mFunction->mCode[jump] };
+        uint32_t target { static_cast<uint32_t>(indexAt[instruction.Target()]) };
+        instruction.mB = static_cast<uint16_t>(target);
+        instruction.mC = static_cast<uint16_t>(target >> 16);
+    }
+    return std::move(mFunction);
+}
+
+const std::string& Translator::Error() const
+{
+    return mError;
+}
+
+void Translator::Translate(ir::Opcode opcode, const uint8_t* operands, int line)
+{
+    const ir::OpcodeInfo& info { ir::GetOpcodeInfo(opcode) };
+    uint32_t operand { 0 };
+    for (int i { 0 }; i < info.mOperandBytes; i++) {
+        operand |= static_cast<uint32_t>(operands[i]) << (8 * i); // Little-endian
+    }
+    int top { static_cast<int>(mSlots.size()) - 1 };
+
+    // Long and quickened forms translate like the plain ones
+    switch (ir::Generic(ir::ShortForm(opcode))) {
+    case ir::Opcode::kConstant:
+        PushConstant(operand);
+        break;
+    case ir::Opcode::kNil:
+        PushConstant(ConstantFor(ir::Value(), mNil));
+        break;
+    case ir::Opcode::kTrue:
+        PushConstant(ConstantFor(ir::Value(true), mTrue));
+        break;
+    case ir::Opcode::kFalse:
+        PushConstant(ConstantFor(ir::Value(false), mFalse));
+        break;
+    case ir::Opcode::kLocalGet: {
+        Slot local { mSlots[operand] };
+        mSlots.push_back(local.mKind == Slot::Kind::kHome ? Slot { Slot::Kind::kRegister, static_cast<int>(operand) } : local);
+        break;
+    }
+    case ir::Opcode::kLocalSet: {
+        int local { static_cast<int>(operand) };
+        Slot value { mSlots[top] };
+        if (local == top || (value.mKind == Slot::Kind::kRegister && value.mIndex == local)) {
+            break;
+        }
+        // Copies taken before the assignment keep the old value
+        MaterializeCopiesOf(local, line);
+
+        std::vector<Instruction>& code { mFunction->mCode };
+        if (value.mKind == Slot::Kind::kHome && static_cast<int>(code.size()) > mBlockStart
+            && WritesA(code.back().mOpcode) && code.back().mA == top) {
+            code.back().mA = local;
+            mSlots[top] = { Slot::Kind::kRegister, local };
+        } else {
+            Emit(Opcode::kMove, local, Operand(top, line), 0, line);
+        }
+        mSlots[local] = { Slot::Kind::kHome, 0 };
+        break;
+    }
+    case ir::Opcode::kAddLocalConst: {
+        uint16_t local { Operand(operand & 0xFF, line) };
+        Emit(Opcode::kAdd, top + 1, local, kConstantFlag | (operand >> 8), line);
+        mSlots.push_back({ Slot::Kind::kHome, 0 });
+        break;
+    }
+    case ir::Opcode::kGlobalGet:
+        Emit(Opcode::kGlobalGet, top + 1, operand, 0, line);
+        mSlots.push_back({ Slot::Kind::kHome, 0 });
+        break;
+    case ir::Opcode::kGlobalSet:
+        Emit(Opcode::kGlobalSet, operand, Operand(top, line), 0, line);
+        break;
+    case ir::Opcode::kGlobalDefine:
+        Emit(Opcode::kGlobalDefine, operand, Operand(top, line), 0, line);
+        mSlots.pop_back();
+        break;
+    case ir::Opcode::kPop:
+        mSlots.pop_back();
+        break;
+    case ir::Opcode::kPopn:
+        mSlots.resize(mSlots.size() - operand);
+        break;
+    case ir::Opcode::kPrint:
+        Emit(Opcode::kPrint, Operand(top, line), 0, 0, line);
+        mSlots.pop_back();
+        break;
+    case ir::Opcode::kNegate:
+        Unary(Opcode::kNegate, line);
+        break;
+    case ir::Opcode::kNot:
+        Unary(Opcode::kNot, line);
+        break;
+    case ir::Opcode::kAdd:
+        Binary(Opcode::kAdd, line);
+        break;
+    case ir::Opcode::kSubtract:
+        Binary(Opcode::kSubtract, line);
+        break;
+    case ir::Opcode::kMultiply:
+        Binary(Opcode::kMultiply, line);
+        break;
+    case ir::Opcode::kDivide:
+        Binary(Opcode::kDivide, line);
+        break;
+    case ir::Opcode::kEqual:
+        Binary(Opcode::kEqual, line);
+        break;
+    case ir::Opcode::kNotEqual:
+        Binary(Opcode::kNotEqual, line);
+        break;
+    case ir::Opcode::kGreater:
+        Binary(Opcode::kGreater, line);
+        break;
+    case ir::Opcode::kGreaterEqual:
+        Binary(Opcode::kGreaterEqual, line);
+        break;
+    case ir::Opcode::kLess:
+        Binary(Opcode::kLess, line);
+        break;
+    case ir::Opcode::kLessEqual:
+        Binary(Opcode::kLessEqual, line);
+        break;
+    case ir::Opcode::kJump:
+        MaterializeFrom(0, line);
+        EmitJump(Opcode::kJump, 0, operand, line);
+        break;
+    case ir::Opcode::kJumpIfFalse:
+        MaterializeFrom(0, line);
+        EmitJump(Opcode::kJumpIfFalse, top, operand, line);
+        break;
+    case ir::Opcode::kJumpIfTrue:
+        MaterializeFrom(0, line);
+        EmitJump(Opcode::kJumpIfTrue, top, operand, line);
+        break;
+    case ir::Opcode::kJumpIfFalsePop: {
+        // The condition is gone on both paths, it can stay wherever it is
+        uint16_t condition { Operand(top, line) };
+        mSlots.pop_back();
+        MaterializeFrom(0, line);
+        EmitJump(Opcode::kJumpIfFalse, condition, operand, line);
+        break;
+    }
+    case ir::Opcode::kCall: {
+        int base { top - static_cast<int>(operand) };
+        MaterializeFrom(base, line);
+        Emit(Opcode::kCall, base, operand, mFunction->mCallCaches.size(), line);
+        mFunction->mCallCaches.emplace_back();
+        mSlots.resize(base);
+        mSlots.push_back({ Slot::Kind::kHome, 0 });
+        break;
+    }
+    case ir::Opcode::kReturn:
+        Emit(Opcode::kReturn, Operand(top, line), 0, 0, line);
+        break;
+    case ir::Opcode::kEof:
+        Emit(Opcode::kEof, 0, 0, 0, line);
+        break;
+    default:
+        // The verifier lets nothing else through
+        assert(false);
+    }
+}
+
+void Translator::Binary(Opcode opcode, int line)
+{
+    int a { static_cast<int>(mSlots.size()) - 2 };
+    uint16_t b { Operand(a, line) };
+    uint16_t c { Operand(a + 1, line) };
+    Emit(opcode, a, b, c, line);
+    mSlots.resize(a);
+    mSlots.push_back({ Slot::Kind::kHome, 0 });
+}
+
+void Translator::Unary(Opcode opcode, int line)
+{
+    int a { static_cast<int>(mSlots.size()) - 1 };
+    Emit(opcode, a, Operand(a, line), 0, line);
+    mSlots[a] = { Slot::Kind::kHome, 0 };
+}
+
+uint16_t Translator::Operand(int slot, int line)
+{
+    const Slot& value { mSlots[slot] };
+    switch (value.mKind) {
+    case Slot::Kind::kRegister:
+        return value.mIndex;
+    case Slot::Kind::kConstant:
+        if (value.mIndex < kConstantFlag) {
+            return kConstantFlag | value.mIndex;
+        }
+        Materialize(slot, line);
+        return slot;
+    case Slot::Kind::kHome:
+        break;
+    }
+    return slot;
+}
+
+void Translator::PushConstant(int index)
+{
+    mSlots.push_back({ Slot::Kind::kConstant, index });
+}
+
+int Translator::ConstantFor(ir::Value value, std::optional<int>& index)
+{
+    if (!index) {
+        index = mFunction->mConstants.size();
+        mFunction->mConstants.emplace_back(value);
+    }
+    return *index;
+}
+
+void Translator::Materialize(int slot, int line)
+{
+    const Slot value { mSlots[slot] };
+    if (value.mKind == Slot::Kind::kHome) {
+        return;
+    }
+    if (value.mKind == Slot::Kind::kConstant && value.mIndex >= kConstantFlag) {
+        Emit(Opcode::kLoadConstant, slot, value.mIndex & 0xFFFF, value.mIndex >> 16, line);
+    } else {
+        Emit(Opcode::kMove, slot, Operand(slot, line), 0, line);
+    }
+    mSlots[slot] = { Slot::Kind::kHome, 0 };
+}
+
+void Translator::MaterializeFrom(int slot, int line)
+{
+    for (int i { slot }; i < static_cast<int>(mSlots.size()); i++) {
+        Materialize(i, line);
+    }
+}
+
+void Translator::MaterializeCopiesOf(int slot, int line)
+{
+    for (int i { 0 }; i < static_cast<int>(mSlots.size()); i++) {
+        if (mSlots[i].mKind == Slot::Kind::kRegister && mSlots[i].mIndex == slot) {
+            Materialize(i, line);
+        }
+    }
+}
+
+void Translator::Emit(Opcode opcode, int a, int b, int c, int line)
+{
+    mFunction->mLines.Add(mFunction->mCode.size(), line);
+    mFunction->mCode.push_back({ opcode, static_cast<uint16_t>(a), static_cast<uint16_t>(b), static_cast<uint16_t>(c) });
+}
+
+void Translator::EmitJump(Opcode opcode, int a, uint32_t target, int line)
+{
+    mJumps.emplace_back(mFunction->mCode.size());
+    Emit(opcode, a, target & 0xFFFF, target >> 16, line);
+}
+
+bool Translator::WritesA(Opcode opcode)
+{
+    switch (opcode) {
+    case Opcode::kAdd:
+    case Opcode::kDivide:
+    case Opcode::kEqual:
+    case Opcode::kGlobalGet:
+    case Opcode::kGreater:
+    case Opcode::kGreaterEqual:
+    case Opcode::kLess:
+    case Opcode::kLessEqual:
+    case Opcode::kLoadConstant:
+    case Opcode::kMove:
+    case Opcode::kMultiply:
+    case Opcode::kNegate:
+    case Opcode::kNot:
+    case Opcode::kNotEqual:
+    case Opcode::kSubtract:
+        return true;
+    default:
+        return false;
+    }
+}
+
+}
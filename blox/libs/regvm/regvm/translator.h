@@ -0,0 +1,75 @@
+#pragma once
+
+#include "code.h"
+
+#include <ir/ir.h>
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace regvm {
+
+// Turns a function's stack bytecode into register code. The verifier knows
+// the stack depth at every instruction, so every stack slot becomes the
+// register of the same number and each stack instruction one register
+// instruction on fixed operands, with the pushes and pops gone.
+//
+// Pushes of constants and locals emit nothing at first. The slot just
+// remembers which constant or register it copies, and the instruction that
+// consumes it reads that operand directly. `a + b` on two locals becomes a
+// single kAdd. Slots are only written out (kMove) where the value has to be
+// in its own register: before a jump or a jump target, for the arguments of
+// a call, and before the register they copy is assigned. An assignment right
+// after the instruction computing its value makes that instruction write the
+// local instead of a temporary.
+//
+// Functions in the constant pool are not translated, the VM does that when
+// it first calls them.
+class Translator final {
+public:
+    explicit Translator(int globalCount); // for the verifier, see ir::Verifier
+    std::unique_ptr<Function> Translate(ir::ObjectFunction* function); // nullptr, with Error() set, on failure
+    const std::string& Error() const;
+
+private:
+    // Where the value of a stack slot is
+    struct Slot {
+        enum class Kind {
+            kHome = 0, // in the register of its own number
+            kRegister, // a copy of mIndex, which is in its home register
+            kConstant // constant mIndex
+        };
+        Kind mKind;
+        int mIndex;
+    };
+
+    void Translate(ir::Opcode opcode, const uint8_t* operands, int line);
+    void Binary(Opcode opcode, int line);
+    void Unary(Opcode opcode, int line);
+
+    uint16_t Operand(int slot, int line); // RK
+    void PushConstant(int index);
+    int ConstantFor(ir::Value value, std::optional<int>& index); // nil, true and false, added once
+    void Materialize(int slot, int line);
+    void MaterializeFrom(int slot, int line); // every slot from slot on
+    void MaterializeCopiesOf(int slot, int line);
+
+    void Emit(Opcode opcode, int a, int b, int c, int line);
+    void EmitJump(Opcode opcode, int a, uint32_t target, int line); // target is a bytecode offset until patched
+    static bool WritesA(Opcode opcode); // A is the only register it writes
+
+    int mGlobalCount;
+    std::string mError;
+    std::unique_ptr<Function> mFunction;
+    std::vector<Slot> mSlots; // the stack, bottom first
+    int mBlockStart { 0 }; // first instruction that no jump skips over, for WritesA() rewrites
+    std::vector<int> mJumps; // instructions whose targets are still bytecode offsets
+    std::optional<int> mNil;
+    std::optional<int> mTrue;
+    std::optional<int> mFalse;
+};
+
+}
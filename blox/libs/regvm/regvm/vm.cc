@@ -0,0 +1,414 @@
+#include "vm.h"
+
+#include <algorithm>
+#include <cassert>
+#include <fmt/format.h>
+#include <iostream>
+#include <magic_enum/magic_enum.hpp>
+#include <ranges>
+#include <spdlog/spdlog.h>
+
+using namespace ir;
+
+namespace regvm {
+
+namespace {
+
+bool IsTrue(const Value& value)
+{
+    return !(value.GetType() == Value::Type::kNil || (value.GetType() == Value::Type::kBool && !value.AsBool()));
+}
+
+}
+
+Vm::Vm(ObjectFunction* main, Heap* heap, GlobalTable* globals, IErrorReporter* errorReporter,
+    const vm::Options& options)
+    : mMain { main }
+    , mHeap { heap }
+    , mGlobals { globals }
+    , mErrorReporter { errorReporter }
+    , mTranslator { globals->Size() }
+    , mRegisters { std::make_unique<Value[]>(options.mMaxStackDepth) }
+    , mRegistersEnd { mRegisters.get() + options.mMaxStackDepth }
+    , mFrames { std::make_unique<CallFrame[]>(options.mMaxCallDepth) }
+    , mFramesEnd { mFrames.get() + options.mMaxCallDepth }
+    , mProfileOps { options.mProfileOps }
+    , mCounts(kOpcodeCount, 0)
+{
+    mErrorReporter->SetPrefix("VM");
+    mHeap->AddRootProvider(this);
+}
+
+Vm::~Vm()
+{
+    mHeap->RemoveRootProvider(this);
+}
+
+void Vm::MarkRoots(Heap& heap)
+{
+    heap.MarkObject(mMain);
+    // Frames overlap (a callee's registers start at its caller's kCall), each
+    // covers what it may read
+    for (CallFrame* frame { mFrames.get() }; mFrame != nullptr && frame <= mFrame; frame++) {
+        for (int i { 0 }; i < frame->mFunction->mRegisterCount; i++) {
+            heap.MarkValue(frame->mBase[i]);
+        }
+    }
+    // Translations are looked up by their function, which must not be freed
+    // and its address reused while the translation is around
+    for (auto& [source, function] : mFunctions) {
+        heap.MarkObject(function->mSource);
+        for (Value& constant : function->mConstants) {
+            heap.MarkValue(constant);
+        }
+    }
+    // No remembered set as in vm::Vm, minor collections scan all globals too
+    for (Value& global : mGlobalValues) {
+        heap.MarkValue(global);
+    }
+}
+
+uint64_t Vm::InstructionCount() const
+{
+    uint64_t total { 0 };
+    for (uint64_t count : mCounts) {
+        total += count;
+    }
+    return total;
+}
+
+void Vm::Run()
+{
+    spdlog::info("running register vm..");
+
+    mGlobalValues.assign(mGlobals->Size(), Value::Undefined());
+    Function* main { Translated(mMain, nullptr) };
+    if (main == nullptr) {
+        return;
+    }
+
+    // Main's register 0 is itself, like any other function
+    mFrame = nullptr;
+    mRegisters[0] = Value(mMain);
+    if (!Enter(main, mRegisters.get())) {
+        mErrorReporter->Report(mMain->mChunk.GetLine(0), "Stack overflow");
+        return;
+    }
+
+    if (mProfileOps) {
+        Execute<true>();
+        std::cerr << Report();
+    } else {
+        Execute<false>();
+    }
+    mFrame = nullptr;
+}
+
+// Every handler reads its operands straight from the instruction, RK ones
+// through REGVM_RK. Arithmetic and comparisons on two numbers are done
+// inline, anything else goes through Arithmetic(). The instruction pointer
+// and the frame's registers and constants live in locals, reloaded at calls
+// and returns.
+#define REGVM_RK(operand) ((operand) & kConstantFlag ? constants[(operand) & ~kConstantFlag] : base[(operand)])
+
+#define REGVM_BINARY(opcode, check, operation)                                    \
+    REGVM_CASE(opcode):                                                           \
+    {                                                                             \
+        const Value& a { REGVM_RK(instruction->mB) };                             \
+        const Value& b { REGVM_RK(instruction->mC) };                             \
+        if (a.IsNumber() && b.IsNumber() && (check)) [[likely]] {                 \
+            base[instruction->mA] = Value(operation);                             \
+            REGVM_NEXT();                                                         \
+        }                                                                         \
+        if (!Arithmetic(Opcode::opcode, base[instruction->mA], a, b, ip)) {       \
+            return;                                                               \
+        }                                                                         \
+        REGVM_NEXT();                                                             \
+    }
+
+#define REGVM_COUNT()                                           \
+    if constexpr (kCountOps) {                                  \
+        mCounts[static_cast<int>(instruction->mOpcode)]++;      \
+    }
+
+#ifdef BLOX_REGVM_HAS_COMPUTED_GOTO
+#define REGVM_CASE(opcode) \
+    case Opcode::opcode:   \
+    op_##opcode
+#define REGVM_TARGET(opcode) jumpTable[static_cast<int>(Opcode::opcode)] = &&op_##opcode
+#define REGVM_NEXT()                                                \
+    instruction = ip++;                                             \
+    REGVM_COUNT();                                                  \
+    goto* jumpTable[static_cast<int>(instruction->mOpcode)]
+#else
+#define REGVM_CASE(opcode) case Opcode::opcode
+#define REGVM_NEXT() continue
+#endif
+
+template <bool kCountOps>
+void Vm::Execute()
+{
+#ifdef BLOX_REGVM_HAS_COMPUTED_GOTO
+    void* jumpTable[kOpcodeCount];
+    REGVM_TARGET(kAdd);
+    REGVM_TARGET(kCall);
+    REGVM_TARGET(kDivide);
+    REGVM_TARGET(kEqual);
+    REGVM_TARGET(kGlobalDefine);
+    REGVM_TARGET(kGlobalGet);
+    REGVM_TARGET(kGlobalSet);
+    REGVM_TARGET(kGreater);
+    REGVM_TARGET(kGreaterEqual);
+    REGVM_TARGET(kJump);
+    REGVM_TARGET(kJumpIfFalse);
+    REGVM_TARGET(kJumpIfTrue);
+    REGVM_TARGET(kLess);
+    REGVM_TARGET(kLessEqual);
+    REGVM_TARGET(kLoadConstant);
+    REGVM_TARGET(kMove);
+    REGVM_TARGET(kMultiply);
+    REGVM_TARGET(kNegate);
+    REGVM_TARGET(kNot);
+    REGVM_TARGET(kNotEqual);
+    REGVM_TARGET(kPrint);
+    REGVM_TARGET(kReturn);
+    REGVM_TARGET(kSubtract);
+    REGVM_TARGET(kEof);
+#endif
+
+    // Cached from mFrame, reloaded whenever it changes
+    Function* function { mFrame->mFunction };
+    const Instruction* code { function->mCode.data() };
+    const Instruction* ip { mFrame->mIp };
+    const Value* constants { function->mConstants.data() };
+    Value* base { mFrame->mBase };
+    const Instruction* instruction {};
+
+    for (;;) {
+        instruction = ip++;
+        REGVM_COUNT();
+#ifdef BLOX_REGVM_HAS_COMPUTED_GOTO
+        goto* jumpTable[static_cast<int>(instruction->mOpcode)];
+#endif
+        switch (instruction->mOpcode) {
+        REGVM_CASE(kMove):
+            base[instruction->mA] = REGVM_RK(instruction->mB);
+            REGVM_NEXT();
+        REGVM_CASE(kLoadConstant):
+            base[instruction->mA] = constants[instruction->Target()];
+            REGVM_NEXT();
+        REGVM_CASE(kGlobalGet): {
+            const Value& value { mGlobalValues[instruction->mB] };
+            if (value.GetType() == Value::Type::kUndefined) [[unlikely]] {
+                RuntimeError(ip, fmt::format("Unknown global {}", mGlobals->GetName(instruction->mB)));
+                return;
+            }
+            base[instruction->mA] = value;
+            REGVM_NEXT();
+        }
+        REGVM_CASE(kGlobalSet):
+        REGVM_CASE(kGlobalDefine):
+            mGlobalValues[instruction->mA] = REGVM_RK(instruction->mB);
+            REGVM_NEXT();
+        REGVM_BINARY(kAdd, true, a.AsNumber() + b.AsNumber())
+        REGVM_BINARY(kSubtract, true, a.AsNumber() - b.AsNumber())
+        REGVM_BINARY(kMultiply, true, a.AsNumber() * b.AsNumber())
+        REGVM_BINARY(kDivide, b.AsNumber() != 0.0, a.AsNumber() / b.AsNumber())
+        REGVM_BINARY(kGreater, true, a.AsNumber() > b.AsNumber())
+        REGVM_BINARY(kLess, true, a.AsNumber() < b.AsNumber())
+        // Negated so that NaN compares like the stack VM's fused opcodes
+        REGVM_BINARY(kGreaterEqual, true, !(a.AsNumber() < b.AsNumber()))
+        REGVM_BINARY(kLessEqual, true, !(a.AsNumber() > b.AsNumber()))
+        REGVM_CASE(kEqual):
+            base[instruction->mA] = Value(REGVM_RK(instruction->mB) == REGVM_RK(instruction->mC));
+            REGVM_NEXT();
+        REGVM_CASE(kNotEqual):
+            base[instruction->mA] = Value(!(REGVM_RK(instruction->mB) == REGVM_RK(instruction->mC)));
+            REGVM_NEXT();
+        REGVM_CASE(kNegate): {
+            const Value& value { REGVM_RK(instruction->mB) };
+            if (!CheckType(Value::Type::kNumber, value, ip)) {
+                return;
+            }
+            base[instruction->mA] = Value(-value.AsNumber());
+            REGVM_NEXT();
+        }
+        REGVM_CASE(kNot):
+            base[instruction->mA] = Value(!IsTrue(REGVM_RK(instruction->mB)));
+            REGVM_NEXT();
+        REGVM_CASE(kPrint):
+            std::cout << REGVM_RK(instruction->mA) << "\n";
+            REGVM_NEXT();
+        REGVM_CASE(kJump):
+            ip = code + instruction->Target();
+            REGVM_NEXT();
+        REGVM_CASE(kJumpIfFalse):
+            if (!IsTrue(REGVM_RK(instruction->mA))) {
+                ip = code + instruction->Target();
+            }
+            REGVM_NEXT();
+        REGVM_CASE(kJumpIfTrue):
+            if (IsTrue(REGVM_RK(instruction->mA))) {
+                ip = code + instruction->Target();
+            }
+            REGVM_NEXT();
+        REGVM_CASE(kCall): {
+            // The callee and its arguments become registers 0..argumentCount
+            // of the new frame where they are, nothing is copied
+            Value* calleeBase { base + instruction->mA };
+            Value callee { calleeBase[0] };
+            if (callee.GetType() != Value::Type::kFunction) [[unlikely]] {
+                RuntimeError(ip, "Can only call functions");
+                return;
+            }
+            auto* object { static_cast<ObjectFunction*>(callee.AsObject()) };
+            if (object->mArity != instruction->mB) [[unlikely]] {
+                RuntimeError(ip, fmt::format("Expected {} arguments but got {}", object->mArity, instruction->mB));
+                return;
+            }
+
+            CallCache& cache { function->mCallCaches[instruction->mC] };
+            if (cache.mCallee != object) [[unlikely]] {
+                Function* target { Translated(object, ip) };
+                if (target == nullptr) {
+                    return;
+                }
+                cache = { object, target };
+            }
+            if (mFrame + 1 == mFramesEnd) [[unlikely]] {
+                RuntimeError(ip, "Call stack overflow");
+                return;
+            }
+            mFrame->mIp = ip;
+            if (!Enter(cache.mTarget, calleeBase)) [[unlikely]] {
+                RuntimeError(ip, "Stack overflow");
+                return;
+            }
+
+            function = mFrame->mFunction;
+            code = function->mCode.data();
+            ip = code;
+            constants = function->mConstants.data();
+            base = calleeBase;
+            REGVM_NEXT();
+        }
+        REGVM_CASE(kReturn): {
+            // Register 0 is the caller's kCall register. Main never returns,
+            // the verifier rejects that.
+            base[0] = REGVM_RK(instruction->mA);
+            mFrame--;
+            function = mFrame->mFunction;
+            code = function->mCode.data();
+            ip = mFrame->mIp;
+            constants = function->mConstants.data();
+            base = mFrame->mBase;
+            REGVM_NEXT();
+        }
+        REGVM_CASE(kEof):
+            mFrame->mIp = ip;
+            return;
+        }
+    }
+}
+
+#undef REGVM_RK
+#undef REGVM_BINARY
+#undef REGVM_COUNT
+#undef REGVM_CASE
+#undef REGVM_TARGET
+#undef REGVM_NEXT
+
+Function* Vm::Translated(ObjectFunction* function, const Instruction* ip)
+{
+    auto found { mFunctions.find(function) };
+    if (found != mFunctions.end()) {
+        return found->second.get();
+    }
+
+    std::unique_ptr<Function> translated { mTranslator.Translate(function) };
+    if (!translated) {
+        std::string message { "Internal error - cannot translate " + mTranslator.Error() };
+        if (ip == nullptr) {
+            mErrorReporter->Report(function->mChunk.GetLine(0), message);
+        } else {
+            RuntimeError(ip, message);
+        }
+        return nullptr;
+    }
+    spdlog::debug("translated {}:\n{}", function->mName, translated->Disassemble());
+    return mFunctions.emplace(function, std::move(translated)).first->second.get();
+}
+
+bool Vm::Enter(Function* function, Value* base)
+{
+    if (mRegistersEnd - base < function->mRegisterCount) {
+        return false;
+    }
+    // Registers past the arguments may hold what an earlier, deeper frame
+    // left there, objects the GC has not kept alive since
+    std::fill(base + 1 + function->mSource->mArity, base + function->mRegisterCount, Value());
+
+    CallFrame* frame { mFrame == nullptr ? mFrames.get() : mFrame + 1 };
+    *frame = { function, function->mCode.data(), base };
+    mFrame = frame;
+    return true;
+}
+
+bool Vm::Arithmetic(Opcode opcode, Value& result, Value a, Value b, const Instruction* ip)
+{
+    if (opcode == Opcode::kAdd && a.GetType() == Value::Type::kString) {
+        if (!CheckType(Value::Type::kString, b, ip)) {
+            return false;
+        }
+        // Both are in registers or constants, rooted while the result is allocated
+        result = Value(mHeap->Concatenate(static_cast<ObjectString*>(a.AsObject()),
+            static_cast<ObjectString*>(b.AsObject())));
+        return true;
+    }
+    if (!CheckType(Value::Type::kNumber, a, ip) || !CheckType(Value::Type::kNumber, b, ip)) {
+        return false;
+    }
+    // Numbers only get here dividing by zero
+    assert(opcode == Opcode::kDivide);
+    RuntimeError(ip, "divide by zero");
+    return false;
+}
+
+bool Vm::CheckType(Value::Type type, Value value, const Instruction* ip)
+{
+    if (value.GetType() != type) {
+        RuntimeError(ip, fmt::format("Expected type {}, got {}", magic_enum::enum_name(type),
+            magic_enum::enum_name(value.GetType())));
+        return false;
+    }
+    return true;
+}
+
+void Vm::RuntimeError(const Instruction* ip, const std::string& message)
+{
+    // ip is past the instruction that failed
+    const Function* function { mFrame->mFunction };
+    mErrorReporter->Report(function->mLines.GetLine(ip - function->mCode.data() - 1), message);
+}
+
+std::string Vm::Report() const
+{
+    uint64_t total { InstructionCount() };
+    std::string report { fmt::format("== register vm profile: {} instructions ==\n", total) };
+
+    std::vector<int> opcodes;
+    for (int i { 0 }; i < kOpcodeCount; i++) {
+        if (mCounts[i] != 0) {
+            opcodes.emplace_back(i);
+        }
+    }
+    std::ranges::sort(opcodes, [&](int a, int b) { return mCounts[a] > mCounts[b]; });
+    report += fmt::format("{:<22}{:>14}{:>8}\n", "opcode", "count", "%");
+    for (int opcode : opcodes) {
+        report += fmt::format("{:<22}{:>14}{:>7.2f}%\n", magic_enum::enum_name(static_cast<Opcode>(opcode)),
+            mCounts[opcode], 100.0 * mCounts[opcode] / total);
+    }
+    return report;
+}
+
+}
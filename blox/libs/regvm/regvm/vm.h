@@ -0,0 +1,82 @@
+#pragma once
+
+#include "code.h"
+#include "translator.h"
+
+#include <ir/ierror_reporter.h>
+#include <ir/ir.h>
+#include <vm/options.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Labels-as-values is a GCC/Clang extension, everything else gets the switch loop
+#if defined(BLOX_THREADED_DISPATCH) && (defined(__GNUC__) || defined(__clang__))
+#define BLOX_REGVM_HAS_COMPUTED_GOTO
+#endif
+
+namespace regvm {
+
+// Runs the same programs as vm::Vm, translated to register code (see
+// Translator) one function at a time as they are first called. Values,
+// objects, the heap and the globals are shared with the stack VM, only the
+// code differs.
+//
+// Of vm::Options it honours the stack limits and mProfileOps, which counts
+// executed instructions by opcode. Tracing and sampling are stack VM only.
+class Vm final : public ir::IRootProvider {
+public:
+    Vm(ir::ObjectFunction* main, ir::Heap* heap, ir::GlobalTable* globals,
+        ir::IErrorReporter* errorReporter, const vm::Options& options = {});
+    ~Vm();
+    void Run();
+
+    void MarkRoots(ir::Heap& heap) override;
+
+    uint64_t InstructionCount() const; // executed so far, only counted with Options::mProfileOps
+
+private:
+    template <bool kCountOps>
+    void Execute();
+
+    struct CallFrame {
+        Function* mFunction;
+        const Instruction* mIp; // only kept up to date across calls
+        ir::Value* mBase;
+    };
+
+    Function* Translated(ir::ObjectFunction* function, const Instruction* ip); // nullptr after reporting an error
+    // Pushes a frame at base, false if its registers do not fit
+    bool Enter(Function* function, ir::Value* base);
+
+    // What the inline number paths do not handle: strings, type errors and
+    // division by zero. False after reporting a runtime error.
+    bool Arithmetic(Opcode opcode, ir::Value& result, ir::Value a, ir::Value b, const Instruction* ip);
+    bool CheckType(ir::Value::Type type, ir::Value value, const Instruction* ip);
+
+    void RuntimeError(const Instruction* ip, const std::string& message);
+    std::string Report() const;
+
+    ir::ObjectFunction* mMain;
+    ir::Heap* mHeap;
+    ir::GlobalTable* mGlobals;
+    ir::IErrorReporter* mErrorReporter;
+    Translator mTranslator;
+    std::unordered_map<const ir::ObjectFunction*, std::unique_ptr<Function>> mFunctions;
+
+    // Fixed size so that pointers into either stack stay valid
+    std::unique_ptr<ir::Value[]> mRegisters;
+    ir::Value* mRegistersEnd;
+    std::unique_ptr<CallFrame[]> mFrames;
+    CallFrame* mFramesEnd;
+    CallFrame* mFrame { nullptr };
+    std::vector<ir::Value> mGlobalValues; // indexed by GlobalTable slot
+
+    bool mProfileOps;
+    std::vector<uint64_t> mCounts; // by Opcode
+};
+
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <string>
+
+namespace vm {
+
+struct Options {
+    // Both stacks are allocated up front and never grow, running past either
+    // limit is a runtime error
+    int mMaxStackDepth { 1 << 16 }; // values
+    int mMaxCallDepth { 1 << 10 }; // frames
+
+    // Each of the following runs its own instrumented engine, they are
+    // exclusive and the first one set wins. Off, the plain engine is used.
+    //
+    // Runs the instrumented engine (see OpcodeProfiler) and prints its report
+    // to stderr once the program is done
+    bool mProfileOps { false };
+
+    // Prints every instruction with the stack it sees to stderr
+    bool mTrace { false };
+
+    // Samples the call stack every mSampleIntervalUs of CPU time and writes
+    // the folded stacks there when the program is done, off when empty.
+    std::string mSampleProfilePath;
+    int mSampleIntervalUs { 1000 };
+};
+
+}
@@ -0,0 +1,108 @@
+#include "profiler.h"
+
+#include <algorithm>
+#include <fmt/format.h>
+#include <ranges>
+
+namespace vm {
+
+namespace {
+
+#if defined(__x86_64__) || defined(__i386__)
+constexpr const char* kTimeUnit { "cycles" };
+#else
+constexpr const char* kTimeUnit { "ns" };
+#endif
+
+std::string_view Name(int opcode)
+{
+    return magic_enum::enum_name(static_cast<ir::Opcode>(opcode));
+}
+
+double Percent(uint64_t part, uint64_t total)
+{
+    return total == 0 ? 0.0 : 100.0 * part / total;
+}
+
+}
+
+OpcodeProfiler::OpcodeProfiler()
+    : mCounts(kOpcodeCount, 0)
+    , mCycles(kOpcodeCount, 0)
+    , mPairs(kOpcodeCount * kOpcodeCount, 0)
+{
+}
+
+void OpcodeProfiler::Stop()
+{
+    if (mPrevious != -1) {
+        mCycles[mPrevious] += Now() - mStart;
+        mPrevious = -1;
+    }
+}
+
+uint64_t OpcodeProfiler::Count(ir::Opcode opcode) const
+{
+    return mCounts[static_cast<int>(opcode)];
+}
+
+uint64_t OpcodeProfiler::PairCount(ir::Opcode first, ir::Opcode second) const
+{
+    return mPairs[static_cast<int>(first) * kOpcodeCount + static_cast<int>(second)];
+}
+
+std::string OpcodeProfiler::Report(int top) const
+{
+    uint64_t totalCount { 0 };
+    uint64_t totalCycles { 0 };
+    for (int i { 0 }; i < kOpcodeCount; i++) {
+        totalCount += mCounts[i];
+        totalCycles += mCycles[i];
+    }
+
+    std::string report { fmt::format("== opcode profile: {} instructions, {} {} ==\n",
+        totalCount, totalCycles, kTimeUnit) };
+
+    std::vector<int> opcodes;
+    for (int i { 0 }; i < kOpcodeCount; i++) {
+        if (mCounts[i] != 0) {
+            opcodes.emplace_back(i);
+        }
+    }
+    std::ranges::sort(opcodes, [&](int a, int b) { return mCounts[a] > mCounts[b]; });
+    report += fmt::format("{:<22}{:>14}{:>8}{:>16}{:>8}{:>10}\n", "opcode", "count", "%", kTimeUnit, "%",
+        fmt::format("{}/op", kTimeUnit));
+    for (int opcode : opcodes | std::views::take(top)) {
+        report += fmt::format("{:<22}{:>14}{:>7.2f}%{:>16}{:>7.2f}%{:>10.1f}\n", Name(opcode), mCounts[opcode],
+            Percent(mCounts[opcode], totalCount), mCycles[opcode], Percent(mCycles[opcode], totalCycles),
+            static_cast<double>(mCycles[opcode]) / mCounts[opcode]);
+    }
+
+    std::vector<int> pairs;
+    for (int i { 0 }; i < kOpcodeCount * kOpcodeCount; i++) {
+        if (mPairs[i] != 0) {
+            pairs.emplace_back(i);
+        }
+    }
+    std::ranges::sort(pairs, [&](int a, int b) { return mPairs[a] > mPairs[b]; });
+    report += fmt::format("\n{:<44}{:>14}{:>8}\n", "opcode pair", "count", "%");
+    for (int pair : pairs | std::views::take(top)) {
+        report += fmt::format("{:<44}{:>14}{:>7.2f}%\n",
+            fmt::format("{} {}", Name(pair / kOpcodeCount), Name(pair % kOpcodeCount)), mPairs[pair],
+            Percent(mPairs[pair], totalCount));
+    }
+
+    std::vector<const Site*> sites;
+    for (const auto& [address, site] : mSites) {
+        sites.emplace_back(&site);
+    }
+    std::ranges::sort(sites, [](const Site* a, const Site* b) { return a->mCount > b->mCount; });
+    report += fmt::format("\n{:<22}{:>8}  {:<22}{:>14}{:>8}\n", "function", "offset", "opcode", "count", "%");
+    for (const Site* site : sites | std::views::take(top)) {
+        report += fmt::format("{:<22}{:>8}  {:<22}{:>14}{:>7.2f}%\n", site->mFunction->mName, site->mOffset,
+            magic_enum::enum_name(site->mOpcode), site->mCount, Percent(site->mCount, totalCount));
+    }
+    return report;
+}
+
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <ir/ir.h>
+#include <magic_enum/magic_enum.hpp>
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <chrono>
+#endif
+
+namespace vm {
+
+// Counts what the VM executes when it runs with Options::mProfileOps: every
+// opcode, every pair of consecutive opcodes and every instruction (by its
+// function and offset). The time between two instructions is charged to the
+// first one, in TSC cycles where there is a TSC and nanoseconds elsewhere,
+// so handlers that call into the heap or print are charged for that too.
+//
+// Quickened and fused opcodes are counted as such, so the pair counts show
+// what is left to fuse after the peephole pass and quickening.
+class OpcodeProfiler final {
+public:
+    static constexpr int kOpcodeCount { static_cast<int>(magic_enum::enum_count<ir::Opcode>()) };
+
+    OpcodeProfiler();
+
+    void Enter(ir::Opcode opcode, const ir::ObjectFunction* function, const uint8_t* instruction, int offset)
+    {
+        uint64_t now { Now() };
+        int index { static_cast<int>(opcode) };
+        if (mPrevious != -1) {
+            mCycles[mPrevious] += now - mStart;
+            mPairs[mPrevious * kOpcodeCount + index]++;
+        }
+        mCounts[index]++;
+
+        auto [site, inserted] { mSites.try_emplace(instruction, Site { function, offset, opcode, 0 }) };
+        // A quickened instruction changes opcode at the same address
+        site->second.mOpcode = opcode;
+        site->second.mCount++;
+
+        mPrevious = index;
+        mStart = Now(); // leaves the bookkeeping above out of the measurement
+    }
+    void Stop(); // charges the last instruction, call once execution is over
+
+    uint64_t Count(ir::Opcode opcode) const;
+    uint64_t PairCount(ir::Opcode first, ir::Opcode second) const;
+    // Sorted by count, at most top rows in each table
+    std::string Report(int top = 20) const;
+
+private:
+    struct Site {
+        const ir::ObjectFunction* mFunction;
+        int mOffset;
+        ir::Opcode mOpcode; // last seen
+        uint64_t mCount;
+    };
+
+    static uint64_t Now()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+    }
+
+    std::vector<uint64_t> mCounts;
+    std::vector<uint64_t> mCycles;
+    std::vector<uint64_t> mPairs; // first * kOpcodeCount + second
+    std::unordered_map<const uint8_t*, Site> mSites;
+    int mPrevious { -1 };
+    uint64_t mStart { 0 };
+};
+
+}
@@ -0,0 +1,139 @@
+#include "sampler.h"
+
+#include <algorithm>
+#include <fmt/format.h>
+#include <map>
+#include <spdlog/spdlog.h>
+#include <sys/time.h>
+#include <vector>
+
+namespace vm {
+
+std::atomic<Sampler*> Sampler::sActive { nullptr };
+
+Sampler::Sampler(Collect collect, void* context, int intervalUs)
+    : mCollect { collect }
+    , mContext { context }
+    , mIntervalUs { intervalUs }
+    , mSamples { std::make_unique<Sample[]>(kCapacity) }
+{
+}
+
+Sampler::~Sampler()
+{
+    Stop();
+}
+
+bool Sampler::Start()
+{
+    Sampler* expected { nullptr };
+    if (!sActive.compare_exchange_strong(expected, this)) {
+        spdlog::error("another sampler is already running");
+        return false;
+    }
+
+    struct sigaction action {};
+    action.sa_handler = &Sampler::OnSignal;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGPROF, &action, &mPreviousAction) == -1) {
+        sActive = nullptr;
+        return false;
+    }
+
+    itimerval timer {};
+    timer.it_interval.tv_sec = mIntervalUs / 1000000;
+    timer.it_interval.tv_usec = mIntervalUs % 1000000;
+    timer.it_value = timer.it_interval;
+    if (setitimer(ITIMER_PROF, &timer, nullptr) == -1) {
+        sigaction(SIGPROF, &mPreviousAction, nullptr);
+        sActive = nullptr;
+        return false;
+    }
+
+    mRunning = true;
+    return true;
+}
+
+void Sampler::Stop()
+{
+    if (!mRunning) {
+        return;
+    }
+    // Disarm first, a signal already in flight still finds the handler
+    itimerval timer {};
+    setitimer(ITIMER_PROF, &timer, nullptr);
+    sigaction(SIGPROF, &mPreviousAction, nullptr);
+    sActive = nullptr;
+    mRunning = false;
+}
+
+void Sampler::OnSignal(int)
+{
+    if (Sampler* sampler { sActive.load(std::memory_order_acquire) }) {
+        sampler->Record();
+    }
+}
+
+void Sampler::Record()
+{
+    // Single producer: the handler cannot interrupt itself, SIGPROF is
+    // blocked while it runs
+    int head { mHead.load(std::memory_order_relaxed) };
+    if (head == kCapacity) {
+        mDropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    Sample& sample { mSamples[head] };
+    Frame frames[kMaxDepth + 1];
+    int depth { mCollect(mContext, frames, kMaxDepth + 1) };
+    sample.mTruncated = depth > kMaxDepth;
+    sample.mDepth = std::min(depth, kMaxDepth);
+    std::copy(frames, frames + sample.mDepth, sample.mFrames);
+
+    mHead.store(head + 1, std::memory_order_release);
+}
+
+std::string Sampler::Folded() const
+{
+    // Sorted so the output is stable, flamegraph tools do not care
+    std::map<std::string, int> stacks;
+    int count { mHead.load(std::memory_order_acquire) };
+    for (int i { 0 }; i < count; i++) {
+        const Sample& sample { mSamples[i] };
+        if (sample.mDepth == 0) {
+            continue;
+        }
+
+        std::string stack { sample.mTruncated ? "[truncated];" : "" };
+        for (int frame { sample.mDepth - 1 }; frame >= 0; frame--) {
+            const Frame& f { sample.mFrames[frame] };
+            const ir::Chunk& chunk { f.mFunction->mChunk };
+            int offset { static_cast<int>(f.mIp - chunk.Code().data()) };
+            stack += fmt::format("{}:{}", f.mFunction->mName, chunk.GetLine(offset));
+            if (frame != 0) {
+                stack += ';';
+            }
+        }
+        stacks[stack]++;
+    }
+
+    std::string folded;
+    for (const auto& [stack, samples] : stacks) {
+        folded += fmt::format("{} {}\n", stack, samples);
+    }
+    return folded;
+}
+
+int Sampler::SampleCount() const
+{
+    return mHead.load(std::memory_order_acquire);
+}
+
+int Sampler::DroppedCount() const
+{
+    return mDropped.load(std::memory_order_relaxed);
+}
+
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <ir/ir.h>
+
+#include <atomic>
+#include <csignal>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace vm {
+
+// Statistical profiler driven by SIGPROF. Every interval of CPU time the
+// signal handler asks the VM for its call stack (through a collect function,
+// it must be async-signal-safe) and appends it to a preallocated buffer;
+// nothing is allocated or locked in the handler. Once the buffer is full
+// the run keeps going, and later samples are only counted as dropped.
+// Stop() disarms the timer, after which the samples are turned into folded
+// stacks ("main:3;fib:2;fib:2 17") that flamegraph.pl and speedscope read.
+//
+// Only one sampler can run at a time, the signal is process wide.
+class Sampler final {
+public:
+    struct Frame {
+        const ir::ObjectFunction* mFunction;
+        const uint8_t* mIp; // anywhere inside the instruction being run
+    };
+    static constexpr int kMaxDepth { 48 }; // innermost frames kept, the rest are cut off
+    static constexpr int kCapacity { 1 << 14 }; // samples kept, the first ones of the run
+    // Fills frames innermost first, -> how many
+    using Collect = int (*)(void* context, Frame* frames, int capacity);
+
+    Sampler(Collect collect, void* context, int intervalUs = 1000);
+    ~Sampler();
+    Sampler(const Sampler&) = delete;
+    Sampler& operator=(const Sampler&) = delete;
+
+    bool Start(); // false if the timer or the handler could not be set up
+    void Stop();
+
+    // Symbolized through the chunks' line tables, so the functions sampled
+    // must still be alive
+    std::string Folded() const;
+    int SampleCount() const;
+    int DroppedCount() const;
+
+private:
+    struct Sample {
+        int mDepth;
+        bool mTruncated;
+        Frame mFrames[kMaxDepth];
+    };
+
+    static void OnSignal(int signal);
+    void Record();
+
+    Collect mCollect;
+    void* mContext;
+    int mIntervalUs;
+    bool mRunning { false };
+    struct sigaction mPreviousAction {};
+
+    std::unique_ptr<Sample[]> mSamples;
+    // Written by the handler only; read once the timer is stopped
+    std::atomic<int> mHead { 0 };
+    std::atomic<int> mDropped { 0 };
+
+    static std::atomic<Sampler*> sActive;
+};
+
+}
@@ -1,10 +1,15 @@
 #include "vm.h"
 #include "ir/value.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <fmt/format.h>
 #include <fmt/ostream.h>
+#include <fstream>
 #include <iostream>
+#include <iterator>
+#include <memory>
 #include <ir/ierror_reporter.h>
 #include <ir/ir.h>
 #include <magic_enum/magic_enum.hpp>
@@ -14,231 +19,610 @@ using namespace ir;
 
 namespace vm {
 
-Vm::Vm(ObjectFunction* main, IErrorReporter* errorReporter)
+Vm::Vm(ObjectFunction* main, Heap* heap, GlobalTable* globals, IErrorReporter* errorReporter,
+    const Options& options)
     : mMain { main }
+    , mHeap { heap }
+    , mGlobals { globals }
     , mErrorReporter { errorReporter }
+    , mStack { std::make_unique<Value[]>(options.mMaxStackDepth) }
+    , mStackTop { mStack.get() }
+    , mStackEnd { mStack.get() + options.mMaxStackDepth }
+    , mFrames { std::make_unique<CallFrame[]>(options.mMaxCallDepth) }
+    , mFramesEnd { mFrames.get() + options.mMaxCallDepth }
+    , mTrace { options.mTrace }
+    , mProfiler { options.mProfileOps ? std::make_unique<OpcodeProfiler>() : nullptr }
+    , mSampleProfilePath { options.mSampleProfilePath }
+    , mSampleIntervalUs { options.mSampleIntervalUs }
 {
     mErrorReporter->SetPrefix("VM");
+    mHeap->AddRootProvider(this);
 }
 
-void Vm::Run()
+Vm::~Vm()
 {
-    spdlog::info("running vm..");
+    mHeap->RemoveRootProvider(this);
+}
 
-    mCallStack.emplace_back(mMain, 0, 0);
-    mChunk = &mMain->mChunk;
-    mFrame = &mCallStack[0];
-
-    while (mFrame != nullptr) {
-        /*
-        if (!HasMoreBytes()) {
-            // TODO: implement proper logic here
-            // Clean up function stuff from value stack?
-            break;
-        }*/
-
-        Byte byte = NextByte();
-        Opcode opcode = static_cast<Opcode>(byte.mByte);
-        spdlog::debug("Interpreting opcode {}", magic_enum::enum_name(opcode));
-        switch (opcode) {
-        case Opcode::kGlobalDefine:
-        case Opcode::kGlobalGet:
-        case Opcode::kGlobalSet:
-            Global(byte);
-            break;
-        case Opcode::kLocalGet:
-        case Opcode::kLocalSet:
-            Local(byte);
-            break;
-        case Opcode::kJump:
-        case Opcode::kJumpIfFalse:
-        case Opcode::kJumpIfTrue:
-            Jump(byte);
-            break;
-        case Opcode::kConstant:
-            Constant(byte);
-            break;
-        case Opcode::kNil:
-            Push(Value());
-            break;
-        case Opcode::kTrue:
-            Push(Value(true));
-            break;
-        case Opcode::kFalse:
-            Push(Value(false));
-            break;
-        case Opcode::kNegate:
-            Negate(byte);
-            break;
-        case Opcode::kNot:
-            Push(!IsTrue(Pop()));
-            break;
-        case Opcode::kAdd:
-        case Opcode::kSubtract:
-        case Opcode::kMultiply:
-        case Opcode::kDivide:
-        case Opcode::kEqual:
-        case Opcode::kLess:
-        case Opcode::kGreater:
-            Binary(byte);
-            break;
-        case Opcode::kPrint:
-            Print(byte);
-            break;
-        case Opcode::kPop:
-            Pop();
-            break;
-        case Opcode::kPopn:
-            Popn(byte);
-            break;
-        case Opcode::kEof:
-            return;
-        default:
-            spdlog::error("Internal error - unknown opcode {}",
-                magic_enum::enum_name(opcode));
+void Vm::MarkRoots(Heap& heap)
+{
+    heap.MarkObject(mMain);
+    for (Value* slot { mStack.get() }; slot < mStackTop; slot++) {
+        heap.MarkValue(*slot);
+    }
+    for (CallFrame* frame { mFrames.get() }; mFrame != nullptr && frame <= mFrame; frame++) {
+        heap.MarkObject(frame->mFunction);
+    }
+
+    // Globals are not scanned by minor collections, only the slots that the
+    // write barrier saw receiving a young object
+    if (heap.IsMinorCollection()) {
+        for (uint16_t slot : mYoungGlobals) {
+            heap.MarkValue(mGlobalValues[slot]);
+            mYoungGlobalFlags[slot] = false;
         }
+        mYoungGlobals.clear();
+        return;
+    }
+    for (Value& global : mGlobalValues) {
+        heap.MarkValue(global);
     }
 }
 
-void Vm::Global(Byte byte)
+const OpcodeProfiler* Vm::GetProfiler() const
 {
-    Opcode opcode { static_cast<Opcode>(byte.mByte) };
-    uint8_t index { NextByte().mByte };
-    ObjectString* name { static_cast<ObjectString*>(mChunk->GetConstant(index).mAs.object) };
+    return mProfiler.get();
+}
 
-    switch (opcode) {
-    case Opcode::kGlobalDefine:
-        mGlobals[name->mString] = Pop();
-        break;
-    case Opcode::kGlobalSet:
-        mGlobals[name->mString] = mValueStack.back();
-        break;
-    case Opcode::kGlobalGet:
-        if (mGlobals.find(name->mString) == mGlobals.end()) {
-            mErrorReporter->Report(byte.mLine, fmt::format("Unknown global {}", name->mString));
-        } else {
-            Push(mGlobals[name->mString]);
-        }
-        break;
-    default:
-        assert(10 > 11);
-    }
+void Vm::Run()
+{
+    Run(kDefaultDispatch);
 }
 
-void Vm::Local(Byte byte)
+void Vm::Run(Dispatch dispatch)
 {
-    Opcode opcode { static_cast<Opcode>(byte.mByte) };
-    uint8_t index { NextByte().mByte };
+    spdlog::info("running vm..");
 
-    switch (opcode) {
-    case Opcode::kLocalGet:
-        Push(mValueStack[index]);
+    // Only verified functions know how deep they go, see ir::Verifier
+    assert(mMain->mMaxStackDepth >= 0);
+    if (mMain->mMaxStackDepth > mStackEnd - mStack.get()) {
+        mErrorReporter->Report(mMain->mChunk.GetLine(0), "Stack overflow");
+        return;
+    }
+
+    // Main's slot 0 is itself, like any other function
+    mStackTop = mStack.get();
+    Push(Value(mMain));
+    mFrame = mFrames.get();
+    *mFrame = { mMain, mMain->mChunk.Code().data(), mStack.get() };
+    mChunk = &mMain->mChunk;
+
+    mGlobalValues.assign(mGlobals->Size(), Value::Undefined());
+    mYoungGlobalFlags.assign(mGlobals->Size(), false);
+    mYoungGlobals.clear();
+
+    switch (dispatch) {
+    case Dispatch::kThreaded:
+#ifdef BLOX_HAS_COMPUTED_GOTO
+        Execute<Dispatch::kThreaded>();
         break;
-    case Opcode::kLocalSet:
-        mValueStack[index] = mValueStack.back();
+#else
+        spdlog::warn("threaded dispatch was not compiled in, using switch dispatch");
+        [[fallthrough]];
+#endif
+    case Dispatch::kSwitch:
+        Execute<Dispatch::kSwitch>();
         break;
-    default:
-        assert(11 > 12);
+    }
+
+    if (mProfiler) {
+        mProfiler->Stop();
+        std::cerr << mProfiler->Report();
     }
 }
 
-void Vm::Jump(Byte byte)
+template <Vm::Dispatch kDispatch>
+void Vm::Execute()
 {
-    Opcode opcode { static_cast<Opcode>(byte.mByte) };
+    if (mProfiler) {
+        Execute<kDispatch, Instrumentation::kProfileOps>();
+        return;
+    }
+    if (mTrace) {
+        Execute<kDispatch, Instrumentation::kTrace>();
+        return;
+    }
+    if (mSampleProfilePath.empty()) {
+        Execute<kDispatch, Instrumentation::kNone>();
+        return;
+    }
 
-    // Little-endian
-    uint16_t target { NextByte().mByte };
-    target += NextByte().mByte << 8;
+    Sampler sampler(&Vm::CollectFrames, this, mSampleIntervalUs);
+    if (!sampler.Start()) {
+        spdlog::error("cannot start the sampling profiler, running without it");
+        Execute<kDispatch, Instrumentation::kNone>();
+        return;
+    }
+    Execute<kDispatch, Instrumentation::kSample>();
+    sampler.Stop();
+    WriteSampleProfile(sampler);
+}
 
-    switch (opcode) {
-    case ir::Opcode::kJump:
-        mFrame->mIp = target;
-        break;
-    case ir::Opcode::kJumpIfFalse:
-        if (!IsTrue(mValueStack.back())) {
-            mFrame->mIp = target;
+// Both engines share the handler bodies below. In the threaded engine every
+// handler ends with its own indirect jump through jumpTable (one branch
+// predictor entry per opcode), the switch engine just goes around the loop.
+//
+// Every handler pushes and pops unchecked. The verifier knows how deep each
+// function's frame gets, so room for all of it is checked once on entry.
+//
+// Generic arithmetic and comparisons that see two numbers rewrite their own
+// opcode byte (ip[-1]) into the quickened form. That one only guards the
+// operand types before doing the arithmetic inline, and rewrites itself back
+// to the generic opcode if the guard ever fails.
+//
+// The instruction pointer lives in a local for the whole loop and is only
+// written back to mFrame at calls and returns. Handlers that can fail get ip
+// so that the line is looked up only once an error is actually reported.
+#define VM_READ_BYTE() (*ip++)
+#define VM_READ_SHORT() (ip += 2, static_cast<uint16_t>(ip[-2] | (ip[-1] << 8))) // Little-endian
+#define VM_READ_UINT24() (ip += 3, static_cast<uint32_t>(ip[-3] | (ip[-2] << 8) | (ip[-1] << 16)))
+#define VM_READ_UINT32() (ip += 4, static_cast<uint32_t>(ip[-4] | (ip[-3] << 8) | (ip[-2] << 16)) | (static_cast<uint32_t>(ip[-1]) << 24))
+
+#define VM_BINARY_NUMBER(opcode, operation)                                   \
+    VM_CASE(opcode##Number):                                                  \
+    {                                                                         \
+        Value& a { mStackTop[-2] };                                           \
+        Value& b { mStackTop[-1] };                                           \
+        if (!a.IsNumber() || !b.IsNumber()) [[unlikely]] {                    \
+            ip[-1] = static_cast<uint8_t>(Opcode::opcode);                    \
+            if (!Binary(Opcode::opcode, ip)) {                                \
+                return;                                                       \
+            }                                                                 \
+            VM_NEXT();                                                        \
+        }                                                                     \
+        a = Value(operation);                                                 \
+        mStackTop--;                                                          \
+        VM_NEXT();                                                            \
+    }
+
+// The signal fence keeps the compiler from sinking the store of ip (or of
+// mFrame, in kCall and kReturn) past the instructions that follow
+#define VM_INSTRUMENT()                                                                       \
+    if constexpr (kInstrumentation == Instrumentation::kProfileOps) {                         \
+        mProfiler->Enter(static_cast<Opcode>(instruction), mFrame->mFunction, ip - 1, ip - 1 - code); \
+    } else if constexpr (kInstrumentation == Instrumentation::kSample) {                      \
+        mFrame->mIp = ip;                                                                     \
+        std::atomic_signal_fence(std::memory_order_seq_cst);                                  \
+    } else if constexpr (kInstrumentation == Instrumentation::kTrace) {                       \
+        Trace(ip - 1);                                                                        \
+    }
+
+#ifdef BLOX_HAS_COMPUTED_GOTO
+// The switch engine is the same function body, so its labels go unused there
+#define VM_CASE(opcode)                   \
+    case Opcode::opcode:                  \
+        [[maybe_unused]] op_##opcode
+#define VM_TARGET(opcode) jumpTable[static_cast<uint8_t>(Opcode::opcode)] = &&op_##opcode
+#define VM_NEXT()                                                        \
+    if constexpr (kDispatch == Dispatch::kThreaded) {                    \
+        instruction = VM_READ_BYTE();                                    \
+        VM_INSTRUMENT();                                                 \
+        goto* jumpTable[instruction];                                    \
+    } else {                                                             \
+        continue;                                                        \
+    }
+#else
+#define VM_CASE(opcode) case Opcode::opcode
+#define VM_NEXT() continue
+#endif
+
+template <Vm::Dispatch kDispatch, Vm::Instrumentation kInstrumentation>
+void Vm::Execute()
+{
+#ifdef BLOX_HAS_COMPUTED_GOTO
+    void* jumpTable[256];
+    if constexpr (kDispatch == Dispatch::kThreaded) {
+        std::fill(std::begin(jumpTable), std::end(jumpTable), &&opUnknown);
+        VM_TARGET(kGlobalDefine);
+        VM_TARGET(kGlobalGet);
+        VM_TARGET(kGlobalSet);
+        VM_TARGET(kLocalGet);
+        VM_TARGET(kLocalGetLong);
+        VM_TARGET(kLocalSet);
+        VM_TARGET(kLocalSetLong);
+        VM_TARGET(kJump);
+        VM_TARGET(kJumpLong);
+        VM_TARGET(kJumpIfFalse);
+        VM_TARGET(kJumpIfFalseLong);
+        VM_TARGET(kJumpIfFalsePop);
+        VM_TARGET(kJumpIfFalsePopLong);
+        VM_TARGET(kJumpIfTrue);
+        VM_TARGET(kJumpIfTrueLong);
+        VM_TARGET(kConstant);
+        VM_TARGET(kConstantLong);
+        VM_TARGET(kNil);
+        VM_TARGET(kTrue);
+        VM_TARGET(kFalse);
+        VM_TARGET(kNegate);
+        VM_TARGET(kNot);
+        VM_TARGET(kAdd);
+        VM_TARGET(kAddLocalConst);
+        VM_TARGET(kSubtract);
+        VM_TARGET(kMultiply);
+        VM_TARGET(kDivide);
+        VM_TARGET(kEqual);
+        VM_TARGET(kLess);
+        VM_TARGET(kGreater);
+        VM_TARGET(kGreaterEqual);
+        VM_TARGET(kLessEqual);
+        VM_TARGET(kNotEqual);
+        VM_TARGET(kAddNumber);
+        VM_TARGET(kSubtractNumber);
+        VM_TARGET(kMultiplyNumber);
+        VM_TARGET(kDivideNumber);
+        VM_TARGET(kLessNumber);
+        VM_TARGET(kGreaterNumber);
+        VM_TARGET(kGreaterEqualNumber);
+        VM_TARGET(kLessEqualNumber);
+        VM_TARGET(kPrint);
+        VM_TARGET(kPop);
+        VM_TARGET(kPopn);
+        VM_TARGET(kCall);
+        VM_TARGET(kReturn);
+        VM_TARGET(kEof);
+    }
+#endif
+
+    // Cached from mFrame, reloaded whenever it changes
+    uint8_t* ip { mFrame->mIp };
+    uint8_t* code { mChunk->Code().data() };
+    Value* bp { mFrame->mBp };
+    uint8_t instruction {};
+
+    for (;;) {
+        instruction = VM_READ_BYTE();
+        VM_INSTRUMENT();
+#ifdef BLOX_HAS_COMPUTED_GOTO
+        if constexpr (kDispatch == Dispatch::kThreaded) {
+            goto* jumpTable[instruction];
         }
-        break;
-    case ir::Opcode::kJumpIfTrue:
-        if (IsTrue(mValueStack.back())) {
-            mFrame->mIp = target;
+#endif
+        switch (static_cast<Opcode>(instruction)) {
+        VM_CASE(kGlobalDefine): {
+            uint16_t slot { VM_READ_SHORT() };
+            mGlobalValues[slot] = Pop();
+            GlobalWriteBarrier(slot);
+            VM_NEXT();
+        }
+        VM_CASE(kGlobalGet): {
+            uint16_t slot { VM_READ_SHORT() };
+            const Value& value { mGlobalValues[slot] };
+            if (value.GetType() == Value::Type::kUndefined) [[unlikely]] {
+                RuntimeError(ip, fmt::format("Unknown global {}", mGlobals->GetName(slot)));
+                return;
+            }
+            Push(value);
+            VM_NEXT();
+        }
+        VM_CASE(kGlobalSet): {
+            uint16_t slot { VM_READ_SHORT() };
+            mGlobalValues[slot] = Peek();
+            GlobalWriteBarrier(slot);
+            VM_NEXT();
+        }
+        VM_CASE(kLocalGet):
+            Push(bp[VM_READ_BYTE()]);
+            VM_NEXT();
+        VM_CASE(kLocalGetLong):
+            Push(bp[VM_READ_SHORT()]);
+            VM_NEXT();
+        VM_CASE(kLocalSet):
+            // No write barrier, the live stack is a root of every collection
+            bp[VM_READ_BYTE()] = Peek();
+            VM_NEXT();
+        VM_CASE(kLocalSetLong):
+            bp[VM_READ_SHORT()] = Peek();
+            VM_NEXT();
+        VM_CASE(kJump): {
+            uint16_t target { VM_READ_SHORT() };
+            ip = code + target;
+            VM_NEXT();
+        }
+        VM_CASE(kJumpIfFalse): {
+            uint16_t target { VM_READ_SHORT() };
+            if (!IsTrue(Peek())) {
+                ip = code + target;
+            }
+            VM_NEXT();
+        }
+        VM_CASE(kJumpIfFalsePop): {
+            uint16_t target { VM_READ_SHORT() };
+            if (!IsTrue(Pop())) {
+                ip = code + target;
+            }
+            VM_NEXT();
+        }
+        VM_CASE(kJumpIfTrue): {
+            uint16_t target { VM_READ_SHORT() };
+            if (IsTrue(Peek())) {
+                ip = code + target;
+            }
+            VM_NEXT();
+        }
+        VM_CASE(kJumpLong): {
+            uint32_t target { VM_READ_UINT32() };
+            ip = code + target;
+            VM_NEXT();
+        }
+        VM_CASE(kJumpIfFalseLong): {
+            uint32_t target { VM_READ_UINT32() };
+            if (!IsTrue(Peek())) {
+                ip = code + target;
+            }
+            VM_NEXT();
+        }
+        VM_CASE(kJumpIfFalsePopLong): {
+            uint32_t target { VM_READ_UINT32() };
+            if (!IsTrue(Pop())) {
+                ip = code + target;
+            }
+            VM_NEXT();
+        }
+        VM_CASE(kJumpIfTrueLong): {
+            uint32_t target { VM_READ_UINT32() };
+            if (IsTrue(Peek())) {
+                ip = code + target;
+            }
+            VM_NEXT();
+        }
+        VM_CASE(kConstant):
+            Push(mChunk->GetConstant(VM_READ_BYTE()));
+            VM_NEXT();
+        VM_CASE(kConstantLong):
+            Push(mChunk->GetConstant(VM_READ_UINT24()));
+            VM_NEXT();
+        VM_CASE(kNil):
+            Push(Value());
+            VM_NEXT();
+        VM_CASE(kTrue):
+            Push(Value(true));
+            VM_NEXT();
+        VM_CASE(kFalse):
+            Push(Value(false));
+            VM_NEXT();
+        VM_CASE(kNegate):
+            if (!Negate(ip)) {
+                return;
+            }
+            VM_NEXT();
+        VM_CASE(kNot):
+            Push(!IsTrue(Pop()));
+            VM_NEXT();
+        VM_CASE(kAdd):
+        VM_CASE(kSubtract):
+        VM_CASE(kMultiply):
+        VM_CASE(kDivide):
+        VM_CASE(kLess):
+        VM_CASE(kGreater):
+        VM_CASE(kGreaterEqual):
+        VM_CASE(kLessEqual): {
+            bool numbers { mStackTop[-2].IsNumber() && mStackTop[-1].IsNumber() };
+            if (!Binary(static_cast<Opcode>(instruction), ip)) {
+                return;
+            }
+            if (numbers) {
+                ip[-1] = static_cast<uint8_t>(Quickened(static_cast<Opcode>(instruction)));
+            }
+            VM_NEXT();
+        }
+        VM_CASE(kEqual):
+        VM_CASE(kNotEqual):
+            // Not quickened, they work on any pair of types and are cheap already
+            if (!Binary(static_cast<Opcode>(instruction), ip)) {
+                return;
+            }
+            VM_NEXT();
+        VM_BINARY_NUMBER(kAdd, a.AsNumber() + b.AsNumber())
+        VM_BINARY_NUMBER(kSubtract, a.AsNumber() - b.AsNumber())
+        VM_BINARY_NUMBER(kMultiply, a.AsNumber() * b.AsNumber())
+        VM_BINARY_NUMBER(kLess, a.AsNumber() < b.AsNumber())
+        VM_BINARY_NUMBER(kGreater, a.AsNumber() > b.AsNumber())
+        VM_BINARY_NUMBER(kGreaterEqual, !(a.AsNumber() < b.AsNumber()))
+        VM_BINARY_NUMBER(kLessEqual, !(a.AsNumber() > b.AsNumber()))
+        VM_CASE(kDivideNumber): {
+            Value& a { mStackTop[-2] };
+            Value& b { mStackTop[-1] };
+            // A zero divisor goes through the generic path for its error
+            if (!a.IsNumber() || !b.IsNumber() || b.AsNumber() == 0.0) [[unlikely]] {
+                if (!b.IsNumber() || !a.IsNumber()) {
+                    ip[-1] = static_cast<uint8_t>(Opcode::kDivide);
+                }
+                if (!Binary(Opcode::kDivide, ip)) {
+                    return;
+                }
+                VM_NEXT();
+            }
+            a = Value(a.AsNumber() / b.AsNumber());
+            mStackTop--;
+            VM_NEXT();
+        }
+        VM_CASE(kAddLocalConst): {
+            Value local { bp[VM_READ_BYTE()] };
+            Value constant { mChunk->GetConstant(VM_READ_BYTE()) };
+            if (local.IsNumber() && constant.IsNumber()) [[likely]] {
+                Push(Value(local.AsNumber() + constant.AsNumber()));
+                VM_NEXT();
+            }
+            // Anything else (string concatenation, type errors) takes the kAdd path
+            Push(local);
+            Push(constant);
+            if (!Binary(Opcode::kAdd, ip)) {
+                return;
+            }
+            VM_NEXT();
+        }
+        VM_CASE(kPrint):
+            Print();
+            VM_NEXT();
+        VM_CASE(kPop):
+            Pop();
+            VM_NEXT();
+        VM_CASE(kPopn):
+            mStackTop -= VM_READ_BYTE();
+            VM_NEXT();
+        VM_CASE(kCall): {
+            // The callee and its arguments become slots 0..argumentCount of
+            // the new frame where they are, nothing is copied
+            uint8_t argumentCount { VM_READ_BYTE() };
+            Value callee { mStackTop[-1 - argumentCount] };
+            if (callee.GetType() != Value::Type::kFunction) [[unlikely]] {
+                RuntimeError(ip, "Can only call functions");
+                return;
+            }
+            auto* function { static_cast<ObjectFunction*>(callee.AsObject()) };
+            if (function->mArity != argumentCount) [[unlikely]] {
+                RuntimeError(ip, fmt::format("Expected {} arguments but got {}", function->mArity, argumentCount));
+                return;
+            }
+            if (mFrame + 1 == mFramesEnd) [[unlikely]] {
+                RuntimeError(ip, "Call stack overflow");
+                return;
+            }
+            assert(function->mMaxStackDepth >= 0);
+            Value* base { mStackTop - argumentCount - 1 };
+            if (mStackEnd - base < function->mMaxStackDepth) [[unlikely]] {
+                RuntimeError(ip, "Stack overflow");
+                return;
+            }
+
+            // The new frame is complete before mFrame points at it, the
+            // sampler may look at any time
+            mFrame->mIp = ip;
+            mFrame[1] = { function, function->mChunk.Code().data(), base };
+            std::atomic_signal_fence(std::memory_order_release);
+            mFrame++;
+            mChunk = &function->mChunk;
+            code = mChunk->Code().data();
+            ip = code;
+            bp = mFrame->mBp;
+            VM_NEXT();
+        }
+        VM_CASE(kReturn): {
+            // Main never returns, the compiler rejects return at top level
+            Value result { Pop() };
+            mStackTop = bp;
+            mFrame--;
+            Push(result);
+            mChunk = &mFrame->mFunction->mChunk;
+            code = mChunk->Code().data();
+            ip = mFrame->mIp;
+            bp = mFrame->mBp;
+            VM_NEXT();
+        }
+        VM_CASE(kEof):
+            mFrame->mIp = ip;
+            return;
+        default:
+#ifdef BLOX_HAS_COMPUTED_GOTO
+        [[maybe_unused]] opUnknown:
+#endif
+            spdlog::error("Internal error - unknown opcode {}",
+                magic_enum::enum_name(static_cast<Opcode>(instruction)));
+            VM_NEXT();
         }
-        break;
-    default:
-        assert(1 > 2);
     }
 }
 
-void Vm::Constant(Byte byte)
+#undef VM_READ_BYTE
+#undef VM_READ_SHORT
+#undef VM_READ_UINT24
+#undef VM_READ_UINT32
+#undef VM_BINARY_NUMBER
+#undef VM_INSTRUMENT
+#undef VM_CASE
+#undef VM_TARGET
+#undef VM_NEXT
+
+bool Vm::Negate(const uint8_t* ip)
 {
-    int index = NextByte().mByte;
-    Push(mChunk->GetConstant(index));
+    Value& top { Peek() };
+    if (!CheckType(Value::Type::kNumber, top, ip)) {
+        return false;
+    }
+    top = Value(-top.AsNumber());
+    return true;
 }
 
-void Vm::Negate(Byte byte)
+bool Vm::Binary(Opcode opcode, const uint8_t* ip)
 {
-    Value top = mValueStack.back();
-    if (CheckType(Value::Type::kNumber, top, byte.mLine)) {
-        Pop();
-        Push(Value(-top.mAs.number));
+    if (opcode == Opcode::kAdd && mStackTop[-2].GetType() == ir::Value::Type::kString) {
+        if (!CheckType(Value::Type::kString, Peek(), ip)) {
+            return false;
+        }
+        // Operands stay on the stack (rooted) while the result is allocated
+        ObjectString* objectA { static_cast<ObjectString*>(mStackTop[-2].AsObject()) };
+        ObjectString* objectB { static_cast<ObjectString*>(mStackTop[-1].AsObject()) };
+        ObjectString* result { mHeap->Concatenate(objectA, objectB) };
+        mStackTop -= 2;
+        Push(Value(result));
+        return true;
     }
-}
 
-void Vm::Binary(Byte byte)
-{
     Value b { Pop() };
     Value a { Pop() };
-    Opcode opcode = static_cast<Opcode>(byte.mByte);
-
-    if (opcode == Opcode::kAdd && a.mType == ir::Value::Type::kString) {
-        if (!CheckType(Value::Type::kString, b, byte.mLine)) {
-            return;
-        }
-        ObjectString* objectA { static_cast<ObjectString*>(a.mAs.object) };
-        ObjectString* objectB { static_cast<ObjectString*>(b.mAs.object) };
-        Push(Value(objectA->mString + objectB->mString));
-        return;
-    }
 
     if (opcode == Opcode::kEqual) {
         Push(Value(a == b));
-        return;
+        return true;
+    }
+    if (opcode == Opcode::kNotEqual) {
+        Push(Value(!(a == b)));
+        return true;
     }
 
-    if (!CheckType(Value::Type::kNumber, { a, b }, byte.mLine)) {
-        return;
+    if (!CheckType(Value::Type::kNumber, { a, b }, ip)) {
+        return false;
     }
 
     switch (opcode) {
     case Opcode::kAdd:
-        Push(Value(a.mAs.number + b.mAs.number));
+        Push(Value(a.AsNumber() + b.AsNumber()));
         break;
     case Opcode::kSubtract:
-        Push(Value(a.mAs.number - b.mAs.number));
+        Push(Value(a.AsNumber() - b.AsNumber()));
         break;
     case Opcode::kMultiply:
-        Push(Value(a.mAs.number * b.mAs.number));
+        Push(Value(a.AsNumber() * b.AsNumber()));
         break;
     case Opcode::kDivide: {
-        if (b.mAs.number == 0.0) {
-            mErrorReporter->Report(byte.mLine, "divide by zero");
-            return;
+        if (b.AsNumber() == 0.0) {
+            RuntimeError(ip, "divide by zero");
+            return false;
         }
-        Push(Value(a.mAs.number / b.mAs.number));
+        Push(Value(a.AsNumber() / b.AsNumber()));
         break;
     }
     case Opcode::kGreater:
-        Push(Value(a.mAs.number > b.mAs.number));
+        Push(Value(a.AsNumber() > b.AsNumber()));
         break;
     case Opcode::kLess:
-        Push(Value(a.mAs.number < b.mAs.number));
+        Push(Value(a.AsNumber() < b.AsNumber()));
+        break;
+    // Negated rather than >= and <= so that NaN compares exactly like the
+    // unfused kLess kNot and kGreater kNot did
+    case Opcode::kGreaterEqual:
+        Push(Value(!(a.AsNumber() < b.AsNumber())));
+        break;
+    case Opcode::kLessEqual:
+        Push(Value(!(a.AsNumber() > b.AsNumber())));
         break;
     default:
         assert(6 > 7);
     }
+    return true;
 }
 
-void Vm::Print(Byte byte)
+void Vm::Print()
 {
     // TODO: Clean this up, nothing should be run if errors are there
     if (mErrorReporter->HadErrors()) {
@@ -247,70 +631,91 @@ void Vm::Print(Byte byte)
     std::cout << Pop() << "\n";
 }
 
-void Vm::Popn(Byte byte)
+void Vm::GlobalWriteBarrier(uint16_t slot)
 {
-    uint8_t count { NextByte().mByte };
-    for (uint8_t i = 0; i < count; i++) {
-        Pop();
+    if (mHeap->IsYoung(mGlobalValues[slot]) && !mYoungGlobalFlags[slot]) {
+        mYoungGlobalFlags[slot] = true;
+        mYoungGlobals.emplace_back(slot);
     }
 }
 
-Vm::Byte Vm::NextByte()
+int Vm::CollectFrames(void* context, Sampler::Frame* frames, int capacity)
 {
-    assert(HasMoreBytes());
-    return { mChunk->mBytecode[mFrame->mIp], mChunk->mLines[mFrame->mIp++] };
-}
+    // Async-signal-safe: reads only, and only what Execute() keeps current
+    // in the kSample engine
+    auto* vm { static_cast<const Vm*>(context) };
+    CallFrame* top { vm->mFrame };
+    if (top == nullptr) {
+        return 0;
+    }
 
-Vm::Byte Vm::PeekByte()
-{
-    assert(HasMoreBytes());
-    return { mChunk->mBytecode[mFrame->mIp], mChunk->mLines[mFrame->mIp] };
+    int depth { 0 };
+    for (CallFrame* frame { top }; frame >= vm->mFrames.get(); frame--) {
+        if (depth == capacity) {
+            return depth + 1; // tells the sampler there was more
+        }
+        // mIp is past the opcode (top frame) or past the kCall; step back into
+        // the instruction, unless the frame has not run anything yet
+        const uint8_t* code { frame->mFunction->mChunk.Code().data() };
+        frames[depth++] = { frame->mFunction, frame->mIp > code ? frame->mIp - 1 : frame->mIp };
+    }
+    return depth;
 }
 
-bool Vm::HasMoreBytes()
+void Vm::WriteSampleProfile(const Sampler& sampler) const
 {
-    return mFrame->mIp < mChunk->mBytecode.size();
+    std::ofstream out { mSampleProfilePath };
+    out << sampler.Folded();
+    if (!out) {
+        spdlog::error("cannot write the sample profile to {}", mSampleProfilePath);
+        return;
+    }
+    spdlog::info("wrote {} samples ({} dropped) to {}", sampler.SampleCount(), sampler.DroppedCount(),
+        mSampleProfilePath);
 }
 
-void Vm::Push(Value value)
+void Vm::Trace(const uint8_t* instruction) const
 {
-    mValueStack.push_back(value);
-    mStackPointer++;
+    std::string line { fmt::format("{:>12} {:04d} {:<20}", mFrame->mFunction->mName,
+        instruction - mChunk->Code().data(), magic_enum::enum_name(static_cast<Opcode>(*instruction))) };
+    for (Value* slot { mFrame->mBp }; slot < mStackTop; slot++) {
+        line += fmt::format("[ {} ]", *slot);
+    }
+    std::cerr << line << "\n";
 }
 
-Value Vm::Pop()
+void Vm::RuntimeError(const uint8_t* ip, const std::string& message)
 {
-    Value ret { mValueStack[--mStackPointer] };
-    mValueStack.pop_back();
-    return ret;
+    // ip is past the last byte read, every byte of an instruction carries its line
+    int offset { static_cast<int>(ip - mChunk->Code().data()) - 1 };
+    mErrorReporter->Report(mChunk->GetLine(offset), message);
 }
 
 bool Vm::IsTrue(Value value)
 {
-    if (value.mType == Value::Type::kNil || (value.mType == Value::Type::kBool && value.mAs.boolean == false)) {
+    if (value.GetType() == Value::Type::kNil || (value.GetType() == Value::Type::kBool && !value.AsBool())) {
         return false;
     }
     return true;
 }
 
-bool Vm::CheckType(Value::Type type, Value value, int line)
+bool Vm::CheckType(Value::Type type, Value value, const uint8_t* ip)
 {
-    if (value.mType != type) {
-        mErrorReporter->Report(line, fmt::format("Expected type {}, got {}", magic_enum::enum_name(type), magic_enum::enum_name(value.mType)));
+    if (value.GetType() != type) {
+        RuntimeError(ip, fmt::format("Expected type {}, got {}", magic_enum::enum_name(type), magic_enum::enum_name(value.GetType())));
         return false;
     }
     return true;
 }
 
-bool Vm::CheckType(Value::Type type, std::initializer_list<Value> values, int line)
+bool Vm::CheckType(Value::Type type, std::initializer_list<Value> values, const uint8_t* ip)
 {
-    bool ret { true };
     for (auto& value : values) {
-        if (!CheckType(type, value, line)) {
-            ret = false;
+        if (!CheckType(type, value, ip)) {
+            return false;
         }
     }
-    return ret;
+    return true;
 }
 
 }
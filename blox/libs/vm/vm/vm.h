@@ -2,60 +2,110 @@
 
 #include <ir/ierror_reporter.h>
 #include <ir/ir.h>
-#include <map>
+#include <memory>
+#include <vm/options.h>
+#include <vm/profiler.h>
+#include <vm/sampler.h>
+
+// Labels-as-values is a GCC/Clang extension, everything else gets the switch loop
+#if defined(BLOX_THREADED_DISPATCH) && (defined(__GNUC__) || defined(__clang__))
+#define BLOX_HAS_COMPUTED_GOTO
+#endif
 
 namespace vm {
 
-class Vm final {
+class Vm final : public ir::IRootProvider {
 public:
-    Vm(ir::ObjectFunction* main, ir::IErrorReporter* errorReporter);
+    // kSwitch funnels every instruction through a single indirect branch,
+    // kThreaded has each handler jump straight to the next one
+    enum class Dispatch {
+        kSwitch = 0,
+        kThreaded
+    };
+
+#ifdef BLOX_HAS_COMPUTED_GOTO
+    static constexpr Dispatch kDefaultDispatch { Dispatch::kThreaded };
+#else
+    static constexpr Dispatch kDefaultDispatch { Dispatch::kSwitch };
+#endif
+
+    Vm(ir::ObjectFunction* main, ir::Heap* heap, ir::GlobalTable* globals,
+        ir::IErrorReporter* errorReporter, const Options& options = {});
+    ~Vm();
     void Run();
+    void Run(Dispatch dispatch);
+
+    void MarkRoots(ir::Heap& heap) override;
+
+    const OpcodeProfiler* GetProfiler() const; // nullptr unless Options::mProfileOps
 
 private:
-    // TODO: Switch instruction pointers from int -> uint16_t
-    struct CallFrame {
-        ir::ObjectFunction* mFunction;
-        int mIp;
-        int mBp;
+    // Extra work per instruction, each is its own instantiation of Execute()
+    // so the plain engine carries none of it
+    enum class Instrumentation {
+        kNone = 0,
+        kProfileOps, // feed every instruction to mProfiler
+        kSample, // publish ip in mFrame for the sampler's signal handler
+        kTrace // print every instruction, see Trace()
     };
 
-    struct Byte {
-        uint8_t mByte;
-        int mLine;
+    template <Dispatch kDispatch, Instrumentation kInstrumentation>
+    void Execute();
+    template <Dispatch kDispatch>
+    void Execute();
+
+    // mIp is only kept up to date across calls, Execute() keeps the live
+    // instruction pointer in a local. Not const, quickening writes through it.
+    struct CallFrame {
+        ir::ObjectFunction* mFunction;
+        uint8_t* mIp;
+        ir::Value* mBp;
     };
 
-    void Global(Byte byte);
-    void Local(Byte byte);
-    void Jump(Byte byte);
-    void Constant(Byte byte);
-    void Negate(Byte byte);
-    void Binary(Byte byte);
-    void Print(Byte byte);
-    void Popn(Byte byte);
+    // Return false after reporting a runtime error
+    bool Negate(const uint8_t* ip);
+    bool Binary(ir::Opcode opcode, const uint8_t* ip);
+    void Print();
 
-    // bytecode
-    Byte NextByte();
-    Byte PeekByte();
-    bool HasMoreBytes();
+    void RuntimeError(const uint8_t* ip, const std::string& message);
+    void Trace(const uint8_t* instruction) const;
+    // Sampler::Collect, runs in the signal handler
+    static int CollectFrames(void* vm, Sampler::Frame* frames, int capacity);
+    void WriteSampleProfile(const Sampler& sampler) const;
+    void GlobalWriteBarrier(uint16_t slot);
 
-    // value stack
-    void Push(ir::Value);
-    ir::Value Pop();
+    // value stack, unchecked, frames are checked on entry for the verified depth
+    void Push(ir::Value value) { *mStackTop++ = value; }
+    ir::Value Pop() { return *--mStackTop; }
+    ir::Value& Peek() { return mStackTop[-1]; }
 
     bool IsTrue(ir::Value value);
-    bool CheckType(ir::Value::Type, ir::Value, int line);
-    bool CheckType(ir::Value::Type, std::initializer_list<ir::Value>, int line);
+    bool CheckType(ir::Value::Type, ir::Value, const uint8_t* ip);
+    bool CheckType(ir::Value::Type, std::initializer_list<ir::Value>, const uint8_t* ip);
 
     ir::ObjectFunction* mMain;
+    ir::Heap* mHeap;
+    ir::GlobalTable* mGlobals;
     ir::IErrorReporter* mErrorReporter;
     // ir::ObjectFunction* mCurrentFunction;
-    ir::Chunk* mChunk;
-    CallFrame* mFrame;
+    ir::Chunk* mChunk { nullptr };
+    CallFrame* mFrame { nullptr };
+
+    // Fixed size so that pointers into either stack stay valid
+    std::unique_ptr<ir::Value[]> mStack;
+    ir::Value* mStackTop;
+    ir::Value* mStackEnd;
+    std::unique_ptr<CallFrame[]> mFrames;
+    CallFrame* mFramesEnd;
+    std::vector<ir::Value> mGlobalValues; // indexed by GlobalTable slot
+    // Remembered set for minor collections: slots that may hold a young object
+    std::vector<uint16_t> mYoungGlobals;
+    std::vector<uint8_t> mYoungGlobalFlags;
 
-    std::vector<ir::Value> mValueStack;
-    int mStackPointer { 0 };
-    std::vector<CallFrame> mCallStack;
-    std::map<std::string, ir::Value> mGlobals;
+    bool mTrace;
+    std::unique_ptr<OpcodeProfiler> mProfiler;
+    std::string mSampleProfilePath;
+    int mSampleIntervalUs;
 };
 
 }
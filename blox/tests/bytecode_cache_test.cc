@@ -0,0 +1,200 @@
+#include <compiler/compiler.h>
+#include <driver/driver.h>
+#include <driver/error_reporter.h>
+#include <ir/bytecode_cache.h>
+#include <ir/ir.h>
+#include <ir/mapped_file.h>
+#include <vm/vm.h>
+
+#include <gtest/gtest.h>
+#include <spdlog/spdlog.h>
+
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace bloxTests {
+
+const char* kSource { R"(
+fun greet(name) {
+    fun exclaim(s) { return s + "!"; }
+    return exclaim("hi " + name);
+}
+var n = 1.5;
+print greet("bob");
+print n * 2;
+print nil == false;
+)" };
+
+class BytecodeCacheTest : public testing::Test {
+protected:
+    void SetUp() override
+    {
+        spdlog::set_level(spdlog::level::off);
+        mDirectory = std::filesystem::temp_directory_path()
+            / testing::UnitTest::GetInstance()->current_test_info()->name();
+        std::filesystem::create_directories(mDirectory);
+    }
+
+    void TearDown() override
+    {
+        std::filesystem::remove_all(mDirectory);
+    }
+
+    // Compiles kSource on its own heap and writes it to path
+    void WriteCache(const std::string& path, uint64_t hash)
+    {
+        driver::ErrorReporter errorReporter {};
+        ir::Heap heap {};
+        ir::GlobalTable globals {};
+        compiler::Compiler compiler(kSource, &heap, &globals, &errorReporter);
+        ir::ObjectFunction* main { compiler.Compile() };
+        ASSERT_FALSE(errorReporter.HadErrors());
+        ASSERT_TRUE(ir::BytecodeCache::Write(path, main, globals, hash));
+    }
+
+    std::string Capture(auto&& body)
+    {
+        std::ostringstream out;
+        std::streambuf* old { std::cout.rdbuf(out.rdbuf()) };
+        body();
+        std::cout.rdbuf(old);
+        return out.str();
+    }
+
+    static std::string ReadFile(const std::string& path)
+    {
+        std::ifstream file { path, std::ios::binary };
+        return { std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>() };
+    }
+
+    std::filesystem::path mDirectory;
+};
+
+TEST_F(BytecodeCacheTest, RoundTrip)
+{
+    std::string path { mDirectory / "program.bloxc" };
+    uint64_t hash { ir::BytecodeCache::Hash(kSource) };
+    WriteCache(path, hash);
+
+    std::unique_ptr<ir::MappedFile> mapped { ir::MappedFile::Open(path) };
+    ASSERT_NE(mapped, nullptr);
+
+    driver::ErrorReporter errorReporter {};
+    ir::Heap heap { ir::GcOptions { .mStress = true } };
+    ir::GlobalTable globals {};
+    ir::ObjectFunction* main { ir::BytecodeLoader(&heap, &globals).Load(mapped->Bytes(), hash) };
+    ASSERT_NE(main, nullptr);
+
+    // Zero copy: the bytecode is read from the mapping itself
+    std::span<const uint8_t> file { mapped->Bytes() };
+    EXPECT_TRUE(main->mChunk.mBytecode.empty());
+    EXPECT_GE(main->mChunk.Code().data(), file.data());
+    EXPECT_LE(main->mChunk.Code().data() + main->mChunk.Code().size(), file.data() + file.size());
+
+    std::string output { Capture([&]() {
+        vm::Vm vm(main, &heap, &globals, &errorReporter);
+        vm.Run();
+    }) };
+    EXPECT_EQ(output, "string= hi bob!\nnumber= 3\nboolean= false\n");
+    EXPECT_FALSE(errorReporter.HadErrors());
+
+    // Running quickened the mapped code, but neither the file on disk nor a
+    // file written from it sees that
+    std::string rewritten { mDirectory / "rewritten.bloxc" };
+    ASSERT_TRUE(ir::BytecodeCache::Write(rewritten, main, globals, hash));
+    EXPECT_EQ(ReadFile(rewritten), ReadFile(path));
+}
+
+TEST_F(BytecodeCacheTest, RejectsStaleAndCorruptFiles)
+{
+    std::string path { mDirectory / "program.bloxc" };
+    uint64_t hash { ir::BytecodeCache::Hash(kSource) };
+    WriteCache(path, hash);
+
+    std::unique_ptr<ir::MappedFile> mapped { ir::MappedFile::Open(path) };
+    ASSERT_NE(mapped, nullptr);
+    std::vector<uint8_t> bytes { mapped->Bytes().begin(), mapped->Bytes().end() };
+
+    ir::Heap heap {};
+    ir::GlobalTable globals {};
+    EXPECT_EQ(ir::BytecodeLoader(&heap, &globals).Load(bytes, hash + 1), nullptr);
+
+    // Every truncation must be caught, not read past the end
+    for (std::size_t size { 0 }; size < bytes.size(); size++) {
+        ir::GlobalTable freshGlobals {};
+        EXPECT_EQ(ir::BytecodeLoader(&heap, &freshGlobals).Load({ bytes.data(), size }, hash), nullptr);
+    }
+
+    std::vector<uint8_t> newerVersion { bytes };
+    newerVersion[8]++;
+    EXPECT_EQ(ir::BytecodeLoader(&heap, &globals).Load(newerVersion, hash), nullptr);
+
+    // Slots already taken by other globals
+    ir::GlobalTable usedGlobals {};
+    usedGlobals.Resolve("other");
+    EXPECT_EQ(ir::BytecodeLoader(&heap, &usedGlobals).Load(bytes, hash), nullptr);
+}
+
+TEST_F(BytecodeCacheTest, DriverReusesCacheUntilSourceChanges)
+{
+    std::string script { mDirectory / "program.lox" };
+    std::string cache { mDirectory / "program.bloxc" };
+    auto run { [&](std::string_view source) {
+        std::ofstream(script) << source;
+        return Capture([&]() { EXPECT_TRUE(driver::Driver {}.RunFile(script)); });
+    } };
+
+    EXPECT_EQ(run("var a = 3; print a + 2;"), "number= 5\n");
+    ASSERT_TRUE(std::filesystem::exists(cache));
+    std::string written { ReadFile(cache) };
+
+    // Corrupting the code behind the cache's back shows whether it is used;
+    // a + 2 turns into a * 2
+    std::string patched { written };
+    std::size_t add { patched.rfind(static_cast<char>(ir::Opcode::kAdd)) };
+    ASSERT_NE(add, std::string::npos);
+    patched[add] = static_cast<char>(ir::Opcode::kMultiply);
+    std::ofstream(cache, std::ios::binary) << patched;
+    EXPECT_EQ(run("var a = 3; print a + 2;"), "number= 6\n");
+
+    EXPECT_EQ(run("print \"changed\";"), "string= changed\n");
+    EXPECT_NE(ReadFile(cache), patched);
+}
+
+TEST_F(BytecodeCacheTest, CorruptLineRunsFallBackToCompiling)
+{
+    using namespace std::string_literals;
+    std::string script { mDirectory / "program.lox" };
+    std::string cache { mDirectory / "program.bloxc" };
+    std::string source { "var a = 3;\nprint a + 2;" };
+    std::ofstream(script) << source;
+    auto run { [&]() { return Capture([&]() { EXPECT_TRUE(driver::Driver {}.RunFile(script)); }); } };
+
+    EXPECT_EQ(run(), "number= 5\n");
+    std::string written { ReadFile(cache) };
+
+    // Two runs, { 0, line 1 } and { offset, line 2 }, little-endian
+    std::string runs { "\x02\0\0\0\0\0\0\0\x01\0\0\0"s };
+    std::size_t second { written.find(runs) };
+    ASSERT_NE(second, std::string::npos);
+    second += runs.size();
+    ASSERT_EQ(written.substr(second + 4, 4), "\x02\0\0\0"s);
+
+    // Negative as an int, past the code, a negative line
+    for (auto [at, value] : { std::pair { second, "\0\0\0\x80"s }, std::pair { second, "\xf0\xff\xff\x7f"s },
+             std::pair { second + 4, "\xff\xff\xff\xff"s } }) {
+        std::string patched { written };
+        patched.replace(at, 4, value);
+        std::ofstream(cache, std::ios::binary) << patched;
+        EXPECT_EQ(run(), "number= 5\n");
+        EXPECT_EQ(ReadFile(cache), written);
+    }
+}
+
+}
@@ -0,0 +1,94 @@
+#include <ir/heap.h>
+#include <ir/ir.h>
+#include <ir/line_table.h>
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <optional>
+
+namespace bloxTests {
+
+TEST(LineTableTest, Empty)
+{
+    ir::LineTable table {};
+    EXPECT_TRUE(table.Runs().empty());
+    EXPECT_EQ(table.GetLine(0), -1);
+}
+
+TEST(LineTableTest, RunsOnlyOnLineChange)
+{
+    ir::LineTable table {};
+    table.Add(0, 1);
+    table.Add(1, 1);
+    table.Add(2, 1);
+    table.Add(3, 4);
+    table.Add(4, 4);
+    table.Add(5, 2);
+
+    ASSERT_EQ(table.Runs().size(), 3);
+
+    EXPECT_EQ(table.GetLine(0), 1);
+    EXPECT_EQ(table.GetLine(2), 1);
+    EXPECT_EQ(table.GetLine(3), 4);
+    EXPECT_EQ(table.GetLine(4), 4);
+    EXPECT_EQ(table.GetLine(5), 2);
+    EXPECT_EQ(table.GetLine(100), 2);
+}
+
+TEST(LineTableTest, ChunkLines)
+{
+    ir::Chunk chunk {};
+    chunk.AddBytes({ ir::Opcode::kNil, ir::Opcode::kNil, ir::Opcode::kAdd }, 7);
+    chunk.AddByte(ir::Opcode::kPrint, 8);
+    chunk.AddByte(ir::Opcode::kEof, 9);
+
+    ASSERT_EQ(chunk.mBytecode.size(), 5);
+    EXPECT_EQ(chunk.mLines.Runs().size(), 3);
+
+    EXPECT_EQ(chunk.GetLine(0), 7);
+    EXPECT_EQ(chunk.GetLine(2), 7);
+    EXPECT_EQ(chunk.GetLine(3), 8);
+    EXPECT_EQ(chunk.GetLine(4), 9);
+}
+
+TEST(ChunkTest, ConstantsAreShared)
+{
+    ir::Heap heap {};
+    ir::Chunk chunk {};
+
+    EXPECT_EQ(chunk.AddConstant(1.0), 0);
+    EXPECT_EQ(chunk.AddConstant(heap.NewString("a")), 1);
+    EXPECT_EQ(chunk.AddConstant(1.0), 0);
+    EXPECT_EQ(chunk.AddConstant(heap.NewString("a")), 1);
+    EXPECT_EQ(chunk.mConstants.size(), 2);
+
+    // Bitwise: 0 and -0 compare equal but print differently, NaN never
+    // compares equal but is still the same constant
+    EXPECT_EQ(chunk.AddConstant(0.0), 2);
+    EXPECT_EQ(chunk.AddConstant(-0.0), 3);
+    EXPECT_EQ(chunk.AddConstant(std::nan("")), 4);
+    EXPECT_EQ(chunk.AddConstant(std::nan("")), 4);
+    EXPECT_EQ(chunk.AddConstant(heap.NewString("b")), 5);
+
+    EXPECT_EQ(chunk.FindConstant(heap.NewString("a")), 1);
+    EXPECT_EQ(chunk.FindConstant(-0.0), 3);
+    EXPECT_EQ(chunk.FindConstant(2.0), std::nullopt);
+    EXPECT_EQ(chunk.mConstants.size(), 6);
+}
+
+TEST(ChunkTest, TruncateForgetsConstants)
+{
+    ir::Heap heap {};
+    ir::Chunk chunk {};
+    chunk.AddConstant(1.0);
+    chunk.AddConstant(2.0);
+    chunk.AddConstant(heap.NewString("a"));
+
+    chunk.Truncate(0, 1);
+    EXPECT_EQ(chunk.AddConstant(heap.NewString("a")), 1);
+    EXPECT_EQ(chunk.AddConstant(2.0), 2);
+    EXPECT_EQ(chunk.AddConstant(1.0), 0);
+}
+
+}
@@ -0,0 +1,156 @@
+#include <compiler/compiler.h>
+#include <driver/error_reporter.h>
+#include <ir/ir.h>
+
+#include <fmt/format.h>
+#include <gtest/gtest.h>
+#include <spdlog/spdlog.h>
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace bloxTests {
+
+using ir::Opcode;
+
+// Checks the bytecode the compiler produces, with the peephole pass off
+class CompilerTest : public testing::Test {
+protected:
+    void SetUp() override
+    {
+        spdlog::set_level(spdlog::level::off);
+    }
+
+    const ir::Chunk& Compile(std::string_view source)
+    {
+        compiler::Compiler compiler(source, &mHeap, &mGlobals, &mErrorReporter, { .mPeephole = false });
+        mChunk = &compiler.Compile()->mChunk;
+        return *mChunk;
+    }
+
+    std::vector<Opcode> Opcodes() const
+    {
+        std::vector<Opcode> opcodes;
+        for (int offset { 0 }; offset < mChunk->mBytecode.size();) {
+            Opcode opcode { static_cast<Opcode>(mChunk->mBytecode[offset]) };
+            opcodes.emplace_back(opcode);
+            offset += 1 + ir::OperandBytes(opcode);
+        }
+        return opcodes;
+    }
+
+    driver::ErrorReporter mErrorReporter;
+    ir::Heap mHeap;
+    ir::GlobalTable mGlobals;
+    const ir::Chunk* mChunk { nullptr };
+};
+
+TEST_F(CompilerTest, FoldsArithmetic)
+{
+    const ir::Chunk& chunk { Compile("print 60 * 60 * 24 + -(1 - 2);") };
+
+    EXPECT_EQ(Opcodes(), (std::vector { Opcode::kConstant, Opcode::kPrint, Opcode::kEof }));
+    ASSERT_EQ(chunk.mConstants.size(), 1);
+    EXPECT_EQ(chunk.GetConstant(0).AsNumber(), 86401);
+}
+
+TEST_F(CompilerTest, FoldsComparisonsAndNot)
+{
+    Compile("print !(1 >= 2) == (\"a\" + \"b\" == \"ab\");");
+
+    EXPECT_EQ(Opcodes(), (std::vector { Opcode::kTrue, Opcode::kPrint, Opcode::kEof }));
+    EXPECT_EQ(mChunk->mConstants.size(), 0);
+}
+
+TEST_F(CompilerTest, FoldsStrings)
+{
+    const ir::Chunk& chunk { Compile("print \"con\" + \"cat\";") };
+
+    ASSERT_EQ(chunk.mConstants.size(), 1);
+    EXPECT_EQ(chunk.GetConstant(0).AsObject(), mHeap.NewString("concat"));
+}
+
+TEST_F(CompilerTest, LeavesRuntimeErrorsAlone)
+{
+    Compile("print 1 / 0; print -\"a\"; print 1 + nil;");
+
+    EXPECT_EQ(Opcodes(), (std::vector { Opcode::kConstant, Opcode::kConstant, Opcode::kDivide, Opcode::kPrint,
+                             Opcode::kConstant, Opcode::kNegate, Opcode::kPrint,
+                             Opcode::kConstant, Opcode::kNil, Opcode::kAdd, Opcode::kPrint, Opcode::kEof }));
+}
+
+TEST_F(CompilerTest, DoesNotFoldVariables)
+{
+    Compile("{ var a = 1; print a + 2 * 3; print (a and 2) + 3; }");
+
+    EXPECT_EQ(Opcodes(), (std::vector { Opcode::kConstant,
+                             Opcode::kLocalGet, Opcode::kConstant, Opcode::kAdd, Opcode::kPrint,
+                             Opcode::kLocalGet, Opcode::kJumpIfFalse, Opcode::kPop, Opcode::kConstant,
+                             Opcode::kConstant, Opcode::kAdd, Opcode::kPrint,
+                             Opcode::kPopn, Opcode::kEof }));
+    EXPECT_EQ(mChunk->GetConstant(1).AsNumber(), 6);
+}
+
+TEST_F(CompilerTest, DropsDeadBranches)
+{
+    Compile(R"(
+        if (1 > 2) print "then"; else print "else";
+        if (true) print 1;
+        while (nil) { var x = "dead"; print x; }
+    )");
+
+    EXPECT_EQ(Opcodes(), (std::vector { Opcode::kConstant, Opcode::kPrint,
+                             Opcode::kConstant, Opcode::kPrint, Opcode::kEof }));
+    ASSERT_EQ(mChunk->mConstants.size(), 2);
+    EXPECT_EQ(mChunk->GetConstant(0).AsObject(), mHeap.NewString("else"));
+    EXPECT_FALSE(mErrorReporter.HadErrors());
+}
+
+TEST_F(CompilerTest, DeadBranchesStillReportErrors)
+{
+    Compile("if (false) print 1 +;");
+
+    EXPECT_TRUE(mErrorReporter.HadErrors());
+}
+
+TEST_F(CompilerTest, WideConstantsAndLocals)
+{
+    std::string source { "{" };
+    for (int i { 0 }; i < 300; i++) {
+        source += fmt::format(" var v{} = {};", i, i);
+    }
+    source += " print v299; v299 = v0; }";
+    const ir::Chunk& chunk { Compile(source) };
+
+    ASSERT_FALSE(mErrorReporter.HadErrors());
+    std::vector<Opcode> opcodes { Opcodes() };
+    EXPECT_EQ(opcodes[255], Opcode::kConstant);
+    EXPECT_EQ(opcodes[256], Opcode::kConstantLong);
+    EXPECT_EQ(chunk.mConstants.size(), 300);
+
+    std::vector<Opcode> tail(opcodes.begin() + 300, opcodes.end());
+    EXPECT_EQ(tail, (std::vector { Opcode::kLocalGetLong, Opcode::kPrint, Opcode::kLocalGet, Opcode::kLocalSetLong,
+                        Opcode::kPop, Opcode::kPopn, Opcode::kPopn, Opcode::kEof }));
+}
+
+TEST_F(CompilerTest, SharesConstants)
+{
+    // Folding drops the operands' constants but must not drop the shared 2
+    const ir::Chunk& chunk { Compile("print 2; print \"s\"; print 2 + 3; print 2; print \"s\" + \"\"; print \"s\";") };
+
+    ASSERT_FALSE(mErrorReporter.HadErrors());
+    ASSERT_EQ(chunk.mConstants.size(), 3);
+    EXPECT_EQ(chunk.GetConstant(0).AsNumber(), 2);
+    EXPECT_EQ(chunk.GetConstant(1).AsObject(), mHeap.NewString("s"));
+    EXPECT_EQ(chunk.GetConstant(2).AsNumber(), 5);
+}
+
+TEST_F(CompilerTest, InfiniteLoopHasNoExit)
+{
+    Compile("while (true) print 1;");
+
+    EXPECT_EQ(Opcodes(), (std::vector { Opcode::kConstant, Opcode::kPrint, Opcode::kJump, Opcode::kEof }));
+}
+
+}
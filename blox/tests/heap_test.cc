@@ -0,0 +1,174 @@
+#include <ir/heap.h>
+#include <ir/iroot_provider.h>
+#include <ir/ir.h>
+
+#include <gtest/gtest.h>
+#include <string>
+
+namespace bloxTests {
+
+TEST(HeapTest, StringsAreInterned)
+{
+    ir::Heap heap {};
+
+    ir::ObjectString* a { heap.NewString("hello") };
+    ir::ObjectString* b { heap.NewString(std::string("hel") + "lo") };
+    ir::ObjectString* c { heap.NewString("world") };
+
+    EXPECT_EQ(a, b);
+    EXPECT_NE(a, c);
+    EXPECT_EQ(a->mHash, ir::StringTable::Hash("hello"));
+    EXPECT_EQ(heap.Strings().Size(), 2);
+
+    EXPECT_TRUE(ir::Value(a) == ir::Value(b));
+    EXPECT_FALSE(ir::Value(a) == ir::Value(c));
+}
+
+TEST(HeapTest, Concatenate)
+{
+    ir::Heap heap {};
+
+    ir::ObjectString* hello { heap.NewString("hello ") };
+    ir::ObjectString* world { heap.NewString("world") };
+    ir::ObjectString* joined { heap.Concatenate(hello, world) };
+
+    EXPECT_EQ(joined->mString, "hello world");
+    EXPECT_EQ(joined, heap.NewString("hello world"));
+}
+
+TEST(HeapTest, StringTableGrowsAndRemoves)
+{
+    ir::Heap heap {};
+    std::vector<ir::ObjectString*> strings;
+    for (int i { 0 }; i < 1000; i++) {
+        strings.emplace_back(heap.NewString(std::to_string(i)));
+    }
+    EXPECT_EQ(heap.Strings().Size(), 1000);
+
+    for (int i { 0 }; i < 1000; i++) {
+        EXPECT_EQ(heap.NewString(std::to_string(i)), strings[i]);
+    }
+
+    ir::StringTable table {};
+    for (ir::ObjectString* string : strings) {
+        table.Insert(string);
+    }
+    for (int i { 0 }; i < 1000; i += 2) {
+        table.Remove(strings[i]);
+    }
+    EXPECT_EQ(table.Size(), 500);
+    EXPECT_EQ(table.Find("2", ir::StringTable::Hash("2")), nullptr);
+    EXPECT_EQ(table.Find("3", ir::StringTable::Hash("3")), strings[3]);
+}
+
+class FakeRoots final : public ir::IRootProvider {
+public:
+    void MarkRoots(ir::Heap& heap) override
+    {
+        for (ir::Value& value : mValues) {
+            heap.MarkValue(value);
+        }
+    }
+
+    std::vector<ir::Value> mValues;
+};
+
+TEST(HeapTest, CollectFreesUnreachable)
+{
+    ir::Heap heap {};
+    FakeRoots roots {};
+    heap.AddRootProvider(&roots);
+
+    roots.mValues.emplace_back(heap.NewString("kept"));
+    heap.NewString("garbage 1");
+    heap.NewString("garbage 2");
+    ASSERT_EQ(heap.ObjectCount(), 3);
+
+    heap.Collect();
+
+    EXPECT_EQ(heap.ObjectCount(), 1);
+    EXPECT_EQ(heap.Strings().Size(), 1);
+    // Promoted out of the nursery, the root was updated to the new copy
+    EXPECT_EQ(heap.NewString("kept"), roots.mValues[0].AsObject());
+    EXPECT_EQ(heap.Strings().Find("garbage 1", ir::StringTable::Hash("garbage 1")), nullptr);
+
+    heap.RemoveRootProvider(&roots);
+}
+
+TEST(HeapTest, FunctionsKeepConstantsAlive)
+{
+    ir::Heap heap {};
+    FakeRoots roots {};
+    heap.AddRootProvider(&roots);
+
+    ir::ObjectFunction* function { heap.NewFunction("f", ir::ObjectFunction::Type::kFunction, 0) };
+    roots.mValues.emplace_back(function);
+    int index { function->mChunk.AddConstant(heap.NewString("constant")) };
+    heap.WriteBarrier(function, function->mChunk.GetConstant(index));
+    heap.NewString("garbage");
+
+    heap.Collect();
+
+    EXPECT_EQ(heap.ObjectCount(), 2);
+    EXPECT_EQ(function->mChunk.GetConstant(0).AsObject(), heap.NewString("constant"));
+
+    roots.mValues.clear();
+    heap.Collect();
+    EXPECT_EQ(heap.ObjectCount(), 0);
+    EXPECT_EQ(heap.BytesAllocated(), 0);
+
+    heap.RemoveRootProvider(&roots);
+}
+
+TEST(HeapTest, MinorCollectionPromotesSurvivors)
+{
+    ir::Heap heap {};
+    FakeRoots roots {};
+    heap.AddRootProvider(&roots);
+
+    ir::ObjectString* young { heap.NewString("survivor") };
+    roots.mValues.emplace_back(young);
+    EXPECT_TRUE(heap.IsYoung(young));
+    for (int i { 0 }; i < 100; i++) {
+        heap.NewString(std::to_string(i));
+    }
+
+    heap.CollectMinor();
+
+    ir::Object* promoted { roots.mValues[0].AsObject() };
+    EXPECT_NE(promoted, young);
+    EXPECT_FALSE(heap.IsYoung(promoted));
+    EXPECT_EQ(static_cast<ir::ObjectString*>(promoted)->mString, "survivor");
+    EXPECT_EQ(heap.ObjectCount(), 1);
+    EXPECT_EQ(heap.Strings().Size(), 1);
+
+    // New allocations reuse the nursery
+    EXPECT_TRUE(heap.IsYoung(heap.NewString("fresh")));
+
+    heap.RemoveRootProvider(&roots);
+}
+
+TEST(HeapTest, NurseryOverflowRunsMinorCollection)
+{
+    ir::Heap heap { ir::GcOptions { .mNurserySize = 4096 } };
+
+    for (int i { 0 }; i < 10000; i++) {
+        heap.NewString(std::to_string(i));
+    }
+    // Nothing was rooted, so only the current nursery contents are live
+    EXPECT_LE(heap.BytesAllocated(), 4096);
+    EXPECT_LT(heap.ObjectCount(), 4096 / static_cast<int>(sizeof(ir::ObjectString)));
+}
+
+TEST(HeapTest, StressCollectsOnEveryAllocation)
+{
+    ir::Heap heap { ir::GcOptions { .mStress = true } };
+
+    for (int i { 0 }; i < 100; i++) {
+        heap.NewString(std::to_string(i));
+    }
+    // Nothing is rooted, only the last allocation survives
+    EXPECT_EQ(heap.ObjectCount(), 1);
+}
+
+}
@@ -0,0 +1,141 @@
+#include <compiler/peephole.h>
+#include <ir/ir.h>
+
+#include <gtest/gtest.h>
+#include <vector>
+
+namespace bloxTests {
+
+using ir::Opcode;
+
+class PeepholeTest : public testing::Test {
+protected:
+    static uint8_t Byte(Opcode opcode)
+    {
+        return static_cast<uint8_t>(opcode);
+    }
+
+    std::vector<uint8_t> Optimize(const compiler::PeepholeOptions& options = {})
+    {
+        compiler::Peephole(options).Optimize(mChunk);
+        return mChunk.mBytecode;
+    }
+
+    ir::Chunk mChunk;
+};
+
+TEST_F(PeepholeTest, FusesComparisons)
+{
+    mChunk.AddBytes({ Opcode::kTrue, Opcode::kFalse, Opcode::kLess, Opcode::kNot }, 1);
+    mChunk.AddBytes({ Opcode::kTrue, Opcode::kFalse, Opcode::kEqual, Opcode::kNot }, 2);
+    mChunk.AddByte(Opcode::kEof, 3);
+
+    std::vector<uint8_t> expected { Byte(Opcode::kTrue), Byte(Opcode::kFalse), Byte(Opcode::kGreaterEqual),
+        Byte(Opcode::kTrue), Byte(Opcode::kFalse), Byte(Opcode::kNotEqual), Byte(Opcode::kEof) };
+    EXPECT_EQ(Optimize(), expected);
+    EXPECT_EQ(mChunk.GetLine(2), 1);
+    EXPECT_EQ(mChunk.GetLine(5), 2);
+    EXPECT_EQ(mChunk.GetLine(6), 3);
+}
+
+TEST_F(PeepholeTest, FusionsCanBeDisabled)
+{
+    mChunk.AddBytes({ Opcode::kTrue, Opcode::kFalse, Opcode::kLess, Opcode::kNot, Opcode::kEof }, 1);
+    std::vector<uint8_t> original { mChunk.mBytecode };
+
+    EXPECT_EQ(Optimize({ .mGreaterEqual = false }), original);
+}
+
+TEST_F(PeepholeTest, FusesAddLocalConst)
+{
+    uint8_t constant { static_cast<uint8_t>(mChunk.AddConstant(1.0)) };
+    mChunk.AddByte(Opcode::kNil, 1);
+    mChunk.AddBytes({ Byte(Opcode::kLocalGet), 0, Byte(Opcode::kConstant), constant }, 1);
+    mChunk.AddByte(Opcode::kAdd, 2);
+    mChunk.AddByte(Opcode::kEof, 2);
+
+    std::vector<uint8_t> expected { Byte(Opcode::kNil), Byte(Opcode::kAddLocalConst), 0, constant,
+        Byte(Opcode::kEof) };
+    EXPECT_EQ(Optimize(), expected);
+    // The line of the kAdd, which is what can fail at runtime
+    EXPECT_EQ(mChunk.GetLine(1), 2);
+}
+
+TEST_F(PeepholeTest, DoesNotFuseAcrossJumpTargets)
+{
+    // 0: kTrue, 1: kJumpIfTrue -> 5, 4: kLess, 5: kNot, 6: kEof
+    mChunk.AddBytes({ Byte(Opcode::kTrue), Byte(Opcode::kJumpIfTrue), 5, 0 }, 1);
+    mChunk.AddBytes({ Opcode::kLess, Opcode::kNot, Opcode::kEof }, 1);
+    std::vector<uint8_t> original { mChunk.mBytecode };
+
+    EXPECT_EQ(Optimize(), original);
+}
+
+TEST_F(PeepholeTest, JumpIfFalsePopSkipsTargetPop)
+{
+    // 0: kTrue, 1: kJumpIfFalse -> 8, 4: kPop, 5: kJump -> 9, 8: kPop, 9: kEof
+    mChunk.AddBytes({ Byte(Opcode::kTrue), Byte(Opcode::kJumpIfFalse), 8, 0, Byte(Opcode::kPop) }, 1);
+    mChunk.AddBytes({ Byte(Opcode::kJump), 9, 0, Byte(Opcode::kPop), Byte(Opcode::kEof) }, 1);
+
+    // 0: kTrue, 1: kJumpIfFalsePop -> 8, 4: kJump -> 8, 7: kPop, 8: kEof
+    std::vector<uint8_t> expected { Byte(Opcode::kTrue), Byte(Opcode::kJumpIfFalsePop), 8, 0,
+        Byte(Opcode::kJump), 8, 0, Byte(Opcode::kPop), Byte(Opcode::kEof) };
+    EXPECT_EQ(Optimize({ .mThreadJumps = false }), expected);
+}
+
+TEST_F(PeepholeTest, ThreadsJumpChains)
+{
+    // 0: kJump -> 3, 3: kJump -> 6, 6: kJump -> 9, 9: kEof
+    mChunk.AddBytes({ Byte(Opcode::kJump), 3, 0, Byte(Opcode::kJump), 6, 0 }, 1);
+    mChunk.AddBytes({ Byte(Opcode::kJump), 9, 0, Byte(Opcode::kEof) }, 1);
+
+    std::vector<uint8_t> expected { Byte(Opcode::kJump), 9, 0, Byte(Opcode::kJump), 9, 0,
+        Byte(Opcode::kJump), 9, 0, Byte(Opcode::kEof) };
+    EXPECT_EQ(Optimize(), expected);
+}
+
+TEST_F(PeepholeTest, ThreadsConditionalJumps)
+{
+    // 0: kFalse, 1: kJumpIfFalse -> 4, 4: kJumpIfTrue -> 8, 7: kNil, 8: kEof
+    mChunk.AddBytes({ Byte(Opcode::kFalse), Byte(Opcode::kJumpIfFalse), 4, 0 }, 1);
+    mChunk.AddBytes({ Byte(Opcode::kJumpIfTrue), 8, 0, Byte(Opcode::kNil), Byte(Opcode::kEof) }, 1);
+
+    // The condition is known to be false at the kJumpIfTrue, so it falls through
+    EXPECT_EQ(Optimize()[2], 7);
+}
+
+TEST_F(PeepholeTest, ShrinksLongJumps)
+{
+    // 0: kJumpLong -> 5, 5: kEof
+    mChunk.AddBytes({ Byte(Opcode::kJumpLong), 5, 0, 0, 0, Byte(Opcode::kEof) }, 1);
+
+    std::vector<uint8_t> expected { Byte(Opcode::kJump), 3, 0, Byte(Opcode::kEof) };
+    EXPECT_EQ(Optimize(compiler::PeepholeOptions::None()), expected);
+}
+
+TEST_F(PeepholeTest, KeepsJumpsPastSixtyFourKiBLong)
+{
+    // 0: kJumpIfFalseLong -> 5 + kCount, 5: kCount x kNil, kEof
+    constexpr int kCount { 0x10000 };
+    int target { 5 + kCount };
+    mChunk.AddBytes({ Byte(Opcode::kJumpIfFalseLong), static_cast<uint8_t>(target),
+                        static_cast<uint8_t>(target >> 8), static_cast<uint8_t>(target >> 16), 0 },
+        1);
+    for (int i { 0 }; i < kCount; i++) {
+        mChunk.AddByte(Opcode::kNil, 1);
+    }
+    mChunk.AddByte(Opcode::kEof, 1);
+    std::vector<uint8_t> original { mChunk.mBytecode };
+
+    EXPECT_EQ(Optimize(), original);
+}
+
+TEST_F(PeepholeTest, LeavesBogusJumpsAlone)
+{
+    mChunk.AddBytes({ Byte(Opcode::kJump), 0xFF, 0xFF, Byte(Opcode::kEof) }, 1);
+    std::vector<uint8_t> original { mChunk.mBytecode };
+
+    EXPECT_EQ(Optimize(), original);
+}
+
+}
@@ -0,0 +1,159 @@
+#include <compiler/compiler.h>
+#include <driver/driver.h>
+#include <driver/error_reporter.h>
+#include <ir/ir.h>
+#include <regvm/translator.h>
+#include <regvm/vm.h>
+#include <vm/vm.h>
+
+#include <gtest/gtest.h>
+#include <spdlog/spdlog.h>
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace bloxTests {
+
+using regvm::Opcode;
+
+// Runs programs on both backends, they must print the same and fail the same
+class RegvmTest : public testing::Test {
+protected:
+    void SetUp() override
+    {
+        spdlog::set_level(spdlog::level::off);
+    }
+
+    std::string Run(std::string_view source, driver::Options::Backend backend)
+    {
+        std::ostringstream out;
+        std::streambuf* old { std::cout.rdbuf(out.rdbuf()) };
+
+        driver::Driver driver { ir::GcOptions { .mStress = true }, {}, { .mBackend = backend } };
+        mSucceeded = driver.Run(source);
+
+        std::cout.rdbuf(old);
+        return out.str();
+    }
+
+    void ExpectSameOnBoth(std::string_view source)
+    {
+        std::string stack { Run(source, driver::Options::Backend::kStack) };
+        bool stackSucceeded { mSucceeded };
+        EXPECT_EQ(Run(source, driver::Options::Backend::kRegister), stack) << source;
+        EXPECT_EQ(mSucceeded, stackSucceeded) << source;
+    }
+
+    // The opcodes of the function called name, or of main
+    std::vector<Opcode> Translate(std::string_view source, std::string_view name = "main")
+    {
+        compiler::Compiler compiler(source, &mHeap, &mGlobals, &mErrorReporter);
+        ir::ObjectFunction* function { compiler.Compile() };
+        for (const ir::Value& constant : function->mChunk.mConstants) {
+            if (constant.GetType() == ir::Value::Type::kFunction
+                && static_cast<ir::ObjectFunction*>(constant.AsObject())->mName == name) {
+                function = static_cast<ir::ObjectFunction*>(constant.AsObject());
+            }
+        }
+
+        std::unique_ptr<regvm::Function> translated { regvm::Translator(mGlobals.Size()).Translate(function) };
+        std::vector<Opcode> opcodes;
+        for (const regvm::Instruction& instruction : translated->mCode) {
+            opcodes.emplace_back(instruction.mOpcode);
+        }
+        return opcodes;
+    }
+
+    bool mSucceeded { false };
+    driver::ErrorReporter mErrorReporter {};
+    ir::Heap mHeap {};
+    ir::GlobalTable mGlobals {};
+};
+
+TEST_F(RegvmTest, SameOutputAsStackVm)
+{
+    ExpectSameOnBoth("print 1 + 2 * 3 - 4 / 2; print !(1 < 2) == false; print -(3 >= 3);");
+    ExpectSameOnBoth("var a = \"a\"; var b = a + \"b\"; { var c = b + b; print c + a; }");
+    ExpectSameOnBoth(R"(
+        var total = 0;
+        for (var i = 0; i < 10; i = i + 1) {
+            var j = i;
+            while (j > 0) { total = total + j; j = j - 1; }
+        }
+        print total;
+        { var x = 1; var y = x; x = 5; print y; print x; }
+        print nil or "right"; print false and 1; print 1 != 2;
+    )");
+    ExpectSameOnBoth(R"(
+        fun fib(n) {
+            if (n < 2) return n;
+            return fib(n - 1) + fib(n - 2);
+        }
+        fun noReturn() { }
+        print fib(15);
+        print noReturn();
+    )");
+}
+
+TEST_F(RegvmTest, SameErrorsAsStackVm)
+{
+    ExpectSameOnBoth("print 1; print 1 + nil;");
+    ExpectSameOnBoth("print \"a\" + 1;");
+    ExpectSameOnBoth("print 1 / 0;");
+    ExpectSameOnBoth("print -\"a\";");
+    ExpectSameOnBoth("print missing;");
+    ExpectSameOnBoth("fun f(a) { return a; } print f(1, 2);");
+    ExpectSameOnBoth("var x = 1; x();");
+    ExpectSameOnBoth("fun f() { return f(); } f();");
+}
+
+TEST_F(RegvmTest, OperandsComeStraightFromLocalsAndConstants)
+{
+    // The implicit return nil after the return is never reached, so not translated
+    EXPECT_EQ(Translate("fun f(a, b) { return a + b; }", "f"), (std::vector { Opcode::kAdd, Opcode::kReturn }));
+    // The assignment writes the local directly
+    EXPECT_EQ(Translate("fun f(x) { x = x * 2; return x; }", "f"), (std::vector { Opcode::kMultiply, Opcode::kReturn }));
+    // A copy taken before an assignment keeps the old value
+    EXPECT_EQ(Translate("fun f(x) { var y = x; x = 1; return y; }", "f"),
+        (std::vector { Opcode::kMove, Opcode::kMove, Opcode::kReturn }));
+    // Literals are operands, the nil of an empty function included
+    EXPECT_EQ(Translate("fun f() { }", "f"), (std::vector { Opcode::kReturn }));
+}
+
+TEST_F(RegvmTest, ExecutesFewerInstructions)
+{
+    std::string source { R"(
+        fun f(n) {
+            var sum = 0;
+            for (var i = 0; i < n; i = i + 1) { sum = sum + i * i; }
+            return sum;
+        }
+        print f(100);
+    )" };
+    compiler::Compiler compiler(source, &mHeap, &mGlobals, &mErrorReporter);
+    ir::ObjectFunction* main { compiler.Compile() };
+
+    // Both print their profile to stderr
+    std::ostringstream out;
+    std::streambuf* old { std::cout.rdbuf(out.rdbuf()) };
+    std::streambuf* oldErr { std::cerr.rdbuf(out.rdbuf()) };
+    vm::Vm stackVm(main, &mHeap, &mGlobals, &mErrorReporter, { .mProfileOps = true });
+    stackVm.Run();
+    regvm::Vm registerVm(main, &mHeap, &mGlobals, &mErrorReporter, { .mProfileOps = true });
+    registerVm.Run();
+    std::cerr.rdbuf(oldErr);
+    std::cout.rdbuf(old);
+
+    uint64_t stackCount { 0 };
+    for (int i { 0 }; i < ir::kOpcodeCount; i++) {
+        stackCount += stackVm.GetProfiler()->Count(static_cast<ir::Opcode>(i));
+    }
+    // The loop body is 7 register instructions against 15 stack ones
+    EXPECT_GT(registerVm.InstructionCount(), 0);
+    EXPECT_LT(registerVm.InstructionCount() * 2, stackCount);
+}
+
+}
@@ -0,0 +1,176 @@
+#include <compiler/scanner.h>
+#include <compiler/source.h>
+#include <compiler/token.h>
+#include <driver/error_reporter.h>
+
+#include <gtest/gtest.h>
+#include <spdlog/spdlog.h>
+
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace bloxTests {
+
+using compiler::Token;
+
+// The scanner skips whitespace, identifiers and string bodies 16 bytes at a
+// time where it can, so most inputs here are sized to cross that boundary
+class ScannerTest : public testing::Test {
+protected:
+    void SetUp() override
+    {
+        spdlog::set_level(spdlog::level::off);
+    }
+
+    // The lexemes point into mSource, they are valid until the next Scan()
+    std::vector<Token> Scan(std::string_view source)
+    {
+        mSource = source;
+        mScanner = std::make_unique<compiler::Scanner>(mSource, &mErrorReporter);
+        std::vector<Token> tokens;
+        for (Token token { mScanner->ScanToken() }; token.mType != Token::Type::kEof; token = mScanner->ScanToken()) {
+            tokens.emplace_back(token);
+        }
+        return tokens;
+    }
+
+    // Scans source from a file through a StreamSource with a tiny buffer and
+    // checks each token against scanning it from memory. Every lexeme is
+    // checked after the next token was peeked, it has to survive that.
+    void ExpectSameAsStreamed(const std::string& source)
+    {
+        std::string path { std::filesystem::temp_directory_path() / "scanner_test_stream.lox" };
+        std::ofstream { path } << source;
+        int fd { open(path.c_str(), O_RDONLY) };
+        ASSERT_NE(fd, -1);
+
+        compiler::Scanner streamed(std::make_unique<compiler::StreamSource>(fd, 8), &mErrorReporter);
+        compiler::Scanner scanned(source, &mErrorReporter);
+        for (;;) {
+            Token expected { scanned.ScanToken() };
+            Token token { streamed.ScanToken() };
+            streamed.PeekToken();
+            EXPECT_EQ(token.mType, expected.mType);
+            EXPECT_EQ(token.mLexeme, expected.mLexeme);
+            EXPECT_EQ(token.mLine, expected.mLine);
+            if (expected.mType == Token::Type::kEof || token.mType == Token::Type::kEof) {
+                break;
+            }
+        }
+        close(fd);
+        std::filesystem::remove(path);
+    }
+
+    driver::ErrorReporter mErrorReporter;
+    std::string mSource;
+    std::unique_ptr<compiler::Scanner> mScanner;
+};
+
+TEST_F(ScannerTest, Keywords)
+{
+    std::string_view source { "and class else false for fun if nil or print return super this true var while" };
+    std::vector<Token::Type> expected { Token::Type::kAnd, Token::Type::kClass, Token::Type::kElse,
+        Token::Type::kFalse, Token::Type::kFor, Token::Type::kFun, Token::Type::kIf, Token::Type::kNil,
+        Token::Type::kOr, Token::Type::kPrint, Token::Type::kReturn, Token::Type::kSuper, Token::Type::kThis,
+        Token::Type::kTrue, Token::Type::kVar, Token::Type::kWhile };
+
+    std::vector<Token::Type> types;
+    for (const Token& token : Scan(source)) {
+        types.emplace_back(token.mType);
+    }
+    EXPECT_EQ(types, expected);
+
+    // Prefixes and extensions of keywords are plain identifiers
+    for (const Token& token : Scan("a an andy f fa fo fore fu t th tr thiss _if If whil")) {
+        EXPECT_EQ(token.mType, Token::Type::kIdentifier) << token;
+    }
+}
+
+TEST_F(ScannerTest, LongIdentifiers)
+{
+    for (int length : { 15, 16, 17, 31, 32, 33, 100 }) {
+        std::string name(length, 'a');
+        name[length - 1] = '9';
+        name[length / 2] = '_';
+        name[1] = 'Z';
+        std::vector<Token> tokens { Scan(name + "+" + name) };
+        ASSERT_EQ(tokens.size(), 3) << length;
+        EXPECT_EQ(tokens[0].mLexeme, name);
+        EXPECT_EQ(tokens[1].mType, Token::Type::kPlus);
+        EXPECT_EQ(tokens[2].mLexeme, name);
+    }
+}
+
+TEST_F(ScannerTest, WhitespaceCountsLines)
+{
+    std::string source { "a" };
+    source += std::string(20, ' ') + "\n\t\r\n" + std::string(40, '\n') + "  b";
+    source += std::string(17, '\n') + "c // comment\n// another\n\nd";
+
+    std::vector<Token> tokens { Scan(source) };
+    ASSERT_EQ(tokens.size(), 4);
+    EXPECT_EQ(tokens[0].mLine, 1);
+    EXPECT_EQ(tokens[1].mLine, 43);
+    EXPECT_EQ(tokens[2].mLine, 60);
+    EXPECT_EQ(tokens[3].mLine, 63);
+    EXPECT_EQ(tokens[3].mLexeme, "d");
+}
+
+TEST_F(ScannerTest, Strings)
+{
+    std::string body { std::string(20, 'x') + "\n" + std::string(16, 'y') + "\n\n" };
+    std::vector<Token> tokens { Scan("\"\" \"" + body + "\" z") };
+    ASSERT_EQ(tokens.size(), 3);
+    EXPECT_EQ(tokens[0].mLexeme, "\"\"");
+    EXPECT_EQ(tokens[1].mLexeme, "\"" + body + "\"");
+    EXPECT_EQ(tokens[1].mLine, 4); // strings take the line they end on
+    EXPECT_EQ(tokens[2].mLine, 4);
+    EXPECT_FALSE(mErrorReporter.HadErrors());
+
+    tokens = Scan("\"" + std::string(40, 's'));
+    ASSERT_EQ(tokens.size(), 1);
+    EXPECT_EQ(tokens[0].mType, Token::Type::kError);
+    EXPECT_TRUE(mErrorReporter.HadErrors());
+}
+
+TEST_F(ScannerTest, CommentAtEnd)
+{
+    std::vector<Token> tokens { Scan("1 // no newline after this") };
+    ASSERT_EQ(tokens.size(), 1);
+    EXPECT_EQ(tokens[0].mType, Token::Type::kNumber);
+}
+
+TEST_F(ScannerTest, NonAsciiIsAnError)
+{
+    std::vector<Token> tokens { Scan("abc\xc3\xa9") };
+    ASSERT_EQ(tokens.size(), 3);
+    EXPECT_EQ(tokens[0].mLexeme, "abc");
+    EXPECT_EQ(tokens[1].mType, Token::Type::kError);
+    EXPECT_TRUE(mErrorReporter.HadErrors());
+}
+
+TEST_F(ScannerTest, Streamed)
+{
+    ExpectSameAsStreamed("");
+    ExpectSameAsStreamed("print 1;");
+    ExpectSameAsStreamed("var a = 1;\n\n\n// only a comment\n\n{ var b = a + 2; print b; }\n");
+
+    // Lines and a string literal much longer than the buffer, a string that
+    // spans several windows, and no newline at the very end
+    std::string source { "var " + std::string(100, 'x') + " = \"" + std::string(50, 's') + "\";\n" };
+    source += "print \"one\ntwo\n\nthree " + std::string(30, 't') + "\";\n";
+    for (int i { 0 }; i < 50; i++) {
+        source += "fun f" + std::to_string(i) + "(a, b) { return a >= b and !nil; }\n";
+    }
+    source += "print \"unterminated";
+    ExpectSameAsStreamed(source);
+}
+
+}
@@ -0,0 +1,80 @@
+#include <ir/heap.h>
+#include <ir/ir.h>
+
+#include <gtest/gtest.h>
+#include <cmath>
+#include <limits>
+
+namespace bloxTests {
+
+using Type = ir::Value::Type;
+
+TEST(ValueTest, Layout)
+{
+#ifdef BLOX_NAN_BOXING
+    EXPECT_EQ(sizeof(ir::Value), 8);
+#else
+    EXPECT_EQ(sizeof(ir::Value), 16);
+#endif
+}
+
+TEST(ValueTest, Singletons)
+{
+    EXPECT_EQ(ir::Value().GetType(), Type::kNil);
+    EXPECT_EQ(ir::Value::Undefined().GetType(), Type::kUndefined);
+    EXPECT_EQ(ir::Value(true).GetType(), Type::kBool);
+    EXPECT_EQ(ir::Value(false).GetType(), Type::kBool);
+    EXPECT_TRUE(ir::Value(true).AsBool());
+    EXPECT_FALSE(ir::Value(false).AsBool());
+
+    EXPECT_FALSE(ir::Value().IsNumber());
+    EXPECT_FALSE(ir::Value(true).IsObject());
+    EXPECT_TRUE(ir::Value() == ir::Value());
+    EXPECT_FALSE(ir::Value(true) == ir::Value(false));
+    EXPECT_FALSE(ir::Value() == ir::Value(false));
+}
+
+TEST(ValueTest, Numbers)
+{
+    const double kNumbers[] { 0.0, -0.0, 1.5, -1e308, std::numeric_limits<double>::infinity(),
+        -std::numeric_limits<double>::infinity(), std::numeric_limits<double>::denorm_min() };
+    for (double number : kNumbers) {
+        ir::Value value { number };
+        EXPECT_EQ(value.GetType(), Type::kNumber);
+        EXPECT_TRUE(value.IsNumber());
+        EXPECT_FALSE(value.IsObject());
+        EXPECT_EQ(value.AsNumber(), number);
+    }
+
+    // Arithmetic NaNs must not be mistaken for boxed values
+    ir::Value nan { std::numeric_limits<double>::quiet_NaN() };
+    ir::Value computed { ir::Value(0.0).AsNumber() / ir::Value(0.0).AsNumber() };
+    EXPECT_TRUE(nan.IsNumber());
+    EXPECT_TRUE(computed.IsNumber());
+    EXPECT_TRUE(std::isnan(computed.AsNumber()));
+    EXPECT_FALSE(nan == nan);
+    EXPECT_TRUE(ir::Value(0.0) == ir::Value(-0.0));
+}
+
+TEST(ValueTest, Objects)
+{
+    ir::Heap heap {};
+    ir::ObjectString* string { heap.NewString("string") };
+    ir::ObjectFunction* function { heap.NewFunction("f", ir::ObjectFunction::Type::kFunction, 0) };
+
+    ir::Value stringValue { string };
+    ir::Value functionValue { function };
+    EXPECT_EQ(stringValue.GetType(), Type::kString);
+    EXPECT_EQ(functionValue.GetType(), Type::kFunction);
+    EXPECT_TRUE(stringValue.IsObject());
+    EXPECT_FALSE(stringValue.IsNumber());
+    EXPECT_EQ(stringValue.AsObject(), string);
+    EXPECT_EQ(functionValue.AsObject(), function);
+    EXPECT_EQ(stringValue.ToString(), "string= string");
+
+    stringValue.SetObject(heap.NewString("other"));
+    EXPECT_EQ(stringValue.GetType(), Type::kString);
+    EXPECT_TRUE(stringValue == ir::Value(heap.NewString("other")));
+}
+
+}
@@ -0,0 +1,117 @@
+#include <ir/ir.h>
+#include <ir/verifier.h>
+
+#include <gtest/gtest.h>
+#include <initializer_list>
+
+namespace bloxTests {
+
+using ir::Opcode;
+
+class VerifierTest : public testing::Test {
+protected:
+    static uint8_t Byte(Opcode opcode)
+    {
+        return static_cast<uint8_t>(opcode);
+    }
+
+    ir::ObjectFunction* Function(std::initializer_list<uint8_t> code, int arity = 0)
+    {
+        ir::ObjectFunction* function { mHeap.NewFunction("f", ir::ObjectFunction::Type::kFunction, arity) };
+        function->mChunk.AddBytes(code, 1);
+        return function;
+    }
+
+    ir::ObjectFunction* Main(std::initializer_list<uint8_t> code)
+    {
+        ir::ObjectFunction* main { mHeap.NewFunction("main", ir::ObjectFunction::Type::kMain, 0) };
+        main->mChunk.AddBytes(code, 1);
+        return main;
+    }
+
+    bool Verify(ir::ObjectFunction* function, int globalCount = 0)
+    {
+        return ir::Verifier(globalCount).Verify(function);
+    }
+
+    ir::Heap mHeap;
+};
+
+TEST_F(VerifierTest, ComputesMaxStackDepth)
+{
+    // Slot 0 holds main itself
+    ir::ObjectFunction* main { Main({ Byte(Opcode::kNil), Byte(Opcode::kNil), Byte(Opcode::kNil),
+        Byte(Opcode::kAdd), Byte(Opcode::kAdd), Byte(Opcode::kPrint), Byte(Opcode::kEof) }) };
+    ASSERT_TRUE(Verify(main));
+    EXPECT_EQ(main->mMaxStackDepth, 4);
+
+    // The arguments count too, and kAddLocalConst may need one more slot for a while
+    ir::ObjectFunction* function { Function({ Byte(Opcode::kAddLocalConst), 2, 0, Byte(Opcode::kReturn) }, 2) };
+    function->mChunk.AddConstant(1.0);
+    ASSERT_TRUE(Verify(function));
+    EXPECT_EQ(function->mMaxStackDepth, 5);
+}
+
+TEST_F(VerifierTest, FollowsBothSidesOfJumps)
+{
+    // if (true) nil; else { nil; nil; pop; } with the condition popped on both paths
+    ir::ObjectFunction* main { Main({ Byte(Opcode::kTrue), Byte(Opcode::kJumpIfFalsePop), 8, 0,
+        Byte(Opcode::kNil), Byte(Opcode::kJump), 11, 0,
+        Byte(Opcode::kNil), Byte(Opcode::kNil), Byte(Opcode::kPop),
+        Byte(Opcode::kPop), Byte(Opcode::kEof) }) };
+    ASSERT_TRUE(Verify(main));
+    EXPECT_EQ(main->mMaxStackDepth, 3);
+}
+
+TEST_F(VerifierTest, RejectsBadControlFlow)
+{
+    // Into the operand of kConstant
+    ir::ObjectFunction* main { Main({ Byte(Opcode::kConstant), 0, Byte(Opcode::kJump), 1, 0 }) };
+    main->mChunk.AddConstant(1.0);
+    EXPECT_FALSE(Verify(main));
+
+    // Off the end
+    EXPECT_FALSE(Verify(Main({ Byte(Opcode::kNil), Byte(Opcode::kPop) })));
+    EXPECT_FALSE(Verify(Main({ Byte(Opcode::kJump), 3, 0 })));
+    // Operands cut short
+    EXPECT_FALSE(Verify(Main({ Byte(Opcode::kEof), Byte(Opcode::kJump), 0 })));
+    // Not an opcode
+    EXPECT_FALSE(Verify(Main({ 0xFE, Byte(Opcode::kEof) })));
+    // Main cannot return, a function cannot end the program
+    EXPECT_FALSE(Verify(Main({ Byte(Opcode::kNil), Byte(Opcode::kReturn) })));
+    EXPECT_FALSE(Verify(Function({ Byte(Opcode::kEof) })));
+}
+
+TEST_F(VerifierTest, RejectsBadStackDepths)
+{
+    // kAdd with only main's slot on the stack
+    EXPECT_FALSE(Verify(Main({ Byte(Opcode::kNil), Byte(Opcode::kAdd), Byte(Opcode::kAdd), Byte(Opcode::kEof) })));
+
+    // One path reaches kEof with an extra value
+    EXPECT_FALSE(Verify(Main({ Byte(Opcode::kTrue), Byte(Opcode::kJumpIfFalsePop), 5, 0,
+        Byte(Opcode::kNil), Byte(Opcode::kEof) })));
+
+    ir::ObjectFunction* call { Main({ Byte(Opcode::kNil), Byte(Opcode::kCall), 1, Byte(Opcode::kEof) }) };
+    EXPECT_TRUE(Verify(call));
+    call->mChunk.mBytecode[2] = 2;
+    EXPECT_FALSE(Verify(call));
+}
+
+TEST_F(VerifierTest, RejectsOperandsOutOfRange)
+{
+    ir::ObjectFunction* constant { Main({ Byte(Opcode::kConstant), 0, Byte(Opcode::kPop), Byte(Opcode::kEof) }) };
+    EXPECT_FALSE(Verify(constant));
+    constant->mChunk.AddConstant(1.0);
+    EXPECT_TRUE(Verify(constant));
+
+    ir::ObjectFunction* global { Main({ Byte(Opcode::kGlobalGet), 3, 0, Byte(Opcode::kPop), Byte(Opcode::kEof) }) };
+    EXPECT_FALSE(Verify(global, 3));
+    EXPECT_TRUE(Verify(global, 4));
+
+    // Slots 0..arity exist on entry, nothing above them
+    EXPECT_TRUE(Verify(Function({ Byte(Opcode::kLocalGet), 1, Byte(Opcode::kReturn) }, 1)));
+    EXPECT_FALSE(Verify(Function({ Byte(Opcode::kLocalGet), 2, Byte(Opcode::kReturn) }, 1)));
+    EXPECT_FALSE(Verify(Function({ Byte(Opcode::kLocalGetLong), 0, 1, Byte(Opcode::kReturn) }, 1)));
+}
+
+}
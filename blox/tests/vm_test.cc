@@ -0,0 +1,378 @@
+#include <compiler/compiler.h>
+#include <compiler/source.h>
+#include <driver/driver.h>
+#include <driver/error_reporter.h>
+#include <ir/ir.h>
+#include <vm/vm.h>
+
+#include <fmt/format.h>
+#include <gtest/gtest.h>
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <string_view>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace bloxTests {
+
+// Runs whole programs through the driver, with the GC collecting on every
+// allocation, and checks what they print
+class VmTest : public testing::Test {
+protected:
+    void SetUp() override
+    {
+        spdlog::set_level(spdlog::level::off);
+    }
+
+    std::string Run(std::string_view source)
+    {
+        std::ostringstream out;
+        std::streambuf* old { std::cout.rdbuf(out.rdbuf()) };
+
+        driver::Driver driver { ir::GcOptions { .mStress = true } };
+        mSucceeded = driver.Run(source);
+
+        std::cout.rdbuf(old);
+        return out.str();
+    }
+
+    bool mSucceeded { false };
+};
+
+TEST_F(VmTest, Arithmetic)
+{
+    EXPECT_EQ(Run("print 1 + 2 * 3 - 4 / 2;"), "number= 5\n");
+    EXPECT_TRUE(mSucceeded);
+    EXPECT_EQ(Run("print !(1 < 2) == false;"), "boolean= true\n");
+}
+
+TEST_F(VmTest, GlobalsAndLocals)
+{
+    std::string source { R"(
+        var total = 0;
+        for (var i = 0; i < 10; i = i + 1) {
+            var doubled = i * 2;
+            total = total + doubled;
+        }
+        print total;
+    )" };
+    EXPECT_EQ(Run(source), "number= 90\n");
+    EXPECT_TRUE(mSucceeded);
+}
+
+TEST_F(VmTest, StringsSurviveCollections)
+{
+    std::string source { R"(
+        var s = "";
+        for (var i = 0; i < 50; i = i + 1) {
+            s = s + "ab";
+        }
+        print s == "abababababababababababababababababababababababababababababababababababababababababababababababababab";
+        var t = "x" + "y";
+        print t;
+    )" };
+    EXPECT_EQ(Run(source), "boolean= true\nstring= xy\n");
+    EXPECT_TRUE(mSucceeded);
+}
+
+TEST_F(VmTest, Superinstructions)
+{
+    std::string source { R"(
+        print 2 >= 2;
+        print 1 >= 2;
+        print 3 <= 2;
+        print 1 != 2;
+        print "a" != "a";
+        {
+            var n = 1;
+            var s = "a";
+            print n + 2;
+            print s + "b";
+        }
+        var count = 0;
+        var i = 0;
+        while (i <= 5) {
+            if (i != 3) count = count + 1;
+            i = i + 1;
+        }
+        print count;
+    )" };
+    EXPECT_EQ(Run(source),
+        "boolean= true\nboolean= false\nboolean= false\nboolean= true\nboolean= false\n"
+        "number= 3\nstring= ab\nnumber= 5\n");
+    EXPECT_TRUE(mSucceeded);
+}
+
+TEST_F(VmTest, AddLocalConstTypeError)
+{
+    EXPECT_EQ(Run("{ var b = true; print b + 1; }"), "");
+    EXPECT_FALSE(mSucceeded);
+}
+
+TEST_F(VmTest, ConstantFolding)
+{
+    std::string source { R"(
+        var seconds = 60 * 60 * 24;
+        if (seconds > 1000) print "long"; else print "short";
+        if (!nil) print "a" + "b";
+        while (false) print 1;
+        print 1 / 0;
+    )" };
+    EXPECT_EQ(Run(source), "string= long\nstring= ab\n");
+    EXPECT_FALSE(mSucceeded);
+}
+
+TEST_F(VmTest, LargePrograms)
+{
+    // More locals and constants than fit a byte, and a branch over more than 64 KiB
+    std::string source { "{ var sum = 0;" };
+    for (int i { 0 }; i < 300; i++) {
+        source += fmt::format(" var v{} = {};", i, i + 0.5);
+    }
+    source += " if (sum == 0) {";
+    for (int i { 0 }; i < 300; i++) {
+        source += fmt::format(" sum = sum + v{};", i);
+    }
+    for (int i { 0 }; i < 5000; i++) {
+        source += " sum = sum + 0 * v1;";
+    }
+    source += " } print sum; }";
+
+    EXPECT_EQ(Run(source), "number= 45000\n");
+    EXPECT_TRUE(mSucceeded);
+}
+
+TEST_F(VmTest, Functions)
+{
+    std::string source { R"(
+        fun add(a, b) { return a + b; }
+        fun greet(name) { print "hi " + name; }
+        print add(1, 2);
+        print greet("bob");
+        {
+            var base = 10;
+            fun twice(x) { var y = x * 2; return y; }
+            print base + twice(add(base, 1));
+        }
+    )" };
+    EXPECT_EQ(Run(source), "number= 3\nstring= hi bob\nnil\nnumber= 32\n");
+    EXPECT_TRUE(mSucceeded);
+}
+
+TEST_F(VmTest, Recursion)
+{
+    std::string source { R"(
+        fun fib(n) {
+            if (n < 2) return n;
+            return fib(n - 1) + fib(n - 2);
+        }
+        print fib(15);
+    )" };
+    EXPECT_EQ(Run(source), "number= 610\n");
+    EXPECT_TRUE(mSucceeded);
+}
+
+TEST_F(VmTest, CallErrors)
+{
+    EXPECT_EQ(Run("fun f(a) { return a; } print f(1, 2);"), "");
+    EXPECT_FALSE(mSucceeded);
+    EXPECT_EQ(Run("var x = 1; x();"), "");
+    EXPECT_FALSE(mSucceeded);
+    EXPECT_EQ(Run("fun f() { return f(); } f();"), "");
+    EXPECT_FALSE(mSucceeded);
+    EXPECT_EQ(Run("return 1;"), "");
+    EXPECT_FALSE(mSucceeded);
+}
+
+TEST_F(VmTest, StackOverflow)
+{
+    // Each call of f starts its frame two slots further up, the value stack
+    // runs out long before the call stack
+    driver::Driver driver { {}, { .mMaxStackDepth = 32 } };
+    EXPECT_TRUE(driver.Run("fun f(n) { if (n > 0) return f(n - 1); return n; } f(5);"));
+    EXPECT_FALSE(driver.Run("fun f(n) { if (n > 0) return f(n - 1); return n; } f(20);"));
+
+    driver::Driver tiny { {}, { .mMaxStackDepth = 2 } };
+    EXPECT_FALSE(tiny.Run("var a = 1; var b = a + a;"));
+}
+
+TEST_F(VmTest, QuickeningFallsBackOnOtherTypes)
+{
+    // The same kAdd sees numbers, then strings, then numbers again
+    std::string source { R"(
+        fun add(a, b) { return a + b; }
+        fun less(a, b) { return a < b; }
+        print add(1, 2);
+        print add("a", "b");
+        print add(3, 4);
+        print less(1, 2);
+        print less(1, "x");
+    )" };
+    EXPECT_EQ(Run(source), "number= 3\nstring= ab\nnumber= 7\nboolean= true\n");
+    EXPECT_FALSE(mSucceeded);
+
+    EXPECT_EQ(Run("fun f(a, b) { return a / b; } print f(1, 2); print f(1, 0);"), "number= 0.5\n");
+    EXPECT_FALSE(mSucceeded);
+}
+
+TEST_F(VmTest, QuickeningRewritesBytecode)
+{
+    driver::ErrorReporter errorReporter {};
+    ir::Heap heap {};
+    ir::GlobalTable globals {};
+    compiler::Compiler compiler("var x = 0; while (x < 10) x = x * 1 + 1; var s = \"a\" + \"b\"; print s;",
+        &heap, &globals, &errorReporter);
+    ir::ObjectFunction* main { compiler.Compile() };
+
+    auto contains { [&](ir::Opcode opcode) {
+        const std::vector<uint8_t>& code { main->mChunk.mBytecode };
+        return std::find(code.begin(), code.end(), static_cast<uint8_t>(opcode)) != code.end();
+    } };
+    ASSERT_TRUE(contains(ir::Opcode::kLess));
+    EXPECT_FALSE(contains(ir::Opcode::kLessNumber));
+
+    std::ostringstream out;
+    std::streambuf* old { std::cout.rdbuf(out.rdbuf()) };
+    vm::Vm(main, &heap, &globals, &errorReporter).Run();
+    std::cout.rdbuf(old);
+    EXPECT_EQ(out.str(), "string= ab\n");
+
+    EXPECT_TRUE(contains(ir::Opcode::kLessNumber));
+    EXPECT_TRUE(contains(ir::Opcode::kMultiplyNumber));
+    EXPECT_TRUE(contains(ir::Opcode::kAddNumber));
+    EXPECT_FALSE(contains(ir::Opcode::kLess));
+}
+
+TEST_F(VmTest, ProfileOps)
+{
+    driver::ErrorReporter errorReporter {};
+    ir::Heap heap {};
+    ir::GlobalTable globals {};
+    compiler::Compiler compiler("fun f(x) { return x; } for (var i = 0; i < 10; i = i + 1) f(i);",
+        &heap, &globals, &errorReporter);
+    ir::ObjectFunction* main { compiler.Compile() };
+
+    std::ostringstream err;
+    std::streambuf* old { std::cerr.rdbuf(err.rdbuf()) };
+    vm::Vm vm(main, &heap, &globals, &errorReporter, { .mProfileOps = true });
+    vm.Run();
+    std::cerr.rdbuf(old);
+
+    const vm::OpcodeProfiler* profiler { vm.GetProfiler() };
+    ASSERT_NE(profiler, nullptr);
+    EXPECT_EQ(profiler->Count(ir::Opcode::kCall), 10);
+    EXPECT_EQ(profiler->Count(ir::Opcode::kReturn), 10);
+    EXPECT_EQ(profiler->Count(ir::Opcode::kEof), 1);
+    // The first comparison runs generic, the other ten quickened
+    EXPECT_EQ(profiler->Count(ir::Opcode::kLess), 1);
+    EXPECT_EQ(profiler->Count(ir::Opcode::kLessNumber), 10);
+    EXPECT_EQ(profiler->PairCount(ir::Opcode::kCall, ir::Opcode::kLocalGet), 10);
+    EXPECT_NE(err.str().find("kCall kLocalGet"), std::string::npos);
+}
+
+TEST_F(VmTest, SampleProfile)
+{
+    std::string path { std::filesystem::temp_directory_path() / "vm_test_sample_profile.folded" };
+    driver::ErrorReporter errorReporter {};
+    ir::Heap heap {};
+    ir::GlobalTable globals {};
+    compiler::Compiler compiler(R"(
+        fun spin(n) {
+            var sum = 0;
+            for (var i = 0; i < n; i = i + 1) sum = sum + i;
+            return sum;
+        }
+        var total = 0;
+        for (var i = 0; i < 40; i = i + 1) total = total + spin(20000);
+    )",
+        &heap, &globals, &errorReporter);
+    ir::ObjectFunction* main { compiler.Compile() };
+
+    vm::Vm(main, &heap, &globals, &errorReporter, { .mSampleProfilePath = path, .mSampleIntervalUs = 200 }).Run();
+    EXPECT_FALSE(errorReporter.HadErrors());
+
+    std::ifstream file { path };
+    std::string folded { std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>() };
+    std::filesystem::remove(path);
+
+    // Every stack starts at main, and the loop in spin is where the time goes
+    // (line numbers count the raw string's leading newline)
+    ASSERT_FALSE(folded.empty());
+    EXPECT_TRUE(folded.starts_with("main:"));
+    EXPECT_NE(folded.find("main:8;spin:4 "), std::string::npos);
+}
+
+TEST_F(VmTest, Trace)
+{
+    driver::ErrorReporter errorReporter {};
+    ir::Heap heap {};
+    ir::GlobalTable globals {};
+    compiler::Compiler compiler("fun f(x) { return x; } print f(4);", &heap, &globals, &errorReporter);
+    ir::ObjectFunction* main { compiler.Compile() };
+
+    std::ostringstream out;
+    std::ostringstream err;
+    std::streambuf* oldOut { std::cout.rdbuf(out.rdbuf()) };
+    std::streambuf* oldErr { std::cerr.rdbuf(err.rdbuf()) };
+    vm::Vm(main, &heap, &globals, &errorReporter, { .mTrace = true }).Run();
+    std::cout.rdbuf(oldOut);
+    std::cerr.rdbuf(oldErr);
+
+    // One line per instruction, tracing does not change what the program does
+    EXPECT_EQ(out.str(), "number= 4\n");
+    std::string trace { err.str() };
+    EXPECT_NE(trace.find("kCall"), std::string::npos);
+    EXPECT_NE(trace.find("kEof"), std::string::npos);
+    // Inside f the stack holds the callee, its argument and the result
+    size_t ret { trace.find("kReturn") };
+    ASSERT_NE(ret, std::string::npos);
+    std::string line { trace.substr(0, trace.find('\n', ret)) };
+    line = line.substr(line.rfind('\n') + 1);
+    EXPECT_NE(line.find("f"), std::string::npos);
+    EXPECT_NE(line.find("[ function= <function= f> ][ number= 4 ][ number= 4 ]"), std::string::npos);
+}
+
+TEST_F(VmTest, StreamedSource)
+{
+    // With an 8 byte buffer every lexeme the compiler holds on to for longer
+    // than it may (function and local names) would read garbage
+    std::string path { std::filesystem::temp_directory_path() / "vm_test_streamed.lox" };
+    std::ofstream { path } << R"(
+        fun describe(first, second) {
+            var total = first + second;
+            { var nested = total * 2; total = nested; }
+            return "total " + ((total > 10 and "big") or "small");
+        }
+        print describe(3, 4);
+        print describe(1, 1);
+    )";
+    int fd { open(path.c_str(), O_RDONLY) };
+    ASSERT_NE(fd, -1);
+
+    std::ostringstream out;
+    std::streambuf* old { std::cout.rdbuf(out.rdbuf()) };
+    driver::Driver driver {};
+    mSucceeded = driver.Run(std::make_unique<compiler::StreamSource>(fd, 8));
+    std::cout.rdbuf(old);
+    close(fd);
+    std::filesystem::remove(path);
+
+    EXPECT_TRUE(mSucceeded);
+    EXPECT_EQ(out.str(), "string= total big\nstring= total small\n");
+}
+
+TEST_F(VmTest, UnknownGlobal)
+{
+    EXPECT_EQ(Run("print missing;"), "");
+    EXPECT_FALSE(mSucceeded);
+}
+
+}